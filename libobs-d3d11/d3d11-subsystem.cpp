@@ -275,7 +275,7 @@ ID3D11BlendState *gs_device::AddBlendState()
 		bd.RenderTarget[i].BlendOp        = D3D11_BLEND_OP_ADD;
 		bd.RenderTarget[i].BlendOpAlpha   = D3D11_BLEND_OP_ADD;
 		bd.RenderTarget[i].SrcBlendAlpha  = D3D11_BLEND_ONE;
-		bd.RenderTarget[i].DestBlendAlpha = D3D11_BLEND_ZERO;
+		bd.RenderTarget[i].DestBlendAlpha = D3D11_BLEND_INV_SRC_ALPHA;
 		bd.RenderTarget[i].SrcBlend =
 			ConvertGSBlendType(blendState.srcFactor);
 		bd.RenderTarget[i].DestBlend =
@@ -1089,8 +1089,10 @@ void device_blendfunction(device_t device, enum gs_blend_type src,
 	GLenum gl_src = convert_gs_blend_type(src);
 	GLenum gl_dst = convert_gs_blend_type(dest);
 
-	glBlendFunc(gl_src, gl_dst);
-	if (!gl_success("glBlendFunc"))
+	/* alpha always accumulates coverage, so that translucent draws to a
+	 * cleared render target leave the correct alpha behind */
+	glBlendFuncSeparate(gl_src, gl_dst, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+	if (!gl_success("glBlendFuncSeparate"))
 		blog(LOG_ERROR, "device_blendfunction (GL) failed");
 
 	UNUSED_PARAMETER(device);
@@ -173,6 +173,7 @@ void gs_destroy(graphics_t graphics)
 	pthread_mutex_destroy(&graphics->mutex);
 	da_free(graphics->matrix_stack);
 	da_free(graphics->viewport_stack);
+	da_free(graphics->blend_state_stack);
 	if (graphics->module)
 		os_dlclose(graphics->module);
 	bfree(graphics);
@@ -928,6 +929,32 @@ void gs_perspective(float angle, float aspect, float near, float far)
 			ymin, ymax, near, far);
 }
 
+void gs_blend_state_push(void)
+{
+	graphics_t graphics = thread_graphics;
+	if (!graphics) return;
+
+	da_push_back(graphics->blend_state_stack, &graphics->cur_blend_state);
+}
+
+void gs_blend_state_pop(void)
+{
+	graphics_t graphics = thread_graphics;
+	struct blend_state *state;
+
+	if (!graphics || !graphics->blend_state_stack.num)
+		return;
+
+	state = da_end(graphics->blend_state_stack);
+	if (state->enabled != graphics->cur_blend_state.enabled)
+		gs_enable_blending(state->enabled);
+	if (state->src  != graphics->cur_blend_state.src ||
+	    state->dest != graphics->cur_blend_state.dest)
+		gs_blendfunction(state->src, state->dest);
+
+	da_pop_back(graphics->blend_state_stack);
+}
+
 void gs_reset_blend_state(void)
 {
 	graphics_t graphics = thread_graphics;
@@ -509,6 +509,8 @@ EXPORT void cubetexture_setimage(texture_t cubetex, uint32_t side,
 
 EXPORT void gs_perspective(float fovy, float aspect, float znear, float zfar);
 
+EXPORT void gs_blend_state_push(void);
+EXPORT void gs_blend_state_pop(void);
 EXPORT void gs_reset_blend_state(void);
 
 /* -------------------------- */
@@ -601,6 +603,8 @@ EXPORT void gs_enable_stenciltest(bool enable);
 EXPORT void gs_enable_stencilwrite(bool enable);
 EXPORT void gs_enable_color(bool red, bool green, bool blue, bool alpha);
 
+/* sets the color blend factors.  alpha is always blended with
+ * GS_BLEND_ONE/GS_BLEND_INVSRCALPHA so that it accumulates coverage. */
 EXPORT void gs_blendfunction(enum gs_blend_type src, enum gs_blend_type dest);
 EXPORT void gs_depthfunction(enum gs_depth_test test);
 
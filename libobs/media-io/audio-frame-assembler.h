@@ -0,0 +1,140 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include "../util/circlebuf.h"
+#include "media-io-defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Audio frame assembler
+ *
+ *   Collects audio data of any size and splits it back up in to fixed-size
+ * encoder frames.  Frames are handed out as pointers straight in to the
+ * buffered data, and are only copied when a frame wraps around the end of
+ * the buffer.  The buffers are kept at a multiple of the frame size and
+ * frames are always removed whole, so in practice frames never wrap.
+ *
+ *   Usage: push data, then while audio_frame_assembler_peek returns true,
+ * encode the frame and call audio_frame_assembler_pop.  Pointers returned by
+ * peek are only valid until the next push or pop.
+ */
+
+#define AUDIO_FRAME_ASSEMBLER_FRAMES 4
+
+struct audio_frame_assembler {
+	struct circlebuf buffers[MAX_AV_PLANES];
+	uint8_t          *wrap_data[MAX_AV_PLANES];
+	size_t           planes;
+	size_t           frame_size;
+};
+
+/**
+ * Initializes the assembler
+ *
+ * @param  planes      Number of audio planes
+ * @param  frame_size  Size of one frame of a single plane, in bytes
+ */
+static inline void audio_frame_assembler_init(
+		struct audio_frame_assembler *afa,
+		size_t planes, size_t frame_size)
+{
+	memset(afa, 0, sizeof(struct audio_frame_assembler));
+	afa->planes     = planes;
+	afa->frame_size = frame_size;
+
+	for (size_t i = 0; i < planes; i++)
+		circlebuf_reserve(&afa->buffers[i],
+				frame_size * AUDIO_FRAME_ASSEMBLER_FRAMES);
+}
+
+static inline void audio_frame_assembler_free(
+		struct audio_frame_assembler *afa)
+{
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		circlebuf_free(&afa->buffers[i]);
+		bfree(afa->wrap_data[i]);
+	}
+
+	memset(afa, 0, sizeof(struct audio_frame_assembler));
+}
+
+/** Pushes size bytes of each plane */
+static inline void audio_frame_assembler_push(
+		struct audio_frame_assembler *afa,
+		const uint8_t *const data[], size_t size)
+{
+	if (!size)
+		return;
+
+	for (size_t i = 0; i < afa->planes; i++)
+		circlebuf_push_back(&afa->buffers[i], data[i], size);
+}
+
+/**
+ * Gets the next full frame, if any.
+ *
+ * @param[out]  data  Receives a pointer to the frame data of each plane
+ * @return            true if a full frame is available, false otherwise
+ */
+static inline bool audio_frame_assembler_peek(
+		struct audio_frame_assembler *afa,
+		uint8_t *data[MAX_AV_PLANES])
+{
+	if (!afa->planes || afa->buffers[0].size < afa->frame_size)
+		return false;
+
+	for (size_t i = 0; i < afa->planes; i++) {
+		struct circlebuf *buf = &afa->buffers[i];
+
+		if (buf->start_pos + afa->frame_size <= buf->capacity) {
+			data[i] = (uint8_t*)buf->data + buf->start_pos;
+		} else {
+			if (!afa->wrap_data[i])
+				afa->wrap_data[i] = bmalloc(afa->frame_size);
+
+			circlebuf_peek_front(buf, afa->wrap_data[i],
+					afa->frame_size);
+			data[i] = afa->wrap_data[i];
+		}
+	}
+
+	return true;
+}
+
+/** Removes the frame returned by audio_frame_assembler_peek */
+static inline void audio_frame_assembler_pop(
+		struct audio_frame_assembler *afa)
+{
+	for (size_t i = 0; i < afa->planes; i++)
+		circlebuf_pop_front(&afa->buffers[i], NULL, afa->frame_size);
+}
+
+/** Returns the number of buffered bytes per plane */
+static inline size_t audio_frame_assembler_size(
+		const struct audio_frame_assembler *afa)
+{
+	return afa->buffers[0].size;
+}
+
+#ifdef __cplusplus
+}
+#endif
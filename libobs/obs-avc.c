@@ -19,6 +19,12 @@
 #include "obs-avc.h"
 #include "util/array-serializer.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define AVC_SCAN_SSE2
+#include <emmintrin.h>
+#endif
+
 enum {
 	NAL_UNKNOWN   = 0,
 	NAL_SLICE     = 1,
@@ -33,13 +39,6 @@ enum {
 	NAL_FILLER    = 12,
 };
 
-enum {
-	NAL_PRIORITY_DISPOSABLE = 0,
-	NAL_PRIORITY_LOW        = 1,
-	NAL_PRIORITY_HIGH       = 2,
-	NAL_PRIORITY_HIGHEST    = 3,
-};
-
 /* NOTE: I noticed that FFmpeg does some unusual special handling of certain
  * scenarios that I was unaware of, so instead of just searching for {0, 0, 1}
  * we'll just use the code from FFmpeg - http://www.ffmpeg.org/ */
@@ -81,9 +80,48 @@ static const uint8_t *ff_avc_find_startcode_internal(const uint8_t *p,
 	return end + 3;
 }
 
+#ifdef AVC_SCAN_SSE2
+
+/* tests 16 candidate positions at a time, and leaves the remainder to the
+ * FFmpeg code, so the results are identical: the first {0, 0, 1} that starts
+ * before (end - 3), or end if there isn't one. */
+static const uint8_t *avc_find_startcode_sse2(const uint8_t *p,
+		const uint8_t *end)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one  = _mm_set1_epi8(1);
+
+	for (; end - p >= 16 + 3; p += 16) {
+		__m128i b0 = _mm_loadu_si128((const __m128i*)p);
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(p + 1));
+		__m128i b2 = _mm_loadu_si128((const __m128i*)(p + 2));
+		int mask;
+
+		mask = _mm_movemask_epi8(_mm_and_si128(
+				_mm_and_si128(_mm_cmpeq_epi8(b0, zero),
+				              _mm_cmpeq_epi8(b1, zero)),
+				_mm_cmpeq_epi8(b2, one)));
+
+		if (mask) {
+			while ((mask & 1) == 0) {
+				mask >>= 1;
+				p++;
+			}
+			return p;
+		}
+	}
+
+	return ff_avc_find_startcode_internal(p, end);
+}
+
+#define avc_find_startcode avc_find_startcode_sse2
+#else
+#define avc_find_startcode ff_avc_find_startcode_internal
+#endif
+
 const uint8_t *obs_avc_find_startcode(const uint8_t *p, const uint8_t *end)
 {
-	const uint8_t *out= ff_avc_find_startcode_internal(p, end);
+	const uint8_t *out= avc_find_startcode(p, end);
 	if (p < out && out < end && !out[-1]) out--;
 	return out;
 }
@@ -91,11 +129,11 @@ const uint8_t *obs_avc_find_startcode(const uint8_t *p, const uint8_t *end)
 static inline int get_drop_priority(int priority)
 {
 	switch (priority) {
-	case NAL_PRIORITY_DISPOSABLE: return NAL_PRIORITY_DISPOSABLE;
-	case NAL_PRIORITY_LOW:        return NAL_PRIORITY_LOW;
+	case OBS_NAL_PRIORITY_DISPOSABLE: return OBS_NAL_PRIORITY_DISPOSABLE;
+	case OBS_NAL_PRIORITY_LOW:        return OBS_NAL_PRIORITY_LOW;
 	}
 
-	return NAL_PRIORITY_HIGHEST;
+	return OBS_NAL_PRIORITY_HIGHEST;
 }
 
 static void serialize_avc_data(struct serializer *s, const uint8_t *data,
@@ -0,0 +1,328 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <inttypes.h>
+#include "obs.h"
+#include "obs-internal.h"
+
+obs_encoder_group_t obs_encoder_group_create(video_t video)
+{
+	struct obs_encoder_group *group;
+
+	if (!video)
+		return NULL;
+
+	group = bzalloc(sizeof(struct obs_encoder_group));
+	group->video = video;
+
+	pthread_mutex_init_value(&group->mutex);
+	if (pthread_mutex_init(&group->mutex, NULL) != 0) {
+		bfree(group);
+		return NULL;
+	}
+
+	return group;
+}
+
+static void group_receive_video(void *param, struct video_data *frame);
+
+void obs_encoder_group_destroy(obs_encoder_group_t group)
+{
+	if (!group)
+		return;
+
+	if (group->active_encoders.num) {
+		blog(LOG_WARNING, "obs_encoder_group_destroy: Destroying an "
+		                  "encoder group with active encoders");
+		video_output_disconnect(group->video, group_receive_video,
+				group);
+	}
+
+	for (size_t i = 0; i < group->encoders.num; i++)
+		group->encoders.array[i]->group = NULL;
+
+	for (size_t i = 0; i < group->scalers.num; i++) {
+		struct encoder_group_scaler *gs = group->scalers.array+i;
+		video_scaler_destroy(gs->scaler);
+		video_frame_free(&gs->frame);
+	}
+
+	da_free(group->scalers);
+	da_free(group->active_encoders);
+	da_free(group->encoders);
+	pthread_mutex_destroy(&group->mutex);
+	bfree(group);
+}
+
+bool obs_encoder_group_add(obs_encoder_group_t group, obs_encoder_t encoder)
+{
+	if (!group || !encoder || encoder->info.type != OBS_ENCODER_VIDEO)
+		return false;
+
+	if (encoder->active || encoder->group) {
+		blog(LOG_WARNING, "obs_encoder_group_add: Encoder '%s' is "
+		                  "active or already in a group",
+		                  encoder->context.name);
+		return false;
+	}
+
+	obs_encoder_set_video(encoder, group->video);
+
+	pthread_mutex_lock(&group->mutex);
+	da_push_back(group->encoders, &encoder);
+	encoder->group        = group;
+	encoder->group_scaler = DARRAY_INVALID;
+	pthread_mutex_unlock(&group->mutex);
+
+	return true;
+}
+
+void obs_encoder_group_remove(obs_encoder_group_t group, obs_encoder_t encoder)
+{
+	if (!group || !encoder || encoder->group != group)
+		return;
+
+	if (encoder->active) {
+		blog(LOG_WARNING, "obs_encoder_group_remove: Cannot remove "
+		                  "active encoder '%s'",
+		                  encoder->context.name);
+		return;
+	}
+
+	pthread_mutex_lock(&group->mutex);
+	da_erase_item(group->encoders, &encoder);
+	encoder->group = NULL;
+	pthread_mutex_unlock(&group->mutex);
+}
+
+size_t obs_encoder_group_num_encoders(obs_encoder_group_t group)
+{
+	size_t num;
+
+	if (!group)
+		return 0;
+
+	pthread_mutex_lock(&group->mutex);
+	num = group->encoders.num;
+	pthread_mutex_unlock(&group->mutex);
+
+	return num;
+}
+
+obs_encoder_t obs_encoder_group_get_encoder(obs_encoder_group_t group,
+		size_t idx)
+{
+	obs_encoder_t encoder = NULL;
+
+	if (!group)
+		return NULL;
+
+	pthread_mutex_lock(&group->mutex);
+	if (idx < group->encoders.num)
+		encoder = group->encoders.array[idx];
+	pthread_mutex_unlock(&group->mutex);
+
+	return encoder;
+}
+
+bool obs_encoder_group_keyframes(obs_encoder_t encoder)
+{
+	return encoder && encoder->group && encoder->group->keyint;
+}
+
+void obs_encoder_group_set_keyint(obs_encoder_group_t group, uint32_t keyint)
+{
+	if (group)
+		group->keyint = keyint;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool same_scale_info(const struct video_scale_info *a,
+		const struct video_scale_info *b)
+{
+	return a->format     == b->format &&
+	       a->width      == b->width  &&
+	       a->height     == b->height &&
+	       a->range      == b->range  &&
+	       a->colorspace == b->colorspace;
+}
+
+/* finds or creates the cached scaler for a conversion.  *idx is set to
+ * DARRAY_INVALID if the frame can be used as-is. */
+static bool get_group_scaler(struct obs_encoder_group *group,
+		const struct video_scale_info *conversion, size_t *idx)
+{
+	const struct video_output_info *voi = video_output_getinfo(group->video);
+	struct video_scale_info        from = {0};
+	struct video_scale_info        info;
+	struct encoder_group_scaler    gs;
+	int                            ret;
+
+	*idx = DARRAY_INVALID;
+
+	if (!conversion)
+		return true;
+
+	info = *conversion;
+	if (info.format == VIDEO_FORMAT_NONE)
+		info.format = voi->format;
+	if (!info.width)
+		info.width  = voi->width;
+	if (!info.height)
+		info.height = voi->height;
+
+	if (info.format == voi->format &&
+	    info.width  == voi->width  &&
+	    info.height == voi->height)
+		return true;
+
+	for (size_t i = 0; i < group->scalers.num; i++) {
+		if (same_scale_info(&group->scalers.array[i].info, &info)) {
+			*idx = i;
+			return true;
+		}
+	}
+
+	from.format = voi->format;
+	from.width  = voi->width;
+	from.height = voi->height;
+
+	memset(&gs, 0, sizeof(gs));
+	gs.info = info;
+
+	ret = video_scaler_create(&gs.scaler, &info, &from,
+			VIDEO_SCALE_FAST_BILINEAR);
+	if (ret != VIDEO_SCALER_SUCCESS) {
+		blog(LOG_ERROR, "get_group_scaler: Failed to create scaler "
+		                "for %"PRIu32"x%"PRIu32,
+		                info.width, info.height);
+		return false;
+	}
+
+	video_frame_init(&gs.frame, info.format, info.width, info.height);
+
+	*idx = group->scalers.num;
+	da_push_back(group->scalers, &gs);
+	return true;
+}
+
+bool obs_encoder_group_activate(struct obs_encoder_group *group,
+		struct obs_encoder *encoder,
+		const struct video_scale_info *conversion)
+{
+	bool first;
+
+	pthread_mutex_lock(&group->mutex);
+
+	if (!get_group_scaler(group, conversion, &encoder->group_scaler)) {
+		pthread_mutex_unlock(&group->mutex);
+		return false;
+	}
+
+	first = (group->active_encoders.num == 0);
+	if (first)
+		group->frame_count = 0;
+
+	da_push_back(group->active_encoders, &encoder);
+
+	pthread_mutex_unlock(&group->mutex);
+
+	/* connect outside of the group mutex, the video output holds its own
+	 * input mutex while calling group_receive_video */
+	if (first)
+		video_output_connect(group->video, NULL, group_receive_video,
+				group);
+	return true;
+}
+
+void obs_encoder_group_deactivate(struct obs_encoder_group *group,
+		struct obs_encoder *encoder)
+{
+	bool last;
+
+	pthread_mutex_lock(&group->mutex);
+	da_erase_item(group->active_encoders, &encoder);
+	last = (group->active_encoders.num == 0);
+	pthread_mutex_unlock(&group->mutex);
+
+	if (last)
+		video_output_disconnect(group->video, group_receive_video,
+				group);
+}
+
+/* scales the frame for a rendition, only once per frame no matter how many
+ * encoders use the same rendition */
+static bool scale_group_frame(struct obs_encoder_group *group, size_t idx,
+		struct video_data *frame)
+{
+	struct encoder_group_scaler *gs = group->scalers.array+idx;
+
+	if (!gs->scaled) {
+		gs->scaled = video_scaler_scale(gs->scaler,
+				gs->frame.data, gs->frame.linesize,
+				(const uint8_t * const*)frame->data,
+				frame->linesize);
+		if (!gs->scaled)
+			return false;
+	}
+
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		frame->data[i]     = gs->frame.data[i];
+		frame->linesize[i] = gs->frame.linesize[i];
+	}
+
+	return true;
+}
+
+static void group_receive_video(void *param, struct video_data *frame)
+{
+	struct obs_encoder_group *group = param;
+	bool keyframe;
+
+	pthread_mutex_lock(&group->mutex);
+
+	/* all renditions get keyframes on the same frames, and a requested
+	 * keyframe restarts the interval */
+	if (group->request_keyframe) {
+		group->request_keyframe = false;
+		group->frame_count      = 0;
+		keyframe = true;
+	} else {
+		keyframe = group->keyint &&
+			(group->frame_count % group->keyint) == 0;
+	}
+	group->frame_count++;
+
+	for (size_t i = 0; i < group->scalers.num; i++)
+		group->scalers.array[i].scaled = false;
+
+	for (size_t i = 0; i < group->active_encoders.num; i++) {
+		struct obs_encoder *encoder = group->active_encoders.array[i];
+		struct video_data  scaled   = *frame;
+
+		if (encoder->group_scaler != DARRAY_INVALID &&
+		    !scale_group_frame(group, encoder->group_scaler, &scaled))
+			continue;
+
+		/* frames are only copied in to the encoder's queue here, the
+		 * encoding itself happens on each encoder's encode thread */
+		obs_encoder_receive_video_frame(encoder, &scaled, keyframe);
+	}
+
+	pthread_mutex_unlock(&group->mutex);
+}
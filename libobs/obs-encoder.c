@@ -15,9 +15,17 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 ******************************************************************************/
 
+#include <inttypes.h>
+#include "util/platform.h"
 #include "obs.h"
+#include "obs-avc.h"
 #include "obs-internal.h"
 
+struct encoder_packet_buffer {
+	volatile long refs;
+	uint8_t       *data;
+};
+
 static inline struct obs_encoder_info *get_encoder_info(const char *id)
 {
 	for (size_t i = 0; i < obs->encoder_types.num; i++) {
@@ -36,18 +44,53 @@ const char *obs_encoder_getdisplayname(const char *id)
 	return ei ? ei->getname() : NULL;
 }
 
+#define DEFAULT_QUEUED_FRAMES 3
+
+static const char *encoder_signals[] = {
+	"void overload_level(ptr encoder, int level)",
+	NULL
+};
+
 static bool init_encoder(struct obs_encoder *encoder, const char *name,
 		obs_data_t settings)
 {
+	pthread_mutexattr_t attr;
+
 	pthread_mutex_init_value(&encoder->callbacks_mutex);
 	pthread_mutex_init_value(&encoder->outputs_mutex);
+	pthread_mutex_init_value(&encoder->queue_mutex);
+
+	encoder->queue_policy      = OBS_ENCODER_QUEUE_DROP;
+	encoder->max_queued_frames = DEFAULT_QUEUED_FRAMES;
+	encoder->frame_skip        = 1;
 
 	if (!obs_context_data_init(&encoder->context, settings, name))
 		return false;
-	if (pthread_mutex_init(&encoder->callbacks_mutex, NULL) != 0)
+	if (!signal_handler_add_array(encoder->context.signals,
+				encoder_signals))
 		return false;
+
+	/* recursive so that a packet callback can stop the encoder */
+	if (pthread_mutexattr_init(&attr) != 0)
+		return false;
+	if (pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) != 0) {
+		pthread_mutexattr_destroy(&attr);
+		return false;
+	}
+	if (pthread_mutex_init(&encoder->callbacks_mutex, &attr) != 0) {
+		pthread_mutexattr_destroy(&attr);
+		return false;
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	if (os_event_init(&encoder->stopped_event, OS_EVENT_TYPE_MANUAL) != 0)
+		return false;
+	os_event_signal(encoder->stopped_event);
+
 	if (pthread_mutex_init(&encoder->outputs_mutex, NULL) != 0)
 		return false;
+	if (pthread_mutex_init(&encoder->queue_mutex, NULL) != 0)
+		return false;
 
 	if (encoder->info.defaults)
 		encoder->info.defaults(encoder->context.settings);
@@ -130,7 +173,120 @@ static inline struct video_scale_info *get_video_info(
 	return NULL;
 }
 
-static void add_connection(struct obs_encoder *encoder)
+static void *encode_thread(void *param);
+
+static inline void free_encode_queue(struct obs_encoder *encoder)
+{
+	for (size_t i = 0; i < encoder->queue_size; i++)
+		video_frame_free(&encoder->queue_frames[i].frame);
+	bfree(encoder->queue_frames);
+
+	encoder->queue_frames = NULL;
+	encoder->queue_size   = 0;
+	encoder->queue_start  = 0;
+	encoder->queue_num    = 0;
+}
+
+static inline bool on_encode_thread(struct obs_encoder *encoder)
+{
+	return encoder->encode_thread_active &&
+		pthread_equal(pthread_self(), encoder->encode_thread);
+}
+
+static void free_encode_thread_data(struct obs_encoder *encoder)
+{
+	os_sem_destroy(encoder->encode_sem);
+	os_event_destroy(encoder->queue_space_event);
+	encoder->encode_sem        = NULL;
+	encoder->queue_space_event = NULL;
+
+	free_encode_queue(encoder);
+	encoder->encode_thread_active = false;
+}
+
+static void stop_encode_thread(struct obs_encoder *encoder)
+{
+	void *thread_ret;
+
+	if (!encoder->encode_thread_active)
+		return;
+
+	encoder->encode_thread_exit = true;
+	os_sem_post(encoder->encode_sem);
+
+	/* stopped from a packet callback: the thread exits by itself once the
+	 * queue is empty, and is joined the next time it's stopped */
+	if (on_encode_thread(encoder))
+		return;
+
+	pthread_join(encoder->encode_thread, &thread_ret);
+	free_encode_thread_data(encoder);
+}
+
+static void init_encode_queue(struct obs_encoder *encoder)
+{
+	const struct video_output_info *voi;
+	struct video_scale_info info = {0};
+
+	voi = video_output_getinfo(encoder->media);
+
+	encoder->frame_format = voi->format;
+	encoder->frame_width  = voi->width;
+	encoder->frame_height = voi->height;
+
+	if (get_video_info(encoder, &info)) {
+		if (info.format != VIDEO_FORMAT_NONE)
+			encoder->frame_format = info.format;
+		if (info.width)
+			encoder->frame_width  = info.width;
+		if (info.height)
+			encoder->frame_height = info.height;
+	}
+
+	encoder->queue_size   = encoder->max_queued_frames;
+	encoder->queue_frames = bzalloc(sizeof(struct encoder_queued_frame) *
+			encoder->queue_size);
+
+	for (size_t i = 0; i < encoder->queue_size; i++)
+		video_frame_init(&encoder->queue_frames[i].frame,
+				encoder->frame_format,
+				encoder->frame_width, encoder->frame_height);
+}
+
+static bool start_encode_thread(struct obs_encoder *encoder)
+{
+	/* thread may have exited on its own after an encoding error */
+	stop_encode_thread(encoder);
+
+	init_encode_queue(encoder);
+	encoder->encode_thread_exit = false;
+
+	if (os_sem_init(&encoder->encode_sem, 0) != 0)
+		goto fail;
+	if (os_event_init(&encoder->queue_space_event,
+				OS_EVENT_TYPE_AUTO) != 0)
+		goto fail;
+	if (pthread_create(&encoder->encode_thread, NULL, encode_thread,
+				encoder) != 0)
+		goto fail;
+
+	encoder->encode_thread_active = true;
+	return true;
+
+fail:
+	blog(LOG_WARNING, "Failed to start encode thread for encoder '%s', "
+	                  "encoding on the video thread instead",
+	                  encoder->context.name);
+
+	os_sem_destroy(encoder->encode_sem);
+	os_event_destroy(encoder->queue_space_event);
+	encoder->encode_sem        = NULL;
+	encoder->queue_space_event = NULL;
+	free_encode_queue(encoder);
+	return false;
+}
+
+static bool add_connection(struct obs_encoder *encoder)
 {
 	struct audio_convert_info audio_info = {0};
 	struct video_scale_info   video_info = {0};
@@ -142,12 +298,26 @@ static void add_connection(struct obs_encoder *encoder)
 	} else {
 		struct video_scale_info *info = NULL;
 
+		start_encode_thread(encoder);
+
 		info = get_video_info(encoder, &video_info);
-		video_output_connect(encoder->media, info, receive_video,
-				encoder);
+
+		if (!encoder->group) {
+			video_output_connect(encoder->media, info,
+					receive_video, encoder);
+
+		} else if (!obs_encoder_group_activate(encoder->group, encoder,
+					info)) {
+			blog(LOG_ERROR, "add_connection: Encoder '%s' could "
+			                "not be added to its group",
+			                encoder->context.name);
+			stop_encode_thread(encoder);
+			return false;
+		}
 	}
 
 	encoder->active = true;
+	return true;
 }
 
 static void remove_connection(struct obs_encoder *encoder)
@@ -155,6 +325,8 @@ static void remove_connection(struct obs_encoder *encoder)
 	if (encoder->info.type == OBS_ENCODER_AUDIO)
 		audio_output_disconnect(encoder->media, receive_audio,
 				encoder);
+	else if (encoder->group)
+		obs_encoder_group_deactivate(encoder->group, encoder);
 	else
 		video_output_disconnect(encoder->media, receive_video,
 				encoder);
@@ -164,11 +336,7 @@ static void remove_connection(struct obs_encoder *encoder)
 
 static inline void free_audio_buffers(struct obs_encoder *encoder)
 {
-	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
-		circlebuf_free(&encoder->audio_input_buffer[i]);
-		bfree(encoder->audio_output_buffer[i]);
-		encoder->audio_output_buffer[i] = NULL;
-	}
+	audio_frame_assembler_free(&encoder->audio_frames);
 }
 
 static void obs_encoder_actually_destroy(obs_encoder_t encoder)
@@ -184,13 +352,19 @@ static void obs_encoder_actually_destroy(obs_encoder_t encoder)
 
 		blog(LOG_INFO, "encoder '%s' destroyed", encoder->context.name);
 
+		if (encoder->group)
+			obs_encoder_group_remove(encoder->group, encoder);
+
+		stop_encode_thread(encoder);
 		free_audio_buffers(encoder);
 
 		if (encoder->context.data)
 			encoder->info.destroy(encoder->context.data);
 		da_free(encoder->callbacks);
+		os_event_destroy(encoder->stopped_event);
 		pthread_mutex_destroy(&encoder->callbacks_mutex);
 		pthread_mutex_destroy(&encoder->outputs_mutex);
+		pthread_mutex_destroy(&encoder->queue_mutex);
 		obs_context_data_free(&encoder->context);
 		bfree(encoder);
 	}
@@ -270,6 +444,10 @@ void obs_encoder_update(obs_encoder_t encoder, obs_data_t settings)
 	if (encoder->info.update && encoder->context.data)
 		encoder->info.update(encoder->context.data,
 				encoder->context.settings);
+
+	/* not all settings can be changed on the fly, so a pre-warmed encoder
+	 * must be recreated the next time it's started */
+	encoder->reinit_needed = true;
 }
 
 bool obs_encoder_get_extra_data(obs_encoder_t encoder, uint8_t **extra_data,
@@ -293,10 +471,8 @@ obs_data_t obs_encoder_get_settings(obs_encoder_t encoder)
 static inline void reset_audio_buffers(struct obs_encoder *encoder)
 {
 	free_audio_buffers(encoder);
-
-	for (size_t i = 0; i < encoder->planes; i++)
-		encoder->audio_output_buffer[i] =
-			bmalloc(encoder->framesize_bytes);
+	audio_frame_assembler_init(&encoder->audio_frames, encoder->planes,
+			encoder->framesize_bytes);
 }
 
 static void intitialize_audio_encoder(struct obs_encoder *encoder)
@@ -313,6 +489,35 @@ static void intitialize_audio_encoder(struct obs_encoder *encoder)
 	reset_audio_buffers(encoder);
 }
 
+static inline bool can_reuse_encoder(struct obs_encoder *encoder)
+{
+	return encoder->prewarm && encoder->info.reset &&
+		!encoder->reinit_needed &&
+		encoder->info.reset(encoder->context.data);
+}
+
+/* puts a pre-warmed encoder back in its configured state for a new
+ * session.  the first frame of the session must be a keyframe. */
+static void reuse_encoder(struct obs_encoder *encoder)
+{
+	if ((encoder->cur_bitrate || encoder->frame_skip > 1) &&
+	    encoder->info.set_bitrate) {
+		uint32_t bitrate = (uint32_t)obs_data_getint(
+				encoder->context.settings, "bitrate");
+		if (bitrate)
+			encoder->info.set_bitrate(encoder->context.data,
+					bitrate);
+	}
+
+	if (encoder->speed_level && encoder->info.set_speed_level)
+		encoder->info.set_speed_level(encoder->context.data, 0);
+
+	obs_encoder_request_keyframe(encoder);
+
+	blog(LOG_DEBUG, "encoder '%s': reusing pre-warmed encoder",
+			encoder->context.name);
+}
+
 bool obs_encoder_initialize(obs_encoder_t encoder)
 {
 	if (!encoder) return false;
@@ -320,16 +525,37 @@ bool obs_encoder_initialize(obs_encoder_t encoder)
 	if (encoder->active)
 		return true;
 
-	if (encoder->context.data)
-		encoder->info.destroy(encoder->context.data);
+	/* make sure no queued frame is still being encoded */
+	stop_encode_thread(encoder);
 
-	encoder->context.data = encoder->info.create(encoder->context.settings,
-			encoder);
-	if (!encoder->context.data)
-		return false;
+	if (encoder->context.data && can_reuse_encoder(encoder)) {
+		reuse_encoder(encoder);
+
+	} else {
+		if (encoder->context.data)
+			encoder->info.destroy(encoder->context.data);
+
+		encoder->context.data = encoder->info.create(
+				encoder->context.settings, encoder);
+		if (!encoder->context.data)
+			return false;
+
+		encoder->reinit_needed = false;
+	}
 
 	encoder->paired_encoder  = NULL;
 	encoder->start_ts        = 0;
+	encoder->target_bitrate  = 0;
+	encoder->cur_bitrate     = 0;
+	encoder->overload_level  = 0;
+	encoder->speed_level     = 0;
+	encoder->window_frames   = 0;
+	encoder->window_late     = 0;
+	encoder->window_time     = 0;
+	encoder->good_windows    = 0;
+	encoder->frame_skip      = 1;
+	encoder->frame_index     = 0;
+	encoder->stats.overload_level = 0;
 
 	if (encoder->info.type == OBS_ENCODER_AUDIO)
 		intitialize_audio_encoder(encoder);
@@ -352,17 +578,25 @@ static inline size_t get_callback_idx(
 	return DARRAY_INVALID;
 }
 
-void obs_encoder_start(obs_encoder_t encoder,
+bool obs_encoder_start(obs_encoder_t encoder,
 		void (*new_packet)(void *param, struct encoder_packet *packet),
 		void *param)
 {
 	struct encoder_callback cb = {false, new_packet, param};
 	bool first   = false;
 
-	if (!encoder || !new_packet || !encoder->context.data) return;
+	if (!encoder || !new_packet || !encoder->context.data) return false;
 
 	pthread_mutex_lock(&encoder->callbacks_mutex);
 
+	/* the last callback is being stopped, wait until the encoder has been
+	 * disconnected so that it's connected again for this one */
+	while (encoder->stopping) {
+		pthread_mutex_unlock(&encoder->callbacks_mutex);
+		os_event_wait(encoder->stopped_event);
+		pthread_mutex_lock(&encoder->callbacks_mutex);
+	}
+
 	first = (encoder->callbacks.num == 0);
 
 	size_t idx = get_callback_idx(encoder, new_packet, param);
@@ -373,8 +607,18 @@ void obs_encoder_start(obs_encoder_t encoder,
 
 	if (first) {
 		encoder->cur_pts = 0;
-		add_connection(encoder);
+
+		if (!add_connection(encoder)) {
+			pthread_mutex_lock(&encoder->callbacks_mutex);
+			idx = get_callback_idx(encoder, new_packet, param);
+			if (idx != DARRAY_INVALID)
+				da_erase(encoder->callbacks, idx);
+			pthread_mutex_unlock(&encoder->callbacks_mutex);
+			return false;
+		}
 	}
+
+	return true;
 }
 
 void obs_encoder_stop(obs_encoder_t encoder,
@@ -387,19 +631,35 @@ void obs_encoder_stop(obs_encoder_t encoder,
 	if (!encoder) return;
 
 	pthread_mutex_lock(&encoder->callbacks_mutex);
-
-	idx = get_callback_idx(encoder, new_packet, param);
-	if (idx != DARRAY_INVALID) {
-		da_erase(encoder->callbacks, idx);
-		last = (encoder->callbacks.num == 0);
+	idx  = get_callback_idx(encoder, new_packet, param);
+	last = (idx != DARRAY_INVALID && encoder->callbacks.num == 1);
+	if (last) {
+		encoder->stopping = true;
+		os_event_reset(encoder->stopped_event);
 	}
-
 	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
+	/* the encode thread finishes the queued frames before it exits, so
+	 * the last callback is only removed afterward to get their packets */
 	if (last) {
 		remove_connection(encoder);
+		stop_encode_thread(encoder);
+	}
+
+	pthread_mutex_lock(&encoder->callbacks_mutex);
+	idx = get_callback_idx(encoder, new_packet, param);
+	if (idx != DARRAY_INVALID)
+		da_erase(encoder->callbacks, idx);
+	if (last) {
+		encoder->stopping = false;
+		os_event_signal(encoder->stopped_event);
+	}
+	pthread_mutex_unlock(&encoder->callbacks_mutex);
 
-		if (encoder->destroy_on_stop)
+	if (last && encoder->destroy_on_stop) {
+		if (on_encode_thread(encoder))
+			encoder->destroy_pending = true;
+		else
 			obs_encoder_actually_destroy(encoder);
 	}
 }
@@ -418,9 +678,10 @@ void obs_encoder_set_video(obs_encoder_t encoder, video_t video)
 
 	voi = video_output_getinfo(video);
 
-	encoder->media        = video;
-	encoder->timebase_num = voi->fps_den;
-	encoder->timebase_den = voi->fps_num;
+	encoder->media         = video;
+	encoder->timebase_num  = voi->fps_den;
+	encoder->timebase_den  = voi->fps_num;
+	encoder->reinit_needed = true;
 }
 
 void obs_encoder_set_audio(obs_encoder_t encoder, audio_t audio)
@@ -428,9 +689,10 @@ void obs_encoder_set_audio(obs_encoder_t encoder, audio_t audio)
 	if (!audio || !encoder || encoder->info.type != OBS_ENCODER_AUDIO)
 		return;
 
-	encoder->media        = audio;
-	encoder->timebase_num = 1;
-	encoder->timebase_den = audio_output_samplerate(audio);
+	encoder->media         = audio;
+	encoder->timebase_num  = 1;
+	encoder->timebase_den  = audio_output_samplerate(audio);
+	encoder->reinit_needed = true;
 }
 
 video_t obs_encoder_video(obs_encoder_t encoder)
@@ -458,6 +720,37 @@ static inline bool get_sei(struct obs_encoder *encoder,
 	return false;
 }
 
+static inline bool is_avc_encoder(const struct obs_encoder *encoder)
+{
+	return encoder->info.type == OBS_ENCODER_VIDEO &&
+		encoder->info.codec && strcmp(encoder->info.codec, "h264") == 0;
+}
+
+static inline void share_packet_data(struct encoder_packet *packet)
+{
+	struct encoder_packet_buffer *buffer = bmalloc(sizeof(*buffer));
+	buffer->refs   = 1;
+	buffer->data   = packet->data;
+	packet->buffer = buffer;
+}
+
+/* creates the single shared copy of the encoder's packet that is passed to
+ * all outputs, converting H.264 to AVCC here rather than in each output
+ * (unless the encoder already outputs AVCC) */
+static void create_shared_packet(struct obs_encoder *encoder,
+		struct encoder_packet *out, const struct encoder_packet *in)
+{
+	if (is_avc_encoder(encoder) &&
+	    (encoder->info.caps & OBS_ENCODER_CAP_AVCC) == 0) {
+		obs_parse_avc_packet(out, in);
+	} else {
+		*out = *in;
+		out->data = bmemdup(in->data, in->size);
+	}
+
+	share_packet_data(out);
+}
+
 static void send_first_video_packet(struct obs_encoder *encoder,
 		struct encoder_callback *cb, struct encoder_packet *packet)
 {
@@ -477,12 +770,28 @@ static void send_first_video_packet(struct obs_encoder *encoder,
 		return;
 	}
 
-	da_push_back_array(data, sei, size);
+	/* packet data has already been converted to AVCC, so the SEI must
+	 * be converted as well */
+	if (is_avc_encoder(encoder)) {
+		struct encoder_packet sei_packet = {0};
+		struct encoder_packet avc_sei;
+
+		sei_packet.data = sei;
+		sei_packet.size = size;
+		obs_parse_avc_packet(&avc_sei, &sei_packet);
+
+		da_push_back_array(data, avc_sei.data, avc_sei.size);
+		bfree(avc_sei.data);
+	} else {
+		da_push_back_array(data, sei, size);
+	}
+
 	da_push_back_array(data, packet->data, packet->size);
 
-	first_packet      = *packet;
-	first_packet.data = data.array;
-	first_packet.size = data.num;
+	first_packet        = *packet;
+	first_packet.data   = data.array;
+	first_packet.size   = data.num;
+	first_packet.buffer = NULL;
 
 	cb->new_packet(cb->param, &first_packet);
 	cb->sent_first_packet = true;
@@ -503,6 +812,13 @@ static inline void send_packet(struct obs_encoder *encoder,
 static void full_stop(struct obs_encoder *encoder)
 {
 	if (encoder) {
+		/* if called from the encode thread, make sure the video thread
+		 * isn't left waiting on the queue */
+		if (encoder->encode_thread_active) {
+			encoder->encode_thread_exit = true;
+			os_event_signal(encoder->queue_space_event);
+		}
+
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 		da_free(encoder->callbacks);
 		remove_connection(encoder);
@@ -510,18 +826,205 @@ static void full_stop(struct obs_encoder *encoder)
 	}
 }
 
+/* rate control assumes every frame is encoded, so while frames are skipped
+ * the bitrate is scaled up to keep the same number of bits per frame and the
+ * same bitrate over time */
+static inline bool set_scaled_bitrate(struct obs_encoder *encoder,
+		uint32_t bitrate)
+{
+	return encoder->info.set_bitrate(encoder->context.data,
+			bitrate * encoder->frame_skip);
+}
+
+static inline void apply_target_bitrate(struct obs_encoder *encoder)
+{
+	long bitrate = encoder->target_bitrate;
+
+	if (!bitrate || bitrate == encoder->cur_bitrate)
+		return;
+
+	if (set_scaled_bitrate(encoder, (uint32_t)bitrate))
+		blog(LOG_INFO, "encoder '%s': bitrate changed to %ld kbps",
+				encoder->context.name, bitrate);
+	else
+		blog(LOG_WARNING, "encoder '%s': failed to change bitrate "
+		                  "to %ld kbps",
+		                  encoder->context.name, bitrate);
+
+	/* don't retry on every frame if it failed */
+	encoder->cur_bitrate = bitrate;
+}
+
+/* overload protection: frames are looked at in windows of
+ * OVERLOAD_WINDOW_FRAMES.  if at least OVERLOAD_LATE_PERCENT of the frames in
+ * a window took longer than the frame interval, the overload level is raised.
+ * it is lowered after RECOVER_WINDOWS windows in a row where the average
+ * encode time would be under RECOVER_PERCENT of the interval at the lower
+ * level. */
+#define OVERLOAD_WINDOW_FRAMES 60
+#define OVERLOAD_LATE_PERCENT  50
+#define RECOVER_PERCENT        60
+#define RECOVER_WINDOWS        5
+
+static inline uint64_t frame_budget(struct obs_encoder *encoder,
+		uint32_t frame_skip)
+{
+	return (uint64_t)encoder->timebase_num * 1000000000ULL * frame_skip /
+		encoder->timebase_den;
+}
+
+static inline int max_overload_level(struct obs_encoder *encoder)
+{
+	int max_level = encoder->info.set_speed_level ?
+		encoder->overload_info.max_speed_level : 0;
+
+	return encoder->overload_info.allow_frame_skip ?
+		max_level + 1 : max_level;
+}
+
+static inline int speed_steps(struct obs_encoder *encoder)
+{
+	return encoder->info.set_speed_level ?
+		encoder->overload_info.max_speed_level : 0;
+}
+
+static inline uint32_t level_frame_skip(struct obs_encoder *encoder,
+		int level)
+{
+	return level > speed_steps(encoder) ? 2 : 1;
+}
+
+static void set_overload_level(struct obs_encoder *encoder, int level)
+{
+	struct calldata params = {0};
+	int speed_level = level;
+	uint32_t frame_skip = level_frame_skip(encoder, level);
+
+	if (speed_level > speed_steps(encoder))
+		speed_level = speed_steps(encoder);
+
+	if (speed_level != encoder->speed_level) {
+		if (encoder->info.set_speed_level(encoder->context.data,
+					speed_level))
+			encoder->speed_level = speed_level;
+	}
+
+	if (frame_skip != encoder->frame_skip) {
+		uint32_t bitrate = encoder->cur_bitrate ?
+			(uint32_t)encoder->cur_bitrate :
+			(uint32_t)obs_data_getint(encoder->context.settings,
+					"bitrate");
+
+		encoder->frame_skip = frame_skip;
+		if (bitrate && encoder->info.set_bitrate)
+			set_scaled_bitrate(encoder, bitrate);
+	}
+
+	encoder->overload_level = level;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->stats.overload_level = level;
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	blog(LOG_INFO, "encoder '%s': overload level changed to %d "
+	               "(speed level %d, frame skip %"PRIu32")",
+	               encoder->context.name, level, encoder->speed_level,
+	               encoder->frame_skip);
+
+	calldata_setptr(&params, "encoder", encoder);
+	calldata_setint(&params, "level", level);
+	signal_handler_signal(encoder->context.signals, "overload_level",
+			&params);
+	calldata_free(&params);
+}
+
+static void check_overload(struct obs_encoder *encoder, uint64_t encode_time,
+		uint64_t budget)
+{
+	uint64_t avg_time;
+	int      level = encoder->overload_level;
+
+	encoder->window_frames++;
+	encoder->window_time += encode_time;
+	if (encode_time > budget)
+		encoder->window_late++;
+
+	if (encoder->window_frames < OVERLOAD_WINDOW_FRAMES)
+		return;
+
+	avg_time = encoder->window_time / encoder->window_frames;
+
+	if (encoder->window_late * 100 >=
+	    encoder->window_frames * OVERLOAD_LATE_PERCENT) {
+		encoder->good_windows = 0;
+
+		if (level < max_overload_level(encoder))
+			set_overload_level(encoder, level + 1);
+
+	} else if (level > 0 && avg_time * 100 <= RECOVER_PERCENT *
+			frame_budget(encoder, level_frame_skip(encoder,
+					level - 1))) {
+		if (++encoder->good_windows >= RECOVER_WINDOWS) {
+			encoder->good_windows = 0;
+			set_overload_level(encoder, level - 1);
+		}
+
+	} else {
+		encoder->good_windows = 0;
+	}
+
+	encoder->window_frames = 0;
+	encoder->window_late   = 0;
+	encoder->window_time   = 0;
+}
+
+static void update_encode_time(struct obs_encoder *encoder,
+		uint64_t encode_time)
+{
+	struct obs_encoder_stats *stats  = &encoder->stats;
+	uint64_t                 budget  = frame_budget(encoder,
+			encoder->frame_skip);
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	stats->frames_encoded++;
+	stats->last_encode_time = encode_time;
+	stats->avg_encode_time  = stats->avg_encode_time ?
+		(stats->avg_encode_time * 15 + encode_time) / 16 : encode_time;
+
+	if (encode_time > stats->max_encode_time)
+		stats->max_encode_time = encode_time;
+	if (encode_time > budget)
+		stats->frames_late++;
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	if (encoder->overload_enabled)
+		check_overload(encoder, encode_time, budget);
+}
+
 static inline void do_encode(struct obs_encoder *encoder,
 		struct encoder_frame *frame)
 {
 	struct encoder_packet pkt = {0};
 	bool received = false;
 	bool success;
+	uint64_t start_time;
+
+	if (encoder->info.set_bitrate)
+		apply_target_bitrate(encoder);
 
 	pkt.timebase_num = encoder->timebase_num;
 	pkt.timebase_den = encoder->timebase_den;
+	pkt.encoder      = encoder;
 
+	start_time = os_gettime_ns();
 	success = encoder->info.encode(encoder->context.data, frame, &pkt,
 			&received);
+
+	if (encoder->info.type == OBS_ENCODER_VIDEO)
+		update_encode_time(encoder, os_gettime_ns() - start_time);
+
 	if (!success) {
 		full_stop(encoder);
 		blog(LOG_ERROR, "Error encoding with encoder '%s'",
@@ -530,27 +1033,205 @@ static inline void do_encode(struct obs_encoder *encoder,
 	}
 
 	if (received) {
+		struct encoder_packet shared_pkt;
+
 		/* we use system time here to ensure sync with other encoders,
 		 * you do not want to use relative timestamps here */
 		pkt.dts_usec = encoder->start_ts / 1000 + packet_dts_usec(&pkt);
 
 		pthread_mutex_lock(&encoder->callbacks_mutex);
 
-		for (size_t i = 0; i < encoder->callbacks.num; i++) {
-			struct encoder_callback *cb;
-			cb = encoder->callbacks.array+i;
-			send_packet(encoder, cb, &pkt);
+		if (encoder->callbacks.num) {
+			create_shared_packet(encoder, &shared_pkt, &pkt);
+
+			for (size_t i = 0; i < encoder->callbacks.num; i++) {
+				struct encoder_callback *cb;
+				cb = encoder->callbacks.array+i;
+				send_packet(encoder, cb, &shared_pkt);
+			}
+
+			obs_encoder_packet_release(&shared_pkt);
 		}
 
 		pthread_mutex_unlock(&encoder->callbacks_mutex);
 	}
 }
 
-static void receive_video(void *param, struct video_data *frame)
+static void *encode_thread(void *param)
+{
+	struct obs_encoder *encoder = param;
+
+	while (os_sem_wait(encoder->encode_sem) == 0) {
+		struct encoder_queued_frame *qf;
+		struct encoder_frame        enc_frame;
+
+		/* every queued frame posts once, so the queue is only empty
+		 * for the post made when stopping.  frames still queued at
+		 * that point are encoded first. */
+		pthread_mutex_lock(&encoder->queue_mutex);
+		if (!encoder->queue_num) {
+			pthread_mutex_unlock(&encoder->queue_mutex);
+			if (encoder->encode_thread_exit)
+				break;
+			continue;
+		}
+
+		qf = encoder->queue_frames + encoder->queue_start;
+		pthread_mutex_unlock(&encoder->queue_mutex);
+
+		memset(&enc_frame, 0, sizeof(struct encoder_frame));
+
+		for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+			enc_frame.data[i]     = qf->frame.data[i];
+			enc_frame.linesize[i] = qf->frame.linesize[i];
+		}
+
+		enc_frame.frames   = 1;
+		enc_frame.pts      = qf->pts;
+		enc_frame.keyframe = qf->keyframe;
+
+		do_encode(encoder, &enc_frame);
+
+		pthread_mutex_lock(&encoder->queue_mutex);
+		if (++encoder->queue_start == encoder->queue_size)
+			encoder->queue_start = 0;
+		encoder->queue_num--;
+		pthread_mutex_unlock(&encoder->queue_mutex);
+
+		os_event_signal(encoder->queue_space_event);
+	}
+
+	/* destroyed from one of its own packet callbacks, see
+	 * obs_encoder_stop */
+	if (encoder->destroy_pending) {
+		pthread_detach(encoder->encode_thread);
+		free_encode_thread_data(encoder);
+		obs_encoder_actually_destroy(encoder);
+	}
+
+	return NULL;
+}
+
+static inline uint32_t get_plane_height(enum video_format format,
+		size_t plane, uint32_t height)
+{
+	if (plane > 0 && (format == VIDEO_FORMAT_I420 ||
+	                  format == VIDEO_FORMAT_NV12))
+		return height / 2;
+	return height;
+}
+
+static void copy_video_data(struct obs_encoder *encoder,
+		struct video_frame *dst, const struct video_data *src)
+{
+	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
+		uint32_t height;
+		uint32_t src_linesize = src->linesize[i];
+		uint32_t dst_linesize = dst->linesize[i];
+		uint32_t row_size;
+
+		if (!dst->data[i] || !src->data[i])
+			break;
+
+		height = get_plane_height(encoder->frame_format, i,
+				encoder->frame_height);
+
+		if (src_linesize == dst_linesize) {
+			memcpy(dst->data[i], src->data[i],
+					(size_t)src_linesize * height);
+			continue;
+		}
+
+		row_size = src_linesize < dst_linesize ?
+			src_linesize : dst_linesize;
+
+		for (uint32_t y = 0; y < height; y++)
+			memcpy(dst->data[i] + y * dst_linesize,
+			       src->data[i] + y * src_linesize, row_size);
+	}
+}
+
+/* returns false if the frame could not be queued and was dropped */
+static bool queue_video(struct obs_encoder *encoder,
+		struct video_data *frame, bool keyframe)
+{
+	struct encoder_queued_frame *qf;
+	size_t idx;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+
+	while (encoder->queue_num == encoder->queue_size) {
+		if (encoder->queue_policy == OBS_ENCODER_QUEUE_DROP ||
+		    encoder->encode_thread_exit) {
+			/* don't lose a keyframe request with the frame */
+			if (keyframe)
+				obs_encoder_request_keyframe(encoder);
+
+			encoder->stats.frames_dropped++;
+			pthread_mutex_unlock(&encoder->queue_mutex);
+			return false;
+		}
+
+		pthread_mutex_unlock(&encoder->queue_mutex);
+		os_event_wait(encoder->queue_space_event);
+		pthread_mutex_lock(&encoder->queue_mutex);
+	}
+
+	idx = (encoder->queue_start + encoder->queue_num) % encoder->queue_size;
+	qf  = encoder->queue_frames + idx;
+
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	/* the encode thread does not touch free slots, so this can be done
+	 * without holding the lock */
+	copy_video_data(encoder, &qf->frame, frame);
+	qf->pts      = encoder->cur_pts;
+	qf->keyframe = keyframe;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	encoder->queue_num++;
+	encoder->stats.frames_queued++;
+	if (encoder->queue_num > encoder->stats.max_queue_depth)
+		encoder->stats.max_queue_depth = (uint32_t)encoder->queue_num;
+	pthread_mutex_unlock(&encoder->queue_mutex);
+
+	os_sem_post(encoder->encode_sem);
+	return true;
+}
+
+void obs_encoder_receive_video_frame(struct obs_encoder *encoder,
+		struct video_data *frame, bool keyframe)
 {
-	struct obs_encoder    *encoder  = param;
 	struct encoder_frame  enc_frame;
 
+	if (!encoder->start_ts)
+		encoder->start_ts = frame->timestamp;
+
+	if (encoder->request_keyframe)
+		keyframe = true;
+
+	/* overload protection may be skipping every other frame, but a frame
+	 * that has to be a keyframe is never skipped */
+	if (encoder->frame_skip > 1 &&
+	    (encoder->frame_index++ % encoder->frame_skip) != 0 &&
+	    !keyframe) {
+		pthread_mutex_lock(&encoder->queue_mutex);
+		encoder->stats.frames_skipped++;
+		pthread_mutex_unlock(&encoder->queue_mutex);
+
+		encoder->cur_pts += encoder->timebase_num;
+		return;
+	}
+
+	/* only cleared once the frame carrying the request is sent on */
+	encoder->request_keyframe = false;
+
+	if (encoder->encode_thread_active) {
+		queue_video(encoder, frame, keyframe);
+		encoder->cur_pts += encoder->timebase_num;
+		return;
+	}
+
 	memset(&enc_frame, 0, sizeof(struct encoder_frame));
 
 	for (size_t i = 0; i < MAX_AV_PLANES; i++) {
@@ -558,17 +1239,20 @@ static void receive_video(void *param, struct video_data *frame)
 		enc_frame.linesize[i] = frame->linesize[i];
 	}
 
-	if (!encoder->start_ts)
-		encoder->start_ts = frame->timestamp;
-
-	enc_frame.frames = 1;
-	enc_frame.pts    = encoder->cur_pts;
+	enc_frame.frames   = 1;
+	enc_frame.pts      = encoder->cur_pts;
+	enc_frame.keyframe = keyframe;
 
 	do_encode(encoder, &enc_frame);
 
 	encoder->cur_pts += encoder->timebase_num;
 }
 
+static void receive_video(void *param, struct video_data *frame)
+{
+	obs_encoder_receive_video_frame(param, frame, false);
+}
+
 static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
 {
 	size_t samplerate = encoder->samplerate;
@@ -601,27 +1285,28 @@ static bool buffer_audio(struct obs_encoder *encoder, struct audio_data *data)
 
 	size -= offset_size;
 
-	/* push in to the circular buffer */
-	if (size)
+	if (size) {
+		const uint8_t *planes[MAX_AV_PLANES] = {0};
+
 		for (size_t i = 0; i < encoder->planes; i++)
-			circlebuf_push_back(&encoder->audio_input_buffer[i],
-					data->data[i] + offset_size, size);
+			planes[i] = data->data[i] + offset_size;
+
+		audio_frame_assembler_push(&encoder->audio_frames, planes,
+				size);
+	}
 
 	return true;
 }
 
-static void send_audio_data(struct obs_encoder *encoder)
+static void send_audio_data(struct obs_encoder *encoder,
+		uint8_t *data[MAX_AV_PLANES])
 {
 	struct encoder_frame  enc_frame;
 
 	memset(&enc_frame, 0, sizeof(struct encoder_frame));
 
 	for (size_t i = 0; i < encoder->planes; i++) {
-		circlebuf_pop_front(&encoder->audio_input_buffer[i],
-				encoder->audio_output_buffer[i],
-				encoder->framesize_bytes);
-
-		enc_frame.data[i]     = encoder->audio_output_buffer[i];
+		enc_frame.data[i]     = data[i];
 		enc_frame.linesize[i] = (uint32_t)encoder->framesize_bytes;
 	}
 
@@ -636,12 +1321,16 @@ static void send_audio_data(struct obs_encoder *encoder)
 static void receive_audio(void *param, struct audio_data *data)
 {
 	struct obs_encoder *encoder = param;
+	uint8_t            *frame[MAX_AV_PLANES];
 
 	if (!buffer_audio(encoder, data))
 		return;
 
-	while (encoder->audio_input_buffer[0].size >= encoder->framesize_bytes)
-		send_audio_data(encoder);
+	/* frames are encoded straight from the assembler's buffers */
+	while (audio_frame_assembler_peek(&encoder->audio_frames, frame)) {
+		send_audio_data(encoder, frame);
+		audio_frame_assembler_pop(&encoder->audio_frames);
+	}
 }
 
 void obs_encoder_add_output(struct obs_encoder *encoder,
@@ -664,15 +1353,143 @@ void obs_encoder_remove_output(struct obs_encoder *encoder,
 	pthread_mutex_unlock(&encoder->outputs_mutex);
 }
 
+void obs_encoder_set_queue_policy(obs_encoder_t encoder,
+		enum obs_encoder_queue_policy policy, size_t max_frames)
+{
+	if (!encoder) return;
+
+	encoder->queue_policy      = policy;
+	encoder->max_queued_frames = max_frames ?
+		max_frames : DEFAULT_QUEUED_FRAMES;
+}
+
+bool obs_encoder_get_stats(obs_encoder_t encoder,
+		struct obs_encoder_stats *stats)
+{
+	if (!encoder || !stats) return false;
+
+	pthread_mutex_lock(&encoder->queue_mutex);
+	*stats = encoder->stats;
+	stats->queue_depth = (uint32_t)encoder->queue_num;
+	pthread_mutex_unlock(&encoder->queue_mutex);
+	return true;
+}
+
+void obs_encoder_request_keyframe(obs_encoder_t encoder)
+{
+	if (!encoder || encoder->info.type != OBS_ENCODER_VIDEO)
+		return;
+
+	/* a keyframe in one rendition alone would break their alignment */
+	if (encoder->group)
+		encoder->group->request_keyframe = true;
+	else
+		encoder->request_keyframe = true;
+}
+
+bool obs_encoder_set_prewarm(obs_encoder_t encoder, bool prewarm)
+{
+	if (!encoder || !encoder->info.reset)
+		return false;
+
+	encoder->prewarm = prewarm;
+
+	if (prewarm && !encoder->context.data && encoder->media)
+		return obs_encoder_initialize(encoder);
+
+	return true;
+}
+
+signal_handler_t obs_encoder_signalhandler(obs_encoder_t encoder)
+{
+	return encoder ? encoder->context.signals : NULL;
+}
+
+void obs_encoder_set_overload_protection(obs_encoder_t encoder,
+		const struct obs_encoder_overload_info *info)
+{
+	if (!encoder || encoder->info.type != OBS_ENCODER_VIDEO)
+		return;
+
+	if (encoder->active) {
+		blog(LOG_WARNING, "obs_encoder_set_overload_protection: "
+		                  "Cannot change overload protection while "
+		                  "encoder '%s' is active",
+		                  encoder->context.name);
+		return;
+	}
+
+	encoder->overload_enabled = (info != NULL);
+	if (info) {
+		encoder->overload_info = *info;
+		if (encoder->overload_info.max_speed_level < 0)
+			encoder->overload_info.max_speed_level = 0;
+	}
+}
+
+bool obs_encoder_set_bitrate(obs_encoder_t encoder, uint32_t bitrate)
+{
+	if (!encoder || !encoder->info.set_bitrate || !bitrate)
+		return false;
+
+	encoder->target_bitrate = (long)bitrate;
+	return true;
+}
+
+uint32_t obs_encoder_get_bitrate(obs_encoder_t encoder)
+{
+	long bitrate;
+
+	if (!encoder) return 0;
+
+	bitrate = encoder->target_bitrate;
+	if (bitrate)
+		return (uint32_t)bitrate;
+
+	return (uint32_t)obs_data_getint(encoder->context.settings, "bitrate");
+}
+
 void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src)
 {
 	*dst = *src;
-	dst->data = bmemdup(src->data, src->size);
+	dst->data   = bmemdup(src->data, src->size);
+	dst->buffer = NULL;
 }
 
 void obs_free_encoder_packet(struct encoder_packet *packet)
 {
-	bfree(packet->data);
+	obs_encoder_packet_release(packet);
+}
+
+void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src)
+{
+	if (!dst || !src)
+		return;
+
+	if (src->buffer) {
+		os_atomic_inc_long(&src->buffer->refs);
+		*dst = *src;
+	} else {
+		obs_duplicate_encoder_packet(dst, src);
+		share_packet_data(dst);
+	}
+}
+
+void obs_encoder_packet_release(struct encoder_packet *packet)
+{
+	if (!packet)
+		return;
+
+	if (packet->buffer) {
+		if (os_atomic_dec_long(&packet->buffer->refs) == 0) {
+			bfree(packet->buffer->data);
+			bfree(packet->buffer);
+		}
+	} else {
+		bfree(packet->data);
+	}
+
 	memset(packet, 0, sizeof(struct encoder_packet));
 }
@@ -23,7 +23,19 @@ enum obs_encoder_type {
 	OBS_ENCODER_VIDEO
 };
 
-/** Encoder output packet */
+struct encoder_packet_buffer;
+
+/**
+ * Encoder output packet
+ *
+ *   Packets received by outputs are reference counted and shared between
+ * all outputs using the encoder.  Outputs that need to keep a packet must
+ * take a reference with obs_encoder_packet_ref and later release it with
+ * obs_encoder_packet_release.
+ *
+ *   H.264 packets are delivered to outputs in AVCC (length-prefixed) form;
+ * the conversion from Annex-B is done once by libobs.
+ */
 struct encoder_packet {
 	uint8_t               *data;        /**< Packet data */
 	size_t                size;         /**< Packet size */
@@ -59,6 +71,12 @@ struct encoder_packet {
 	 * priority or higher to continue transmission.
 	 */
 	int                   drop_priority;
+
+	/** Shared packet data (NULL if the packet data is not shared) */
+	struct encoder_packet_buffer *buffer;
+
+	/** Encoder that produced the packet (set by libobs) */
+	obs_encoder_t         encoder;
 };
 
 /** Encoder input frame */
@@ -74,8 +92,59 @@ struct encoder_frame {
 
 	/** Presentation timestamp */
 	int64_t               pts;
+
+	/** Encode this frame as a keyframe (video only) */
+	bool                  keyframe;
+};
+
+/** What to do with new video frames when the encoder queue is full */
+enum obs_encoder_queue_policy {
+	OBS_ENCODER_QUEUE_DROP,  /**< Drop the new frame */
+	OBS_ENCODER_QUEUE_BLOCK  /**< Wait for the encoder to catch up */
+};
+
+/** Encoder statistics */
+struct obs_encoder_stats {
+	uint32_t              queue_depth;     /**< Frames currently queued */
+	uint32_t              max_queue_depth; /**< Highest queue depth */
+	uint32_t              frames_queued;   /**< Total frames queued */
+	uint32_t              frames_dropped;  /**< Frames dropped (full queue) */
+
+	uint32_t              frames_encoded;  /**< Total frames encoded */
+	uint32_t              frames_late;     /**< Frames over the time budget */
+	uint32_t              frames_skipped;  /**< Frames skipped (overload) */
+	uint64_t              last_encode_time;/**< Last encode time (ns) */
+	uint64_t              avg_encode_time; /**< Average encode time (ns) */
+	uint64_t              max_encode_time; /**< Highest encode time (ns) */
+	int                   overload_level;  /**< Overload protection level */
 };
 
+/**
+ * Encoder overload protection bounds
+ *
+ *   When a video encoder takes longer than the frame interval to encode most
+ * frames for a sustained period, the overload level is raised one step.
+ * The first max_speed_level steps ask the encoder to trade quality for
+ * speed (for example, a faster x264 preset).  If allow_frame_skip is set,
+ * the last step halves the encoded frame rate.  Levels are lowered again
+ * when there is enough headroom.
+ */
+struct obs_encoder_overload_info {
+	int                   max_speed_level;  /**< Maximum speed steps */
+	bool                  allow_frame_skip; /**< Allow halving frame rate */
+};
+
+/**
+ * Encoder outputs H.264 packets in AVCC (length-prefixed) form rather than
+ * Annex-B.
+ *
+ *   When set, libobs does not scan/convert the encoded packets, so the
+ * encoder must also fill in the keyframe, priority and drop_priority
+ * members of each packet itself.  Extra data and SEI data are still
+ * expected in Annex-B form.
+ */
+#define OBS_ENCODER_CAP_AVCC (1<<0)
+
 /**
  * Encoder interface
  *
@@ -99,6 +168,9 @@ struct obs_encoder_info {
 	/** Specifies the codec */
 	const char *codec;
 
+	/** Encoder capability flags (OBS_ENCODER_CAP_*) */
+	uint32_t caps;
+
 	/**
 	 * Gets the full translated name of this encoder
 	 *
@@ -209,6 +281,41 @@ struct obs_encoder_info {
 	 *                    otherwise
 	 */
 	bool (*video_info)(void *data, struct video_scale_info *info);
+
+	/**
+	 * Changes the bitrate while the encoder is active.  Always called
+	 * from the thread doing the encoding, between frames.  Encoders with
+	 * a rate control buffer should scale it along with the bitrate.
+	 *
+	 * @param  data     Data associated with this encoder context
+	 * @param  bitrate  New bitrate, in kbps
+	 * @return          true if successful, false otherwise
+	 */
+	bool (*set_bitrate)(void *data, uint32_t bitrate);
+
+	/**
+	 * Changes the speed/quality trade-off while the encoder is active.
+	 * Always called from the thread doing the encoding, between frames.
+	 *
+	 * @param  data   Data associated with this encoder context
+	 * @param  level  0 for the configured settings, each level above that
+	 *                is one step faster (and lower quality)
+	 * @return        true if successful, false otherwise
+	 */
+	bool (*set_speed_level)(void *data, int level);
+
+	/**
+	 * Discards any frames still buffered in the encoder so that it can be
+	 * reused for a new session without being recreated.  Required for
+	 * obs_encoder_set_prewarm.  An encoder that can't discard delayed
+	 * frames may switch to a new internal context here instead, ideally
+	 * one it has prepared ahead of time.
+	 *
+	 * @param  data  Data associated with this encoder context
+	 * @return       true if the encoder can be reused, false if it must
+	 *               be recreated
+	 */
+	bool (*reset)(void *data);
 };
 
 EXPORT void obs_register_encoder_s(const struct obs_encoder_info *info,
@@ -29,7 +29,10 @@
 
 #include "media-io/audio-resampler.h"
 #include "media-io/video-io.h"
+#include "media-io/video-frame.h"
+#include "media-io/video-scaler.h"
 #include "media-io/audio-io.h"
+#include "media-io/audio-frame-assembler.h"
 
 #include "obs.h"
 
@@ -89,6 +92,27 @@ extern bool obs_display_init(struct obs_display *display,
 extern void obs_display_free(struct obs_display *display);
 
 
+/* ------------------------------------------------------------------------- */
+/* tick pool */
+
+#define NUM_TICK_THREADS 3
+
+struct obs_tick_pool {
+	pthread_t                       threads[NUM_TICK_THREADS];
+	size_t                          num_threads;
+	os_sem_t                        start_sem;
+	os_sem_t                        done_sem;
+	bool                            exit;
+
+	DARRAY(struct obs_source*)      sources;
+	volatile long                   next_idx;
+	float                           seconds;
+};
+
+extern bool obs_tick_pool_init(struct obs_tick_pool *pool);
+extern void obs_tick_pool_free(struct obs_tick_pool *pool);
+
+
 /* ------------------------------------------------------------------------- */
 /* core */
 
@@ -125,7 +149,12 @@ struct obs_core_video {
 	uint32_t                        base_width;
 	uint32_t                        base_height;
 
+	/* incremented once per video frame, used to invalidate per-frame
+	 * source caches */
+	uint64_t                        frame_count;
+
 	struct obs_display              main_display;
+	struct obs_tick_pool            tick_pool;
 };
 
 struct obs_core_audio {
@@ -240,6 +269,16 @@ struct obs_source {
 	/* prevents infinite recursion when enumerating sources */
 	volatile long                   enum_refs;
 
+	/* performance counters */
+	struct obs_source_stats         stats;
+
+	/* idle-when-unused policy.  the source is suspended once it has been
+	 * neither shown nor active for idle_delay nanoseconds */
+	bool                            idle_when_unused;
+	uint64_t                        idle_delay;
+	uint64_t                        unused_since;
+	bool                            suspended;
+
 	/* used to indicate that the source has been removed and all
 	 * references to it should be released (not exactly how I would prefer
 	 * to handle things but it's the best option) */
@@ -322,6 +361,16 @@ struct obs_source {
 	pthread_mutex_t                 filter_mutex;
 	texrender_t                     filter_texrender;
 	bool                            rendering_filter;
+
+	/* render cache.  when a source that allows caching was drawn more
+	 * than once in the last frame, the first draw of the frame goes to
+	 * render_cache and any further draws just use its texture */
+	texrender_t                     render_cache;
+	uint64_t                        render_frame;
+	uint64_t                        cache_frame;
+	uint32_t                        frame_renders;
+	uint32_t                        last_frame_renders;
+	bool                            rendering_cache;
 };
 
 extern bool obs_source_init_context(struct obs_source *source,
@@ -338,12 +387,28 @@ enum view_type {
 
 extern void obs_source_activate(obs_source_t source, enum view_type type);
 extern void obs_source_deactivate(obs_source_t source, enum view_type type);
+extern bool obs_source_update_idle(obs_source_t source, uint64_t sys_time);
+extern void obs_source_video_pretick(obs_source_t source);
 extern void obs_source_video_tick(obs_source_t source, float seconds);
+extern void obs_source_call_tick(obs_source_t source, float seconds);
 
 
 /* ------------------------------------------------------------------------- */
 /* outputs  */
 
+/* one FIFO per encoder feeding the output, added when the encoder's first
+ * packet arrives.  each encoder's packets are already in dts order, so the
+ * interleaver only has to merge the fronts of the tracks */
+struct interleave_track {
+	obs_encoder_t                   encoder;
+	struct circlebuf                packets;
+};
+
+struct interleaved_packet {
+	struct encoder_packet           packet;
+	uint64_t                        queue_time;
+};
+
 struct obs_output {
 	struct obs_context_data         context;
 	struct obs_output_info          info;
@@ -353,10 +418,12 @@ struct obs_output {
 	int64_t                         first_video_ts;
 	int64_t                         video_offset;
 	int64_t                         audio_offset;
-	int64_t                         highest_audio_ts;
-	int64_t                         highest_video_ts;
 	pthread_mutex_t                 interleaved_mutex;
-	DARRAY(struct encoder_packet)   interleaved_packets;
+	DARRAY(struct interleave_track) interleave_tracks;
+	size_t                          interleave_track_count;
+	size_t                          interleave_queued;
+	uint64_t                        interleave_total_wait;
+	struct obs_output_interleave_stats interleave_stats;
 
 	int                             reconnect_retry_sec;
 	int                             reconnect_retry_max;
@@ -396,6 +463,12 @@ struct encoder_callback {
 	void *param;
 };
 
+struct encoder_queued_frame {
+	struct video_frame              frame;
+	int64_t                         pts;
+	bool                            keyframe;
+};
+
 struct obs_encoder {
 	struct obs_context_data         context;
 	struct obs_encoder_info         info;
@@ -413,8 +486,7 @@ struct obs_encoder {
 
 	int64_t                         cur_pts;
 
-	struct circlebuf                audio_input_buffer[MAX_AV_PLANES];
-	uint8_t                         *audio_output_buffer[MAX_AV_PLANES];
+	struct audio_frame_assembler    audio_frames;
 
 	/* if a video encoder is paired with an audio encoder, make it start
 	 * up at the specific timestamp.  if this is the audio encoder,
@@ -429,16 +501,76 @@ struct obs_encoder {
 
 	bool                            destroy_on_stop;
 
+	/* set while the last callback is being stopped, obs_encoder_start
+	 * waits on stopped_event until the encoder is disconnected */
+	bool                            stopping;
+	os_event_t                      stopped_event;
+
+	/* destroyed from one of its own packet callbacks, encode_thread
+	 * finishes the destruction when it exits */
+	bool                            destroy_pending;
+
 	/* stores the video/audio media output pointer.  video_t or audio_t */
 	void                            *media;
 
 	pthread_mutex_t                 callbacks_mutex;
 	DARRAY(struct encoder_callback) callbacks;
+
+	/* video frames are queued by the video thread and encoded on
+	 * encode_thread.  queue_frames is a ring of queue_size buffers, the
+	 * frame at queue_start is the one being encoded */
+	pthread_t                       encode_thread;
+	bool                            encode_thread_active;
+	bool                            encode_thread_exit;
+	os_sem_t                        encode_sem;
+	os_event_t                      queue_space_event;
+	pthread_mutex_t                 queue_mutex;
+	struct encoder_queued_frame     *queue_frames;
+	size_t                          queue_size;
+	size_t                          queue_start;
+	size_t                          queue_num;
+	enum obs_encoder_queue_policy   queue_policy;
+	size_t                          max_queued_frames;
+	enum video_format               frame_format;
+	uint32_t                        frame_width;
+	uint32_t                        frame_height;
+
+	struct obs_encoder_stats        stats;
+
+	/* bitrate requested with obs_encoder_set_bitrate (0 if none), and the
+	 * bitrate last applied by the encoding thread */
+	volatile long                   target_bitrate;
+	long                            cur_bitrate;
+
+	/* pre-warm: keep the encoder initialized between sessions, see
+	 * can_reuse_encoder */
+	bool                            prewarm;
+	bool                            reinit_needed;
+
+	/* forces the next video frame to be a keyframe */
+	volatile bool                   request_keyframe;
+
+	/* overload protection, see check_overload */
+	bool                            overload_enabled;
+	struct obs_encoder_overload_info overload_info;
+	int                             overload_level;
+	int                             speed_level;
+	uint32_t                        window_frames;
+	uint32_t                        window_late;
+	uint64_t                        window_time;
+	uint32_t                        good_windows;
+	uint32_t                        frame_skip;
+	uint64_t                        frame_index;
+
+	/* encoder group this encoder belongs to, if any, and the index of the
+	 * group scaler used for this encoder (DARRAY_INVALID if none) */
+	struct obs_encoder_group        *group;
+	size_t                          group_scaler;
 };
 
 extern bool obs_encoder_initialize(obs_encoder_t encoder);
 
-extern void obs_encoder_start(obs_encoder_t encoder,
+extern bool obs_encoder_start(obs_encoder_t encoder,
 		void (*new_packet)(void *param, struct encoder_packet *packet),
 		void *param);
 extern void obs_encoder_stop(obs_encoder_t encoder,
@@ -450,6 +582,45 @@ extern void obs_encoder_add_output(struct obs_encoder *encoder,
 extern void obs_encoder_remove_output(struct obs_encoder *encoder,
 		struct obs_output *output);
 
+extern void obs_encoder_receive_video_frame(struct obs_encoder *encoder,
+		struct video_data *frame, bool keyframe);
+
+
+/* ------------------------------------------------------------------------- */
+/* encoder groups */
+
+struct encoder_group_scaler {
+	struct video_scale_info         info;
+	video_scaler_t                  scaler;
+	struct video_frame              frame;
+	bool                            scaled;
+};
+
+struct obs_encoder_group {
+	video_t                         video;
+
+	pthread_mutex_t                 mutex;
+	DARRAY(struct obs_encoder*)     encoders;
+	DARRAY(struct obs_encoder*)     active_encoders;
+
+	/* scalers are cached for the lifetime of the group, one per distinct
+	 * rendition size/format */
+	DARRAY(struct encoder_group_scaler) scalers;
+
+	uint32_t                        keyint;
+	uint64_t                        frame_count;
+
+	/* keyframes requested for any member are forced on every member so
+	 * that renditions stay aligned, see obs_encoder_request_keyframe */
+	volatile bool                   request_keyframe;
+};
+
+extern bool obs_encoder_group_activate(struct obs_encoder_group *group,
+		struct obs_encoder *encoder,
+		const struct video_scale_info *conversion);
+extern void obs_encoder_group_deactivate(struct obs_encoder_group *group,
+		struct obs_encoder *encoder);
+
 /* ------------------------------------------------------------------------- */
 /* services */
 
@@ -42,15 +42,48 @@ static const char *output_signals[] = {
 	"void stop(ptr output, int code)",
 	"void reconnect(ptr output)",
 	"void reconnect_success(ptr output)",
+	"void target_bitrate(ptr output, int bitrate)",
 	NULL
 };
 
+static void get_stats_proc(void *param, calldata_t data)
+{
+	struct obs_output_stats st;
+	obs_output_get_stats(param, &st);
+
+	calldata_setint(data, "total_bytes",       (long long)st.total_bytes);
+	calldata_setint(data, "total_frames",      st.total_frames);
+	calldata_setint(data, "dropped_frames",    st.dropped_frames);
+	calldata_setint(data, "buffered_packets",  st.buffered_packets);
+	calldata_setint(data, "buffered_duration",
+			(long long)st.buffered_duration);
+	calldata_setint(data, "send_queue_bytes",
+			(long long)st.send_queue_bytes);
+	calldata_setint(data, "rtt",               (long long)st.rtt);
+	calldata_setint(data, "avg_send_time",     (long long)st.avg_send_time);
+	calldata_setint(data, "max_send_time",     (long long)st.max_send_time);
+	calldata_setint(data, "throughput",        st.throughput);
+	calldata_setint(data, "bandwidth_estimate", st.bandwidth_estimate);
+	calldata_setbool(data, "congested",        st.congested);
+}
+
+static const char *get_stats_decl =
+	"void get_stats(out int total_bytes, out int total_frames, "
+		"out int dropped_frames, out int buffered_packets, "
+		"out int buffered_duration, out int send_queue_bytes, "
+		"out int rtt, out int avg_send_time, out int max_send_time, "
+		"out int throughput, out int bandwidth_estimate, "
+		"out bool congested)";
+
 static bool init_output_handlers(struct obs_output *output, const char *name,
 		obs_data_t settings)
 {
 	if (!obs_context_data_init(&output->context, settings, name))
 		return false;
 
+	proc_handler_add(output->context.procs, get_stats_decl,
+			get_stats_proc, output);
+
 	signal_handler_add_array(output->context.signals, output_signals);
 	return true;
 }
@@ -108,9 +141,20 @@ fail:
 
 static inline void free_packets(struct obs_output *output)
 {
-	for (size_t i = 0; i < output->interleaved_packets.num; i++)
-		obs_free_encoder_packet(output->interleaved_packets.array+i);
-	da_free(output->interleaved_packets);
+	for (size_t i = 0; i < output->interleave_tracks.num; i++) {
+		struct circlebuf *track = &output->interleave_tracks.array[i].packets;
+
+		while (track->size) {
+			struct interleaved_packet ip;
+			circlebuf_pop_front(track, &ip, sizeof(ip));
+			obs_encoder_packet_release(&ip.packet);
+		}
+
+		circlebuf_free(track);
+	}
+
+	da_free(output->interleave_tracks);
+	output->interleave_queued = 0;
 }
 
 void obs_output_destroy(obs_output_t output)
@@ -365,6 +409,33 @@ int obs_output_get_total_frames(obs_output_t output)
 	return output ? output->total_frames : 0;
 }
 
+bool obs_output_get_stats(obs_output_t output, struct obs_output_stats *stats)
+{
+	if (!output || !stats) return false;
+
+	memset(stats, 0, sizeof(struct obs_output_stats));
+
+	if (output->context.data && output->info.get_stats)
+		output->info.get_stats(output->context.data, stats);
+
+	stats->total_bytes    = obs_output_get_total_bytes(output);
+	stats->total_frames   = obs_output_get_total_frames(output);
+	stats->dropped_frames = obs_output_get_frames_dropped(output);
+	return true;
+}
+
+bool obs_output_get_interleave_stats(obs_output_t output,
+		struct obs_output_interleave_stats *stats)
+{
+	if (!output || !stats) return false;
+
+	pthread_mutex_lock(&output->interleaved_mutex);
+	*stats = output->interleave_stats;
+	stats->queue_depth = (uint32_t)output->interleave_queued;
+	pthread_mutex_unlock(&output->interleaved_mutex);
+	return true;
+}
+
 void obs_output_set_video_conversion(obs_output_t output,
 		const struct video_scale_info *conversion)
 {
@@ -455,7 +526,7 @@ static bool prepare_interleaved_packet(struct obs_output *output,
 		offset = output->audio_offset;
 	}
 
-	obs_duplicate_encoder_packet(out, in);
+	obs_encoder_packet_ref(out, in);
 	out->dts -= offset;
 	out->pts -= offset;
 
@@ -469,69 +540,112 @@ static bool prepare_interleaved_packet(struct obs_output *output,
 	return true;
 }
 
-static inline bool has_higher_opposing_ts(struct obs_output *output,
-		struct encoder_packet *packet)
+static struct circlebuf *get_interleave_track(struct obs_output *output,
+		obs_encoder_t encoder)
 {
-	if (packet->type == OBS_ENCODER_VIDEO)
-		return output->highest_audio_ts > packet->dts_usec;
-	else
-		return output->highest_video_ts > packet->dts_usec;
+	struct interleave_track *track;
+
+	for (size_t i = 0; i < output->interleave_tracks.num; i++) {
+		track = output->interleave_tracks.array+i;
+		if (track->encoder == encoder)
+			return &track->packets;
+	}
+
+	track = da_push_back_new(output->interleave_tracks);
+	track->encoder = encoder;
+	return &track->packets;
 }
 
-static inline void send_interleaved(struct obs_output *output)
+/* returns the track whose front packet has the lowest dts, or
+ * DARRAY_INVALID if any track is empty or has not received its first packet
+ * yet.  a packet can only be sent once every track has something queued,
+ * otherwise a packet with a lower timestamp could still arrive on the empty
+ * track. */
+static size_t next_interleave_track(struct obs_output *output)
 {
-	struct encoder_packet out = output->interleaved_packets.array[0];
+	size_t  next     = DARRAY_INVALID;
+	int64_t next_dts = 0;
 
-	/* do not send an interleaved packet if there's no packet of the
-	 * opposing type of a higher timstamp in the interleave buffer.
-	 * this ensures that the timestamps are monotonic */
-	if (!has_higher_opposing_ts(output, &out))
-		return;
+	if (output->interleave_tracks.num < output->interleave_track_count)
+		return DARRAY_INVALID;
 
-	if (out.type == OBS_ENCODER_VIDEO)
-		output->total_frames++;
+	for (size_t i = 0; i < output->interleave_tracks.num; i++) {
+		struct circlebuf *track =
+			&output->interleave_tracks.array[i].packets;
+		struct interleaved_packet front;
+
+		if (!track->size)
+			return DARRAY_INVALID;
+
+		circlebuf_peek_front(track, &front, sizeof(front));
+		if (next == DARRAY_INVALID ||
+		    front.packet.dts_usec < next_dts) {
+			next     = i;
+			next_dts = front.packet.dts_usec;
+		}
+	}
 
-	da_erase(output->interleaved_packets, 0);
-	output->info.encoded_packet(output->context.data, &out);
-	obs_free_encoder_packet(&out);
+	return next;
 }
 
-static inline void set_higher_ts(struct obs_output *output,
-		struct encoder_packet *packet)
+static inline void update_interleave_stats(struct obs_output *output,
+		uint64_t queue_time)
 {
-	if (packet->type == OBS_ENCODER_VIDEO) {
-		if (output->highest_video_ts < packet->dts_usec)
-			output->highest_video_ts = packet->dts_usec;
-	} else {
-		if (output->highest_audio_ts < packet->dts_usec)
-			output->highest_audio_ts = packet->dts_usec;
+	struct obs_output_interleave_stats *stats = &output->interleave_stats;
+	uint64_t wait = os_gettime_ns() - queue_time;
+
+	output->interleave_total_wait += wait;
+
+	stats->packets_sent++;
+	stats->last_wait_time = wait;
+	stats->avg_wait_time  = output->interleave_total_wait /
+		stats->packets_sent;
+	if (wait > stats->max_wait_time)
+		stats->max_wait_time = wait;
+}
+
+static void send_interleaved(struct obs_output *output)
+{
+	size_t idx;
+
+	while ((idx = next_interleave_track(output)) != DARRAY_INVALID) {
+		struct interleaved_packet ip;
+		struct circlebuf *track =
+			&output->interleave_tracks.array[idx].packets;
+
+		circlebuf_pop_front(track, &ip, sizeof(ip));
+		output->interleave_queued--;
+		update_interleave_stats(output, ip.queue_time);
+
+		if (ip.packet.type == OBS_ENCODER_VIDEO)
+			output->total_frames++;
+
+		output->info.encoded_packet(output->context.data, &ip.packet);
+		obs_encoder_packet_release(&ip.packet);
 	}
 }
 
 static void interleave_packets(void *data, struct encoder_packet *packet)
 {
-	struct obs_output     *output = data;
-	struct encoder_packet out;
-	size_t                idx;
+	struct obs_output         *output = data;
+	struct interleaved_packet ip;
 
 	pthread_mutex_lock(&output->interleaved_mutex);
 
-	if (prepare_interleaved_packet(output, &out, packet)) {
-		for (idx = 0; idx < output->interleaved_packets.num; idx++) {
-			struct encoder_packet *cur_packet;
-			cur_packet = output->interleaved_packets.array + idx;
+	if (prepare_interleaved_packet(output, &ip.packet, packet)) {
+		struct obs_output_interleave_stats *stats =
+			&output->interleave_stats;
 
-			if (out.dts_usec < cur_packet->dts_usec)
-				break;
-		}
+		ip.queue_time = os_gettime_ns();
+		circlebuf_push_back(
+				get_interleave_track(output, ip.packet.encoder),
+				&ip, sizeof(ip));
 
-		da_insert(output->interleaved_packets, idx, &out);
-		set_higher_ts(output, &out);
+		if (++output->interleave_queued > stats->max_queue_depth)
+			stats->max_queue_depth =
+				(uint32_t)output->interleave_queued;
 
-		/* when both video and audio have been received, we're ready
-		 * to start sending out packets (one at a time) */
-		if (output->received_audio && output->received_video)
-			send_interleaved(output);
+		send_interleaved(output);
 	}
 
 	pthread_mutex_unlock(&output->interleaved_mutex);
@@ -553,24 +667,33 @@ static void default_raw_video_callback(void *param, struct video_data *frame)
 	output->total_frames++;
 }
 
-static void hook_data_capture(struct obs_output *output, bool encoded,
+static bool hook_data_capture(struct obs_output *output, bool encoded,
 		bool has_video, bool has_audio)
 {
 	void (*encoded_callback)(void *data, struct encoder_packet *packet);
 
 	if (encoded) {
+		pthread_mutex_lock(&output->interleaved_mutex);
 		output->received_video   = false;
 		output->received_video   = false;
-		output->highest_audio_ts = 0;
-		output->highest_video_ts = 0;
+		output->interleave_track_count =
+			(has_video ? 1 : 0) + (has_audio ? 1 : 0);
 		free_packets(output);
+		pthread_mutex_unlock(&output->interleaved_mutex);
 
 		encoded_callback = (has_video && has_audio) ?
 			interleave_packets : default_encoded_callback;
 
-		if (has_video)
-			obs_encoder_start(output->video_encoder,
-					encoded_callback, output);
+		if (has_video) {
+			if (!obs_encoder_start(output->video_encoder,
+						encoded_callback, output))
+				return false;
+
+			/* if the encoder is already running for another
+			 * output (or this output is reconnecting), don't wait
+			 * for its next keyframe */
+			obs_encoder_request_keyframe(output->video_encoder);
+		}
 		if (has_audio)
 			obs_encoder_start(output->audio_encoder,
 					encoded_callback, output);
@@ -585,6 +708,8 @@ static void hook_data_capture(struct obs_output *output, bool encoded,
 					output->info.raw_audio,
 					output->context.data);
 	}
+
+	return true;
 }
 
 static inline void do_output_signal(struct obs_output *output,
@@ -694,7 +819,12 @@ bool obs_output_begin_data_capture(obs_output_t output, uint32_t flags)
 				has_service))
 		return false;
 
-	hook_data_capture(output, encoded, has_video, has_audio);
+	if (!hook_data_capture(output, encoded, has_video, has_audio)) {
+		blog(LOG_WARNING, "obs_output_begin_data_capture: Failed to "
+		                  "start the video encoder of '%s'",
+		                  output->context.name);
+		return false;
+	}
 
 	if (has_service)
 		obs_service_activate(output->service);
@@ -812,3 +942,20 @@ void obs_output_signal_stop(obs_output_t output, int code)
 	else
 		signal_stop(output, code);
 }
+
+void obs_output_set_target_bitrate(obs_output_t output, uint32_t bitrate)
+{
+	struct calldata params = {0};
+
+	if (!output || !bitrate)
+		return;
+
+	if (output->video_encoder)
+		obs_encoder_set_bitrate(output->video_encoder, bitrate);
+
+	calldata_setptr(&params, "output", output);
+	calldata_setint(&params, "bitrate", (long long)bitrate);
+	signal_handler_signal(output->context.signals, "target_bitrate",
+			&params);
+	calldata_free(&params);
+}
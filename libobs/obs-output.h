@@ -25,6 +25,36 @@
 
 struct encoder_packet;
 
+/**
+ * Output statistics.  The congestion fields are only filled in by network
+ * outputs, and are left at 0 by outputs that do not track them.
+ */
+struct obs_output_stats {
+	uint64_t total_bytes;             /**< Total bytes sent */
+	int      total_frames;            /**< Total video frames sent */
+	int      dropped_frames;          /**< Video frames dropped */
+
+	uint32_t buffered_packets;        /**< Packets waiting to be sent */
+	uint64_t buffered_duration;       /**< Duration of waiting packets (us) */
+	uint64_t send_queue_bytes;        /**< Bytes in the socket send queue */
+	uint64_t rtt;                     /**< Round trip time (us) */
+	uint64_t avg_send_time;           /**< Average send call time (ns) */
+	uint64_t max_send_time;           /**< Highest send call time (ns) */
+	uint32_t throughput;              /**< Achieved throughput (kbps) */
+	uint32_t bandwidth_estimate;      /**< Estimated bandwidth (kbps) */
+	bool     congested;               /**< Whether data is backing up */
+};
+
+/** Interleave statistics, only used when both audio and video are encoded */
+struct obs_output_interleave_stats {
+	uint32_t queue_depth;        /**< Packets currently waiting */
+	uint32_t max_queue_depth;    /**< Highest number of waiting packets */
+	uint64_t packets_sent;       /**< Total interleaved packets sent */
+	uint64_t last_wait_time;     /**< Wait time of the last packet (ns) */
+	uint64_t avg_wait_time;      /**< Average wait time (ns) */
+	uint64_t max_wait_time;      /**< Highest wait time (ns) */
+};
+
 struct obs_output_info {
 	/* required */
 	const char *id;
@@ -56,6 +86,8 @@ struct obs_output_info {
 	uint64_t (*total_bytes)(void *data);
 
 	int (*dropped_frames)(void *data);
+
+	void (*get_stats)(void *data, struct obs_output_stats *stats);
 };
 
 EXPORT void obs_register_output_s(const struct obs_output_info *info,
@@ -53,8 +53,9 @@ static void *scene_create(obs_data_t settings, struct obs_source *source)
 {
 	pthread_mutexattr_t attr;
 	struct obs_scene *scene = bmalloc(sizeof(struct obs_scene));
-	scene->source     = source;
-	scene->first_item = NULL;
+	scene->source       = source;
+	scene->first_item   = NULL;
+	scene->culled_items = 0;
 
 	signal_handler_add_array(obs_source_signalhandler(source),
 			obs_scene_signals);
@@ -297,13 +298,102 @@ static inline bool source_size_changed(struct obs_scene_item *item)
 	return item->last_width != width || item->last_height != height;
 }
 
+static void get_item_rect(const struct obs_scene_item *item,
+		struct vec2 *min, struct vec2 *max)
+{
+	vec2_set(min, M_INFINITE, M_INFINITE);
+	vec2_set(max, -M_INFINITE, -M_INFINITE);
+
+	for (int i = 0; i < 4; i++) {
+		struct vec3 corner;
+		vec3_set(&corner, (float)(i & 1), (float)(i >> 1), 0.0f);
+		vec3_transform(&corner, &corner, &item->box_transform);
+
+		min->x = fminf(min->x, corner.x);
+		min->y = fminf(min->y, corner.y);
+		max->x = fmaxf(max->x, corner.x);
+		max->y = fmaxf(max->y, corner.y);
+	}
+}
+
+static bool item_off_canvas(const struct obs_scene_item *item,
+		float cx, float cy)
+{
+	struct vec2 min, max;
+	get_item_rect(item, &min, &max);
+
+	return max.x <= 0.0f || max.y <= 0.0f || min.x >= cx || min.y >= cy;
+}
+
+/* bounds that scale inner/to width/etc can leave part of the box uncovered */
+static inline bool item_fills_box(const struct obs_scene_item *item)
+{
+	return item->bounds_type == OBS_BOUNDS_NONE    ||
+	       item->bounds_type == OBS_BOUNDS_STRETCH ||
+	       item->bounds_type == OBS_BOUNDS_SCALE_OUTER;
+}
+
+static bool item_covers_canvas(const struct obs_scene_item *item,
+		float cx, float cy)
+{
+	struct obs_source *source = item->source;
+	struct vec2 min, max;
+
+	if ((source->info.output_flags & OBS_SOURCE_OPAQUE) == 0 ||
+	    source->filters.num || item->rot != 0.0f ||
+	    !item_fills_box(item))
+		return false;
+
+	/* async sources draw nothing until their first frame arrives */
+	if ((source->info.output_flags & OBS_SOURCE_ASYNC_VIDEO) != 0 &&
+	    !source->async_texture)
+		return false;
+
+	get_item_rect(item, &min, &max);
+	return min.x <= 0.0f && min.y <= 0.0f && max.x >= cx && max.y >= cy;
+}
+
+/* returns the topmost item that hides everything beneath it, if any */
+static struct obs_scene_item *find_occluding_item(struct obs_scene *scene,
+		float cx, float cy)
+{
+	struct obs_scene_item *item = scene->first_item;
+	struct obs_scene_item *occluder = NULL;
+
+	while (item) {
+		if (!obs_source_removed(item->source)) {
+			if (source_size_changed(item))
+				update_item_transform(item);
+
+			if (item_covers_canvas(item, cx, cy))
+				occluder = item;
+		}
+
+		item = item->next;
+	}
+
+	return occluder;
+}
+
+/* scenes are only rendered on the graphics thread.  nested scenes are drawn
+ * unclipped wherever their parent puts them, so items are only culled
+ * against the canvas in the top-level scene. */
+static int scene_render_depth = 0;
+
 static void scene_video_render(void *data, effect_t effect)
 {
 	struct obs_scene *scene = data;
 	struct obs_scene_item *item;
+	struct obs_scene_item *occluder = NULL;
+	float    cx     = (float)obs->video.base_width;
+	float    cy     = (float)obs->video.base_height;
+	uint32_t culled = 0;
+	bool     cull   = (scene_render_depth++ == 0);
 
 	pthread_mutex_lock(&scene->mutex);
 
+	if (cull)
+		occluder = find_occluding_item(scene, cx, cy);
 	item = scene->first_item;
 
 	while (item) {
@@ -315,9 +405,18 @@ static void scene_video_render(void *data, effect_t effect)
 			continue;
 		}
 
+		if (item == occluder)
+			occluder = NULL;
+
 		if (source_size_changed(item))
 			update_item_transform(item);
 
+		if (occluder || (cull && item_off_canvas(item, cx, cy))) {
+			culled++;
+			item = item->next;
+			continue;
+		}
+
 		gs_matrix_push();
 		gs_matrix_mul(&item->draw_transform);
 		obs_source_video_render(item->source);
@@ -326,8 +425,12 @@ static void scene_video_render(void *data, effect_t effect)
 		item = item->next;
 	}
 
+	scene->culled_items = culled;
+
 	pthread_mutex_unlock(&scene->mutex);
 
+	scene_render_depth--;
+
 	UNUSED_PARAMETER(effect);
 }
 
@@ -440,7 +543,8 @@ const struct obs_source_info scene_info =
 {
 	.id           = "scene",
 	.type         = OBS_SOURCE_TYPE_INPUT,
-	.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW,
+	.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_CUSTOM_DRAW |
+	                OBS_SOURCE_RENDER_CACHE,
 	.getname      = scene_getname,
 	.create       = scene_create,
 	.destroy      = scene_destroy,
@@ -484,6 +588,11 @@ obs_scene_t obs_scene_fromsource(obs_source_t source)
 	return source->context.data;
 }
 
+uint32_t obs_scene_get_culled_items(obs_scene_t scene)
+{
+	return scene ? scene->culled_items : 0;
+}
+
 obs_sceneitem_t obs_scene_findsource(obs_scene_t scene, const char *name)
 {
 	struct obs_scene_item *item;
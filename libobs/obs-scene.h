@@ -59,4 +59,7 @@ struct obs_scene {
 
 	pthread_mutex_t       mutex;
 	struct obs_scene_item *first_item;
+
+	/* number of items skipped the last time the scene was rendered */
+	uint32_t              culled_items;
 };
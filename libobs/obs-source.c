@@ -79,6 +79,8 @@ static const char *source_signals[] = {
 	"void deactivate(ptr source)",
 	"void show(ptr source)",
 	"void hide(ptr source)",
+	"void suspend(ptr source)",
+	"void resume(ptr source)",
 	"void rename(ptr source, string new_name, string prev_name)",
 	"void volume(ptr source, in out float volume)",
 	"void volume_level(ptr source, float level, float magnitude, "
@@ -86,12 +88,42 @@ static const char *source_signals[] = {
 	NULL
 };
 
+static void get_stats_proc(void *param, calldata_t data)
+{
+	struct obs_source_stats st;
+	obs_source_get_stats(param, &st);
+
+	calldata_setint(data, "tick_time",     (long long)st.tick_time);
+	calldata_setint(data, "render_time",   (long long)st.render_time);
+	calldata_setint(data, "resample_time", (long long)st.resample_time);
+	calldata_setint(data, "ticks",         st.ticks);
+	calldata_setint(data, "renders",       st.renders);
+	calldata_setint(data, "async_frames_received",
+			st.async_frames_received);
+	calldata_setint(data, "async_frames_dropped",
+			st.async_frames_dropped);
+	calldata_setint(data, "async_frames_late",
+			st.async_frames_late);
+	calldata_setint(data, "audio_packets",  st.audio_packets);
+	calldata_setint(data, "audio_ts_jumps", st.audio_ts_jumps);
+}
+
+static const char *get_stats_decl =
+	"void get_stats(out int tick_time, out int render_time, "
+		"out int resample_time, out int ticks, out int renders, "
+		"out int async_frames_received, out int async_frames_dropped, "
+		"out int async_frames_late, out int audio_packets, "
+		"out int audio_ts_jumps)";
+
 bool obs_source_init_context(struct obs_source *source,
 		obs_data_t settings, const char *name)
 {
 	if (!obs_context_data_init(&source->context, settings, name))
 		return false;
 
+	proc_handler_add(source->context.procs, get_stats_decl,
+			get_stats_proc, source);
+
 	return signal_handler_add_array(source->context.signals,
 			source_signals);
 }
@@ -103,6 +135,8 @@ const char *obs_source_getdisplayname(enum obs_source_type type, const char *id)
 }
 
 /* internal initialization */
+#define DEFAULT_IDLE_DELAY_MS 2000
+
 bool obs_source_init(struct obs_source *source,
 		const struct obs_source_info *info)
 {
@@ -110,6 +144,7 @@ bool obs_source_init(struct obs_source *source,
 	source->user_volume = 1.0f;
 	source->present_volume = 0.0f;
 	source->sync_offset = 0;
+	source->idle_delay = DEFAULT_IDLE_DELAY_MS * 1000000ULL;
 	pthread_mutex_init_value(&source->filter_mutex);
 	pthread_mutex_init_value(&source->video_mutex);
 	pthread_mutex_init_value(&source->audio_mutex);
@@ -239,6 +274,7 @@ void obs_source_destroy(struct obs_source *source)
 
 	gs_entercontext(obs->video.graphics);
 	texrender_destroy(source->async_convert_texrender);
+	texrender_destroy(source->render_cache);
 	texture_destroy(source->async_texture);
 	gs_leavecontext();
 
@@ -482,7 +518,53 @@ void obs_source_deactivate(obs_source_t source, enum view_type type)
 	}
 }
 
-void obs_source_video_tick(obs_source_t source, float seconds)
+static void suspend_source(obs_source_t source)
+{
+	source->suspended = true;
+
+	if (source->context.data && source->info.suspend)
+		source->info.suspend(source->context.data);
+	obs_source_dosignal(source, NULL, "suspend");
+
+	blog(LOG_DEBUG, "source '%s' suspended", source->context.name);
+}
+
+static void resume_source(obs_source_t source)
+{
+	source->suspended = false;
+
+	if (source->context.data && source->info.resume)
+		source->info.resume(source->context.data);
+	obs_source_dosignal(source, NULL, "resume");
+
+	blog(LOG_DEBUG, "source '%s' resumed", source->context.name);
+}
+
+/* called from the video thread each frame.  returns true if the source is
+ * suspended and should not be ticked */
+bool obs_source_update_idle(obs_source_t source, uint64_t sys_time)
+{
+	bool unused = source->idle_when_unused &&
+		source->show_refs == 0 && source->activate_refs == 0;
+
+	if (!unused) {
+		source->unused_since = 0;
+		if (source->suspended)
+			resume_source(source);
+		return false;
+	}
+
+	if (!source->suspended) {
+		if (!source->unused_since)
+			source->unused_since = sys_time;
+		else if (sys_time - source->unused_since >= source->idle_delay)
+			suspend_source(source);
+	}
+
+	return source->suspended;
+}
+
+void obs_source_video_pretick(obs_source_t source)
 {
 	if (!source) return;
 
@@ -492,9 +574,63 @@ void obs_source_video_tick(obs_source_t source, float seconds)
 	/* reset the filter render texture information once every frame */
 	if (source->filter_texrender)
 		texrender_reset(source->filter_texrender);
+}
+
+void obs_source_video_tick(obs_source_t source, float seconds)
+{
+	if (!source) return;
+
+	obs_source_video_pretick(source);
 
 	if (source->context.data && source->info.video_tick)
-		source->info.video_tick(source->context.data, seconds);
+		obs_source_call_tick(source, seconds);
+}
+
+void obs_source_call_tick(obs_source_t source, float seconds)
+{
+	uint64_t start = os_gettime_ns();
+
+	source->info.video_tick(source->context.data, seconds);
+
+	source->stats.tick_time += os_gettime_ns() - start;
+	source->stats.ticks++;
+}
+
+void obs_source_set_idle_when_unused(obs_source_t source, bool enable)
+{
+	if (source)
+		source->idle_when_unused = enable;
+}
+
+bool obs_source_idle_when_unused(obs_source_t source)
+{
+	return source ? source->idle_when_unused : false;
+}
+
+void obs_source_set_idle_delay(obs_source_t source, uint32_t ms)
+{
+	if (source)
+		source->idle_delay = (uint64_t)ms * 1000000ULL;
+}
+
+uint32_t obs_source_get_idle_delay(obs_source_t source)
+{
+	return source ? (uint32_t)(source->idle_delay / 1000000ULL) : 0;
+}
+
+bool obs_source_get_stats(obs_source_t source,
+		struct obs_source_stats *stats)
+{
+	if (!source || !stats)
+		return false;
+
+	*stats = source->stats;
+	return true;
+}
+
+bool obs_source_suspended(obs_source_t source)
+{
+	return source ? source->suspended : false;
 }
 
 /* unless the value is 3+ hours worth of frames, this won't overflow */
@@ -528,6 +664,8 @@ static inline void handle_ts_jump(obs_source_t source, uint64_t expected,
 	                "expected value %"PRIu64", input value %"PRIu64,
 	                source->context.name, diff, expected, ts);
 
+	source->stats.audio_ts_jumps++;
+
 	/* if has video, ignore audio data until reset */
 	if (source->info.output_flags & OBS_SOURCE_ASYNC)
 		os_atomic_dec_long(&source->av_sync_ref);
@@ -1084,10 +1222,8 @@ static inline void obs_source_main_render(obs_source_t source)
 				custom_draw ? NULL : gs_geteffect());
 }
 
-void obs_source_video_render(obs_source_t source)
+static inline void obs_source_render(obs_source_t source)
 {
-	if (!source_valid(source)) return;
-
 	if (source->filters.num && !source->rendering_filter)
 		obs_source_render_filters(source);
 
@@ -1101,6 +1237,128 @@ void obs_source_video_render(obs_source_t source)
 		obs_source_render_async_video(source);
 }
 
+/* counts how many times the source has been drawn in the current frame, and
+ * keeps the count for the last frame to decide whether to cache */
+static inline void count_frame_render(struct obs_source *source)
+{
+	uint64_t frame = obs->video.frame_count;
+
+	if (source->render_frame != frame) {
+		source->last_frame_renders =
+			(source->render_frame + 1 == frame) ?
+			source->frame_renders : 0;
+		source->render_frame  = frame;
+		source->frame_renders = 0;
+	}
+
+	source->frame_renders++;
+}
+
+static inline bool use_render_cache(struct obs_source *source)
+{
+	uint32_t flags = source->info.output_flags;
+
+	return  source->last_frame_renders > 1         &&
+		(flags & OBS_SOURCE_RENDER_CACHE) != 0  &&
+		source->info.type != OBS_SOURCE_TYPE_FILTER &&
+		!source->filter_parent                  &&
+		!source->rendering_filter               &&
+		!source->rendering_cache;
+}
+
+static bool update_render_cache(struct obs_source *source,
+		uint32_t cx, uint32_t cy)
+{
+	struct vec4 clear_color;
+
+	if (source->cache_frame == obs->video.frame_count)
+		return true;
+
+	if (!source->render_cache)
+		source->render_cache = texrender_create(GS_RGBA, GS_ZS_NONE);
+
+	texrender_reset(source->render_cache);
+	if (!texrender_begin(source->render_cache, cx, cy))
+		return false;
+
+	vec4_zero(&clear_color);
+	gs_clear(GS_CLEAR_COLOR, &clear_color, 1.0f, 0);
+	gs_ortho(0.0f, (float)cx, 0.0f, (float)cy, -100.0f, 100.0f);
+
+	/* blending over the cleared texture leaves premultiplied color and
+	 * the accumulated alpha in the cache, which is how scenes compose
+	 * their items */
+	gs_blend_state_push();
+	gs_reset_blend_state();
+
+	source->rendering_cache = true;
+	obs_source_render(source);
+	source->rendering_cache = false;
+
+	gs_blend_state_pop();
+
+	texrender_end(source->render_cache);
+
+	source->cache_frame = obs->video.frame_count;
+	return true;
+}
+
+static void obs_source_draw_cache(struct obs_source *source)
+{
+	texture_t   tex    = texrender_gettexture(source->render_cache);
+	effect_t    effect = obs->video.default_effect;
+	technique_t tech   = effect_gettechnique(effect, "Draw");
+	eparam_t    image  = effect_getparambyname(effect, "image");
+	size_t      passes, i;
+
+	effect_settexture(image, tex);
+
+	/* the cache is premultiplied */
+	gs_blend_state_push();
+	gs_enable_blending(true);
+	gs_blendfunction(GS_BLEND_ONE, GS_BLEND_INVSRCALPHA);
+
+	passes = technique_begin(tech);
+	for (i = 0; i < passes; i++) {
+		technique_beginpass(tech, i);
+		gs_draw_sprite(tex, 0, 0, 0);
+		technique_endpass(tech);
+	}
+	technique_end(tech);
+
+	gs_blend_state_pop();
+}
+
+static bool obs_source_render_cached(struct obs_source *source)
+{
+	uint32_t cx = obs_source_getwidth(source);
+	uint32_t cy = obs_source_getheight(source);
+
+	if (!cx || !cy || !update_render_cache(source, cx, cy))
+		return false;
+
+	obs_source_draw_cache(source);
+	return true;
+}
+
+void obs_source_video_render(obs_source_t source)
+{
+	uint64_t start;
+
+	if (!source_valid(source)) return;
+
+	start = os_gettime_ns();
+
+	if (!source->rendering_cache && !source->rendering_filter)
+		count_frame_render(source);
+
+	if (!use_render_cache(source) || !obs_source_render_cached(source))
+		obs_source_render(source);
+
+	source->stats.render_time += os_gettime_ns() - start;
+	source->stats.renders++;
+}
+
 uint32_t obs_source_getwidth(obs_source_t source)
 {
 	if (!source_valid(source)) return 0;
@@ -1324,6 +1582,13 @@ static inline void cycle_frames(struct obs_source *source)
 		ready_async_frame(source, os_gettime_ns());
 }
 
+/* a frame is late if a newer frame has already been displayed */
+static inline bool frame_late(struct obs_source *source,
+		const struct source_frame *frame)
+{
+	return source->last_frame_ts && frame->timestamp < source->last_frame_ts;
+}
+
 void obs_source_output_video(obs_source_t source,
 		const struct source_frame *frame)
 {
@@ -1332,12 +1597,16 @@ void obs_source_output_video(obs_source_t source,
 
 	struct source_frame *output = cache_video(frame);
 
+	source->stats.async_frames_received++;
+
 	pthread_mutex_lock(&source->filter_mutex);
 	output = filter_async_video(source, output);
 	pthread_mutex_unlock(&source->filter_mutex);
 
 	if (output) {
 		pthread_mutex_lock(&source->video_mutex);
+		if (frame_late(source, output))
+			source->stats.async_frames_late++;
 		cycle_frames(source);
 		da_push_back(source->video_frames, &output);
 		pthread_mutex_unlock(&source->video_mutex);
@@ -1434,6 +1703,7 @@ static void process_audio(obs_source_t source, const struct source_audio *audio)
 		uint8_t  *output[MAX_AV_PLANES];
 		uint32_t frames;
 		uint64_t offset;
+		uint64_t start = os_gettime_ns();
 
 		memset(output, 0, sizeof(output));
 
@@ -1441,6 +1711,8 @@ static void process_audio(obs_source_t source, const struct source_audio *audio)
 				output, &frames, &offset,
 				audio->data, audio->frames);
 
+		source->stats.resample_time += os_gettime_ns() - start;
+
 		copy_audio_data(source, (const uint8_t *const *)output, frames,
 				audio->timestamp - offset);
 	} else {
@@ -1459,6 +1731,7 @@ void obs_source_output_audio(obs_source_t source,
 		return;
 
 	flags = source->info.output_flags;
+	source->stats.audio_packets++;
 	process_audio(source, audio);
 
 	pthread_mutex_lock(&source->filter_mutex);
@@ -1511,7 +1784,10 @@ static bool ready_async_frame(obs_source_t source, uint64_t sys_time)
 	}
 
 	while (frame_offset <= sys_offset) {
-		source_frame_destroy(frame);
+		if (frame) {
+			source_frame_destroy(frame);
+			source->stats.async_frames_dropped++;
+		}
 
 		if (source->video_frames.num == 1)
 			return true;
@@ -1531,7 +1807,10 @@ static bool ready_async_frame(obs_source_t source, uint64_t sys_time)
 		frame_offset = frame_time - source->last_frame_ts;
 	}
 
-	source_frame_destroy(frame);
+	if (frame) {
+		source_frame_destroy(frame);
+		source->stats.async_frames_dropped++;
+	}
 
 	return frame != NULL;
 }
@@ -88,6 +88,37 @@ enum obs_source_type {
  */
 #define OBS_SOURCE_COLOR_MATRIX (1<<4)
 
+/**
+ * Source video_tick callback is thread-safe.
+ *
+ * When this is used, the video_tick callback may be called from a worker
+ * thread in parallel with the video_tick callbacks of other sources.  The
+ * callback must not enter the graphics context; any graphics work should be
+ * deferred to video_render, which is always called after all ticks for the
+ * frame have completed.
+ */
+#define OBS_SOURCE_THREADSAFE_TICK (1<<5)
+
+/**
+ * Source can be drawn from a render cache.
+ *
+ * When this is used and the source is drawn more than once per frame, it is
+ * only rendered once per frame to a texture, and the texture is drawn for
+ * any further uses.  The output of the source must not depend on the current
+ * transform or render target, and anything it draws with blending disabled
+ * must be opaque.
+ */
+#define OBS_SOURCE_RENDER_CACHE    (1<<6)
+
+/**
+ * Source is fully opaque.
+ *
+ * When this is used, the source must always fill its entire area with fully
+ * opaque pixels.  Scene items that are completely covered by an opaque source
+ * are not rendered.
+ */
+#define OBS_SOURCE_OPAQUE          (1<<7)
+
 /** @} */
 
 typedef void (*obs_source_enum_proc_t)(obs_source_t parent, obs_source_t child,
@@ -187,6 +218,19 @@ struct obs_source_info {
 	/** Called when the source is no longer visible */
 	void (*hide)(void *data);
 
+	/**
+	 * Called when the source has been unused (neither shown nor active)
+	 * for longer than its idle delay, if its idle-when-unused policy is
+	 * enabled.  The source should stop any device capture here.  Called
+	 * from the video thread.
+	 */
+	void (*suspend)(void *data);
+
+	/**
+	 * Called from the video thread when a suspended source is used again
+	 */
+	void (*resume)(void *data);
+
 	/**
 	 * Called each video frame with the time elapsed
 	 *
@@ -20,9 +20,107 @@
 #include "graphics/vec4.h"
 #include "media-io/format-conversion.h"
 
+static void run_pool_ticks(struct obs_tick_pool *pool)
+{
+	long num = (long)pool->sources.num;
+	long idx;
+
+	while ((idx = os_atomic_inc_long(&pool->next_idx) - 1) < num) {
+		obs_source_call_tick(pool->sources.array[idx], pool->seconds);
+	}
+}
+
+static void *tick_thread(void *param)
+{
+	struct obs_tick_pool *pool = param;
+
+	while (os_sem_wait(pool->start_sem) == 0) {
+		if (pool->exit)
+			break;
+
+		run_pool_ticks(pool);
+		os_sem_post(pool->done_sem);
+	}
+
+	return NULL;
+}
+
+bool obs_tick_pool_init(struct obs_tick_pool *pool)
+{
+	memset(pool, 0, sizeof(struct obs_tick_pool));
+
+	if (os_sem_init(&pool->start_sem, 0) != 0)
+		return false;
+	if (os_sem_init(&pool->done_sem, 0) != 0) {
+		os_sem_destroy(pool->start_sem);
+		pool->start_sem = NULL;
+		return false;
+	}
+
+	for (size_t i = 0; i < NUM_TICK_THREADS; i++) {
+		if (pthread_create(pool->threads+i, NULL, tick_thread,
+					pool) != 0) {
+			blog(LOG_WARNING, "obs_tick_pool_init: Failed to "
+			                  "create tick thread %d", (int)i);
+			break;
+		}
+
+		pool->num_threads++;
+	}
+
+	return true;
+}
+
+void obs_tick_pool_free(struct obs_tick_pool *pool)
+{
+	void *thread_ret;
+
+	pool->exit = true;
+	for (size_t i = 0; i < pool->num_threads; i++)
+		os_sem_post(pool->start_sem);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->threads[i], &thread_ret);
+
+	os_sem_destroy(pool->start_sem);
+	os_sem_destroy(pool->done_sem);
+	da_free(pool->sources);
+
+	memset(pool, 0, sizeof(struct obs_tick_pool));
+}
+
+/* runs all queued thread-safe ticks, with the video thread helping out, and
+ * waits for every worker to finish before returning */
+static void tick_pool_run(struct obs_tick_pool *pool, float seconds)
+{
+	size_t workers = pool->sources.num - 1;
+
+	if (workers > pool->num_threads)
+		workers = pool->num_threads;
+
+	pool->next_idx = 0;
+	pool->seconds  = seconds;
+
+	for (size_t i = 0; i < workers; i++)
+		os_sem_post(pool->start_sem);
+
+	run_pool_ticks(pool);
+
+	for (size_t i = 0; i < workers; i++)
+		os_sem_wait(pool->done_sem);
+
+	da_resize(pool->sources, 0);
+}
+
+static inline bool threadsafe_tick(struct obs_source *source)
+{
+	return (source->info.output_flags & OBS_SOURCE_THREADSAFE_TICK) != 0 &&
+		source->context.data && source->info.video_tick;
+}
+
 static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 {
 	struct obs_core_data *data = &obs->data;
+	struct obs_tick_pool *pool = &obs->video.tick_pool;
 	struct obs_source    *source;
 	uint64_t             delta_time;
 	float                seconds;
@@ -32,15 +130,27 @@ static uint64_t tick_sources(uint64_t cur_time, uint64_t last_time)
 	delta_time = cur_time - last_time;
 	seconds = (float)((double)delta_time / 1000000000.0);
 
+	obs->video.frame_count++;
+
 	pthread_mutex_lock(&data->sources_mutex);
 
 	source = data->first_source;
 	while (source) {
-		if (source->refs)
-			obs_source_video_tick(source, seconds);
+		if (source->refs && !obs_source_update_idle(source, cur_time)) {
+			if (threadsafe_tick(source)) {
+				obs_source_video_pretick(source);
+				da_push_back(pool->sources, &source);
+			} else {
+				obs_source_video_tick(source, seconds);
+			}
+		}
 		source = (struct obs_source*)source->context.next;
 	}
 
+	/* sources must not be rendered until all of their ticks are done */
+	if (pool->sources.num)
+		tick_pool_run(pool, seconds);
+
 	pthread_mutex_unlock(&data->sources_mutex);
 
 	return cur_time;
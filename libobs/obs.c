@@ -282,6 +282,9 @@ static int obs_init_video(struct obs_video_info *ovi)
 
 	gs_leavecontext();
 
+	if (!obs_tick_pool_init(&video->tick_pool))
+		return OBS_VIDEO_FAIL;
+
 	errorcode = pthread_create(&video->video_thread, NULL,
 			obs_video_thread, obs);
 	if (errorcode != 0)
@@ -302,6 +305,8 @@ static void stop_video(void)
 			pthread_join(video->video_thread, &thread_retval);
 			video->thread_initialized = false;
 		}
+
+		obs_tick_pool_free(&video->tick_pool);
 	}
 
 }
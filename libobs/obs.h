@@ -44,6 +44,7 @@ struct obs_scene;
 struct obs_scene_item;
 struct obs_output;
 struct obs_encoder;
+struct obs_encoder_group;
 struct obs_service;
 
 typedef struct obs_display    *obs_display_t;
@@ -53,6 +54,7 @@ typedef struct obs_scene      *obs_scene_t;
 typedef struct obs_scene_item *obs_sceneitem_t;
 typedef struct obs_output     *obs_output_t;
 typedef struct obs_encoder    *obs_encoder_t;
+typedef struct obs_encoder_group *obs_encoder_group_t;
 typedef struct obs_service    *obs_service_t;
 
 #include "obs-source.h"
@@ -195,6 +197,26 @@ struct source_frame {
 	bool                flip;
 };
 
+/**
+ * Source performance counters.  All times are totals in nanoseconds since the
+ * source was created.  Counters are updated without locking, so values read
+ * while the source is running are approximate.
+ */
+struct obs_source_stats {
+	uint64_t            tick_time;
+	uint64_t            render_time;
+	uint64_t            resample_time;
+	uint32_t            ticks;
+	uint32_t            renders;
+
+	uint32_t            async_frames_received;
+	uint32_t            async_frames_dropped;
+	uint32_t            async_frames_late;
+
+	uint32_t            audio_packets;
+	uint32_t            audio_ts_jumps;
+};
+
 /* ------------------------------------------------------------------------- */
 /* OBS context */
 
@@ -614,6 +636,38 @@ EXPORT void obs_source_enum_tree(obs_source_t source,
 /** Returns true if active, false if not */
 EXPORT bool obs_source_active(obs_source_t source);
 
+/**
+ * Gets the performance counters of a source.  Render time includes the time
+ * spent rendering the source's filters and child sources.
+ *
+ * The same values are available through the source's "get_stats" procedure.
+ */
+EXPORT bool obs_source_get_stats(obs_source_t source,
+		struct obs_source_stats *stats);
+
+/**
+ * Enables or disables the idle-when-unused policy for a source.  When enabled,
+ * a source that has been neither shown nor active for longer than its idle
+ * delay is no longer ticked, and its suspend callback is called so it can stop
+ * any device capture.  It is resumed as soon as it is used again.
+ */
+EXPORT void obs_source_set_idle_when_unused(obs_source_t source, bool enable);
+
+/** Returns whether the idle-when-unused policy is enabled for a source */
+EXPORT bool obs_source_idle_when_unused(obs_source_t source);
+
+/**
+ * Sets how long (in milliseconds) an unused source is kept running before it
+ * is suspended, so that it can be shown again quickly
+ */
+EXPORT void obs_source_set_idle_delay(obs_source_t source, uint32_t ms);
+
+/** Gets the idle delay (in milliseconds) of a source */
+EXPORT uint32_t obs_source_get_idle_delay(obs_source_t source);
+
+/** Returns true if the source is currently suspended for being unused */
+EXPORT bool obs_source_suspended(obs_source_t source);
+
 /**
  * Sometimes sources need to be told when to save their settings so they
  * don't have to constantly update and keep track of their settings.  This will
@@ -712,6 +766,13 @@ EXPORT void obs_scene_enum_items(obs_scene_t scene,
 /** Adds/creates a new scene item for a source */
 EXPORT obs_sceneitem_t obs_scene_add(obs_scene_t scene, obs_source_t source);
 
+/**
+ * Gets the number of items that were culled (not rendered because they were
+ * off-canvas or covered by an opaque item) the last time the scene was
+ * rendered
+ */
+EXPORT uint32_t obs_scene_get_culled_items(obs_scene_t scene);
+
 EXPORT void obs_sceneitem_addref(obs_sceneitem_t item);
 EXPORT void obs_sceneitem_release(obs_sceneitem_t item);
 
@@ -875,6 +936,25 @@ EXPORT uint64_t obs_output_get_total_bytes(obs_output_t output);
 EXPORT int obs_output_get_frames_dropped(obs_output_t output);
 EXPORT int obs_output_get_total_frames(obs_output_t output);
 
+/**
+ * Gets the statistics of the output.  Network outputs also report their
+ * send queue, send call latency, achieved throughput and an estimate of the
+ * available bandwidth.
+ *
+ * The same values are available through the output's "get_stats" procedure.
+ */
+EXPORT bool obs_output_get_stats(obs_output_t output,
+		struct obs_output_stats *stats);
+
+/**
+ * Gets the interleave statistics of the output.  Each encoder feeding the
+ * output gets its own track, and packets wait in the interleaver until every
+ * track has a packet queued, so the wait time shows how far apart the
+ * encoders are.
+ */
+EXPORT bool obs_output_get_interleave_stats(obs_output_t output,
+		struct obs_output_interleave_stats *stats);
+
 /* ------------------------------------------------------------------------- */
 /* Functions used by outputs */
 
@@ -918,6 +998,18 @@ EXPORT void obs_output_end_data_capture(obs_output_t output);
  */
 EXPORT void obs_output_signal_stop(obs_output_t output, int code);
 
+/**
+ * Publishes a target video bitrate for the output, for example when the
+ * output is congested.  The target is passed on to the output's video
+ * encoder with obs_encoder_set_bitrate, and the "target_bitrate" signal is
+ * emitted.
+ *
+ * @param  output   Output context
+ * @param  bitrate  Target bitrate, in kbps
+ */
+EXPORT void obs_output_set_target_bitrate(obs_output_t output,
+		uint32_t bitrate);
+
 
 /* ------------------------------------------------------------------------- */
 /* Encoders */
@@ -1000,12 +1092,151 @@ EXPORT audio_t obs_encoder_audio(obs_encoder_t encoder);
 /** Returns true if encoder is active, false otherwise */
 EXPORT bool obs_encoder_active(obs_encoder_t encoder);
 
-/** Duplicates an encoder packet */
+/**
+ * Sets what happens when a video encoder cannot keep up and its frame queue
+ * is full, and how many frames may be queued.  Only takes effect the next
+ * time the encoder is started.
+ *
+ * @param  policy      OBS_ENCODER_QUEUE_DROP to drop new frames, or
+ *                     OBS_ENCODER_QUEUE_BLOCK to make the video thread wait
+ * @param  max_frames  Maximum number of queued frames (0 for default)
+ */
+EXPORT void obs_encoder_set_queue_policy(obs_encoder_t encoder,
+		enum obs_encoder_queue_policy policy, size_t max_frames);
+
+/** Gets the encoder statistics */
+EXPORT bool obs_encoder_get_stats(obs_encoder_t encoder,
+		struct obs_encoder_stats *stats);
+
+/**
+ * Requests that the next video frame given to the encoder be encoded as a
+ * keyframe (an IDR frame for H.264).  Encoders that do not support forced
+ * keyframes ignore the request.  For an encoder in an encoder group, the
+ * keyframe is forced on every encoder of the group.
+ */
+EXPORT void obs_encoder_request_keyframe(obs_encoder_t encoder);
+
+/**
+ * Keeps the encoder initialized while it is inactive, so that starting an
+ * output does not have to recreate the encoder.  A reused encoder starts
+ * its next session with a keyframe.  The encoder is recreated anyway if its
+ * settings or media have changed.  If prewarm is true and the encoder is
+ * not initialized yet, it is initialized immediately.
+ *
+ * Encoders that delay frames (x264 with lookahead or B-frames) can't reuse
+ * the same internal context, and switch to a new one at the next start
+ * instead.  Only the first of those is opened while starting, the following
+ * ones are prepared in the background.
+ *
+ * @return  false if the encoder does not support being reused, or if it
+ *          failed to initialize
+ */
+EXPORT bool obs_encoder_set_prewarm(obs_encoder_t encoder, bool prewarm);
+
+/** Returns the signal handler of the encoder */
+EXPORT signal_handler_t obs_encoder_signalhandler(obs_encoder_t encoder);
+
+/**
+ * Enables overload protection for a video encoder within the specified
+ * bounds, or disables it if info is NULL.  The "overload_level" signal is
+ * emitted whenever the level changes.
+ */
+EXPORT void obs_encoder_set_overload_protection(obs_encoder_t encoder,
+		const struct obs_encoder_overload_info *info);
+
+/**
+ * Changes the bitrate of an active encoder without restarting it.  The new
+ * bitrate is applied before the next frame is encoded.  The encoder's
+ * settings are not changed, and the bitrate is reset when the encoder is
+ * next initialized.
+ *
+ * @param  encoder  Encoder context
+ * @param  bitrate  New bitrate, in kbps
+ * @return          false if the encoder does not support changing its
+ *                  bitrate, true otherwise
+ */
+EXPORT bool obs_encoder_set_bitrate(obs_encoder_t encoder, uint32_t bitrate);
+
+/**
+ * Returns the current bitrate of the encoder in kbps, which is the bitrate
+ * from its settings unless it has been changed with obs_encoder_set_bitrate
+ */
+EXPORT uint32_t obs_encoder_get_bitrate(obs_encoder_t encoder);
+
+/** Duplicates an encoder packet (deep copy, the result is not shared) */
 EXPORT void obs_duplicate_encoder_packet(struct encoder_packet *dst,
 		const struct encoder_packet *src);
 
+/** Frees an encoder packet (same as obs_encoder_packet_release) */
 EXPORT void obs_free_encoder_packet(struct encoder_packet *packet);
 
+/**
+ * Takes a reference to an encoder packet's data.  If the source packet is
+ * not shared, its data is copied in to a new shared buffer.
+ */
+EXPORT void obs_encoder_packet_ref(struct encoder_packet *dst,
+		const struct encoder_packet *src);
+
+/** Releases a reference to an encoder packet's data */
+EXPORT void obs_encoder_packet_release(struct encoder_packet *packet);
+
+
+/* ------------------------------------------------------------------------- */
+/* Encoder groups */
+
+/**
+ * Creates an encoder group.
+ *
+ *   An encoder group drives several video encoders (renditions) from the same
+ * video output.  The group receives each raw frame once, scales it once per
+ * distinct rendition size/format with cached scalers, and passes it to each
+ * of its active encoders, which encode in parallel on their own encode
+ * threads.  Each encoder in the group is still a normal encoder, and is
+ * attached to outputs individually.
+ *
+ * @param  video  Video output context the group's encoders will use
+ * @return        The encoder group, or NULL if failed
+ */
+EXPORT obs_encoder_group_t obs_encoder_group_create(video_t video);
+
+/** Destroys an encoder group (encoders in the group are not destroyed) */
+EXPORT void obs_encoder_group_destroy(obs_encoder_group_t group);
+
+/**
+ * Adds a video encoder to the group.  The encoder must not be active, and
+ * its video output is set to the group's video output.
+ */
+EXPORT bool obs_encoder_group_add(obs_encoder_group_t group,
+		obs_encoder_t encoder);
+
+/** Removes an inactive video encoder from the group */
+EXPORT void obs_encoder_group_remove(obs_encoder_group_t group,
+		obs_encoder_t encoder);
+
+/** Returns the number of encoders in the group */
+EXPORT size_t obs_encoder_group_num_encoders(obs_encoder_group_t group);
+
+/** Returns the encoder at the specified index of the group */
+EXPORT obs_encoder_t obs_encoder_group_get_encoder(obs_encoder_group_t group,
+		size_t idx);
+
+/**
+ * Sets the keyframe interval of the group, in frames.  Every encoder in the
+ * group is asked to encode a keyframe on the same frames so that renditions
+ * can be switched between at keyframes.  0 leaves keyframe placement to the
+ * encoders.
+ */
+EXPORT void obs_encoder_group_set_keyint(obs_encoder_group_t group,
+		uint32_t keyint);
+
+/**
+ * Returns true if the keyframes of an encoder are placed by its group.  The
+ * encoder should then disable its own keyframe placement (maximum keyframe
+ * interval, scene cut detection) and only encode keyframes when asked to,
+ * otherwise renditions get keyframes the others don't have.
+ */
+EXPORT bool obs_encoder_group_keyframes(obs_encoder_t encoder);
+
 
 /* ------------------------------------------------------------------------- */
 /* Stream Services */
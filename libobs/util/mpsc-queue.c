@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+#include "bmem.h"
+#include "threading.h"
+#include "mpsc-queue.h"
+
+/*
+ * Each cell is a sequence number followed by the element.  A cell at index
+ * i is free for the producer that claims position pos when its sequence is
+ * pos, and holds a finished element for the consumer at position pos when
+ * its sequence is pos + 1.  Positions wrap around, so they are always
+ * compared through their (signed) difference.
+ */
+
+#define CELL_HEADER_SIZE 16
+
+static inline volatile long *cell_seq(struct mpsc_queue *queue,
+		unsigned long pos)
+{
+	return (volatile long*)(queue->cells +
+			(pos & queue->mask) * queue->cell_size);
+}
+
+static inline uint8_t *cell_data(struct mpsc_queue *queue, unsigned long pos)
+{
+	return queue->cells + (pos & queue->mask) * queue->cell_size +
+		CELL_HEADER_SIZE;
+}
+
+static inline long pos_diff(long a, long b)
+{
+	return (long)((unsigned long)a - (unsigned long)b);
+}
+
+static inline long pos_add(long pos, unsigned long n)
+{
+	return (long)((unsigned long)pos + n);
+}
+
+bool mpsc_queue_init(struct mpsc_queue *queue, size_t element_size,
+		size_t capacity)
+{
+	size_t size = 2;
+
+	memset(queue, 0, sizeof(struct mpsc_queue));
+
+	if (!element_size || !capacity)
+		return false;
+
+	while (size < capacity)
+		size <<= 1;
+
+	queue->element_size = element_size;
+	queue->cell_size    = CELL_HEADER_SIZE +
+		((element_size + CELL_HEADER_SIZE - 1) & ~(CELL_HEADER_SIZE-1));
+	queue->mask         = (unsigned long)size - 1;
+	queue->cells        = bmalloc(queue->cell_size * size);
+
+	for (size_t i = 0; i < size; i++)
+		*cell_seq(queue, (unsigned long)i) = (long)i;
+
+	return true;
+}
+
+void mpsc_queue_free(struct mpsc_queue *queue)
+{
+	bfree(queue->cells);
+	memset(queue, 0, sizeof(struct mpsc_queue));
+}
+
+bool mpsc_queue_push(struct mpsc_queue *queue, const void *element)
+{
+	long pos = os_atomic_load_long(&queue->head);
+	volatile long *seq;
+
+	for (;;) {
+		long diff;
+
+		seq  = cell_seq(queue, (unsigned long)pos);
+		diff = pos_diff(os_atomic_load_long(seq), pos);
+
+		if (diff == 0) {
+			/* cell is free, try to claim the position */
+			if (os_atomic_compare_swap_long(&queue->head, pos,
+						pos_add(pos, 1)))
+				break;
+			pos = os_atomic_load_long(&queue->head);
+
+		} else if (diff < 0) {
+			/* the consumer hasn't freed this cell yet */
+			return false;
+
+		} else {
+			/* another producer claimed the position */
+			pos = os_atomic_load_long(&queue->head);
+		}
+	}
+
+	memcpy(cell_data(queue, (unsigned long)pos), element,
+			queue->element_size);
+	os_atomic_set_long(seq, pos_add(pos, 1));
+	return true;
+}
+
+bool mpsc_queue_pop(struct mpsc_queue *queue, void *element)
+{
+	long          pos = queue->tail;
+	volatile long *seq;
+
+	if (!queue->cells)
+		return false;
+
+	seq = cell_seq(queue, (unsigned long)pos);
+	if (pos_diff(os_atomic_load_long(seq), pos_add(pos, 1)) < 0)
+		return false;
+
+	memcpy(element, cell_data(queue, (unsigned long)pos),
+			queue->element_size);
+
+	/* hand the cell back to producers for the next time around */
+	os_atomic_set_long(seq, pos_add(pos, queue->mask + 1));
+	queue->tail = pos_add(pos, 1);
+	return true;
+}
+
+size_t mpsc_queue_pop_batch(struct mpsc_queue *queue, void *elements,
+		size_t max_elements)
+{
+	uint8_t *out = elements;
+	size_t  num  = 0;
+
+	while (num < max_elements && mpsc_queue_pop(queue, out)) {
+		out += queue->element_size;
+		num++;
+	}
+
+	return num;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2014 Hugh Bailey <obs.jim@gmail.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "c99defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock-free bounded multi-producer, single-consumer queue
+ *
+ *   Stores fixed-size elements in a ring of cells.  Any number of threads
+ * can push at the same time without locking, but only one thread may pop.
+ * Each cell has a sequence number that tells producers and the consumer
+ * whether the cell is free or holds a finished element, so a slow producer
+ * never exposes a half-written element.
+ *
+ *   The queue does not block or signal.  Pair it with an os_sem_t or
+ * os_event_t to wake the consumer, and drain everything pending with
+ * mpsc_queue_pop_batch in one wakeup.
+ */
+
+#define MPSC_QUEUE_CACHE_LINE 64
+
+struct mpsc_queue {
+	uint8_t       *cells;
+	size_t        cell_size;
+	size_t        element_size;
+	unsigned long mask;
+
+	/* producers and the consumer each get their own cache line */
+	uint8_t       pad1[MPSC_QUEUE_CACHE_LINE];
+	volatile long head;
+	uint8_t       pad2[MPSC_QUEUE_CACHE_LINE];
+	long          tail;
+};
+
+/**
+ * Initializes the queue
+ *
+ * @param  element_size  Size of one element, in bytes
+ * @param  capacity      Maximum number of elements, rounded up to a power of
+ *                       two
+ */
+EXPORT bool mpsc_queue_init(struct mpsc_queue *queue, size_t element_size,
+		size_t capacity);
+EXPORT void mpsc_queue_free(struct mpsc_queue *queue);
+
+/** Pushes an element, returns false if the queue is full.  Thread-safe. */
+EXPORT bool mpsc_queue_push(struct mpsc_queue *queue, const void *element);
+
+/** Pops the oldest element, returns false if the queue is empty */
+EXPORT bool mpsc_queue_pop(struct mpsc_queue *queue, void *element);
+
+/**
+ * Pops up to max_elements elements in to the elements array, and returns
+ * the number popped
+ */
+EXPORT size_t mpsc_queue_pop_batch(struct mpsc_queue *queue, void *elements,
+		size_t max_elements);
+
+/** Returns the maximum number of elements */
+static inline size_t mpsc_queue_capacity(const struct mpsc_queue *queue)
+{
+	return queue->cells ? (size_t)queue->mask + 1 : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -248,3 +248,23 @@ long os_atomic_dec_long(volatile long *val)
 {
 	return __sync_sub_and_fetch(val, 1);
 }
+
+bool os_atomic_compare_swap_long(volatile long *val, long old_val,
+		long new_val)
+{
+	return __sync_bool_compare_and_swap(val, old_val, new_val);
+}
+
+long os_atomic_load_long(const volatile long *val)
+{
+	long ret = *val;
+	__sync_synchronize();
+	return ret;
+}
+
+void os_atomic_set_long(volatile long *val, long new_val)
+{
+	__sync_synchronize();
+	*val = new_val;
+	__sync_synchronize();
+}
@@ -160,3 +160,19 @@ long os_atomic_dec_long(volatile long *val)
 {
 	return InterlockedDecrement(val);
 }
+
+bool os_atomic_compare_swap_long(volatile long *val, long old_val,
+		long new_val)
+{
+	return InterlockedCompareExchange(val, new_val, old_val) == old_val;
+}
+
+long os_atomic_load_long(const volatile long *val)
+{
+	return InterlockedCompareExchange((volatile long*)val, 0, 0);
+}
+
+void os_atomic_set_long(volatile long *val, long new_val)
+{
+	InterlockedExchange(val, new_val);
+}
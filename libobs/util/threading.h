@@ -73,6 +73,13 @@ EXPORT int  os_sem_wait(os_sem_t sem);
 EXPORT long os_atomic_inc_long(volatile long *val);
 EXPORT long os_atomic_dec_long(volatile long *val);
 
+/* sets *val to new_val if it is equal to old_val, returns true if it was */
+EXPORT bool os_atomic_compare_swap_long(volatile long *val, long old_val,
+		long new_val);
+/* loads/stores with a full memory barrier */
+EXPORT long os_atomic_load_long(const volatile long *val);
+EXPORT void os_atomic_set_long(volatile long *val, long new_val);
+
 
 #ifdef __cplusplus
 }
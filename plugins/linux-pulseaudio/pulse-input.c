@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 struct pulse_data {
 	obs_source_t source;
 	pa_stream *stream;
+	bool suspended;
 
 	/* user settings */
 	char *device;
@@ -159,6 +160,16 @@ static void pulse_server_info(pa_context *c, const pa_server_info *i,
 	pulse_signal(0);
 }
 
+/**
+ * Pause or resume a stream, must be called with the mainloop locked
+ */
+static void pulse_cork_stream(pa_stream *stream, bool cork)
+{
+	pa_operation *op = pa_stream_cork(stream, cork ? 1 : 0, NULL, NULL);
+	if (op)
+		pa_operation_unref(op);
+}
+
 /**
  * Start recording
  *
@@ -217,6 +228,12 @@ static int_fast32_t pulse_start_recording(struct pulse_data *data)
 		return -1;
 	}
 
+	if (data->suspended) {
+		pulse_lock();
+		pulse_cork_stream(data->stream, true);
+		pulse_unlock();
+	}
+
 	blog(LOG_INFO, "pulse-input: Started recording from '%s'",
 		data->device);
 	return 0;
@@ -421,6 +438,33 @@ static void pulse_update(void *vptr, obs_data_t settings)
 	pulse_start_recording(data);
 }
 
+/**
+ * Cork the stream while the source is unused
+ *
+ * The stream stays connected so resuming does not need to renegotiate it.
+ */
+static void pulse_suspend(void *vptr)
+{
+	PULSE_DATA(vptr);
+
+	pulse_lock();
+	data->suspended = true;
+	if (data->stream)
+		pulse_cork_stream(data->stream, true);
+	pulse_unlock();
+}
+
+static void pulse_resume(void *vptr)
+{
+	PULSE_DATA(vptr);
+
+	pulse_lock();
+	data->suspended = false;
+	if (data->stream)
+		pulse_cork_stream(data->stream, false);
+	pulse_unlock();
+}
+
 /**
  * Create the plugin object
  */
@@ -449,6 +493,8 @@ struct obs_source_info pulse_input_capture = {
 	.create       = pulse_create,
 	.destroy      = pulse_destroy,
 	.update       = pulse_update,
+	.suspend      = pulse_suspend,
+	.resume       = pulse_resume,
 	.defaults     = pulse_input_defaults,
 	.properties   = pulse_input_properties
 };
@@ -461,6 +507,8 @@ struct obs_source_info pulse_output_capture = {
 	.create       = pulse_create,
 	.destroy      = pulse_destroy,
 	.update       = pulse_update,
+	.suspend      = pulse_suspend,
+	.resume       = pulse_resume,
 	.defaults     = pulse_output_defaults,
 	.properties   = pulse_output_properties
 };
@@ -51,6 +51,14 @@ struct v4l2_data {
 
 	pthread_t thread;
 	os_event_t event;
+	pthread_mutex_t mutex;
+	bool suspended;
+
+	/* suspend and resume only change the suspended state, the device is
+	 * opened and closed on this thread so that rendering isn't blocked */
+	pthread_t ctrl_thread;
+	os_sem_t ctrl_sem;
+	bool ctrl_exit;
 	obs_source_t source;
 	uint_fast32_t linesize;
 
@@ -633,6 +641,7 @@ static void v4l2_terminate(struct v4l2_data *data)
 		os_event_signal(data->event);
 		pthread_join(data->thread, NULL);
 		os_event_destroy(data->event);
+		data->thread = 0;
 	}
 
 	if (data->buf_count)
@@ -651,7 +660,15 @@ static void v4l2_destroy(void *vptr)
 	if (!data)
 		return;
 
+	if (data->ctrl_thread) {
+		data->ctrl_exit = true;
+		os_sem_post(data->ctrl_sem);
+		pthread_join(data->ctrl_thread, NULL);
+	}
+	os_sem_destroy(data->ctrl_sem);
+
 	v4l2_terminate(data);
+	pthread_mutex_destroy(&data->mutex);
 
 	if (data->device)
 		bfree(data->device);
@@ -725,6 +742,8 @@ static void v4l2_update(void *vptr, obs_data_t settings)
 		new_device = obs_data_getstring(settings, "device_id");
 	}
 
+	pthread_mutex_lock(&data->mutex);
+
 	if (!data->device || strcmp(data->device, new_device) != 0) {
 		if (data->device)
 			bfree(data->device);
@@ -761,8 +780,55 @@ static void v4l2_update(void *vptr, obs_data_t settings)
 		data->width = width;
 		data->height = height;
 
-		v4l2_init(data);
+		/* a suspended source picks up the new settings on resume */
+		if (!data->suspended)
+			v4l2_init(data);
 	}
+
+	pthread_mutex_unlock(&data->mutex);
+}
+
+/**
+ * Close the device while the source is unused to free up the usb bandwidth
+ */
+static void *v4l2_ctrl_thread(void *vptr)
+{
+	V4L2_DATA(vptr);
+
+	while (os_sem_wait(data->ctrl_sem) == 0) {
+		if (data->ctrl_exit)
+			break;
+
+		pthread_mutex_lock(&data->mutex);
+		if (data->suspended)
+			v4l2_terminate(data);
+		else if (data->dev == -1)
+			v4l2_init(data);
+		pthread_mutex_unlock(&data->mutex);
+	}
+
+	return NULL;
+}
+
+static void v4l2_set_suspended(struct v4l2_data *data, bool suspended)
+{
+	pthread_mutex_lock(&data->mutex);
+	data->suspended = suspended;
+	pthread_mutex_unlock(&data->mutex);
+
+	os_sem_post(data->ctrl_sem);
+}
+
+static void v4l2_suspend(void *vptr)
+{
+	V4L2_DATA(vptr);
+	v4l2_set_suspended(data, true);
+}
+
+static void v4l2_resume(void *vptr)
+{
+	V4L2_DATA(vptr);
+	v4l2_set_suspended(data, false);
 }
 
 static void *v4l2_create(obs_data_t settings, obs_source_t source)
@@ -773,6 +839,19 @@ static void *v4l2_create(obs_data_t settings, obs_source_t source)
 	data->dev = -1;
 	data->source = source;
 
+	if (pthread_mutex_init(&data->mutex, NULL) != 0) {
+		bfree(data);
+		return NULL;
+	}
+	if (os_sem_init(&data->ctrl_sem, 0) != 0 ||
+	    pthread_create(&data->ctrl_thread, NULL, v4l2_ctrl_thread,
+			    data) != 0) {
+		blog(LOG_ERROR, "Unable to create control thread");
+		data->ctrl_thread = 0;
+		v4l2_destroy(data);
+		return NULL;
+	}
+
 	v4l2_update(data, settings);
 	blog(LOG_DEBUG, "New input created");
 
@@ -782,13 +861,15 @@ static void *v4l2_create(obs_data_t settings, obs_source_t source)
 struct obs_source_info v4l2_input = {
 	.id           = "v4l2_input",
 	.type         = OBS_SOURCE_TYPE_INPUT,
-	.output_flags = OBS_SOURCE_ASYNC_VIDEO,
+	.output_flags = OBS_SOURCE_ASYNC_VIDEO | OBS_SOURCE_OPAQUE,
 	.getname      = v4l2_getname,
 	.create       = v4l2_create,
 	.destroy      = v4l2_destroy,
 	.update       = v4l2_update,
 	.defaults     = v4l2_defaults,
 	.properties   = v4l2_properties,
+	.suspend      = v4l2_suspend,
+	.resume       = v4l2_resume,
 	.getwidth     = v4l2_getwidth,
 	.getheight    = v4l2_getheight
 };
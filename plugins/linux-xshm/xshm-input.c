@@ -36,6 +36,7 @@ struct xshm_data {
 
 	xshm_t *xshm;
 	texture_t texture;
+	bool texture_dirty;
 
 	bool show_cursor;
 	xcursor_t *cursor;
@@ -236,6 +237,9 @@ fail:
 
 /**
  * Prepare the capture data
+ *
+ * This may run on a tick worker thread, so the texture upload is left to
+ * xshm_video_render.
  */
 static void xshm_video_tick(void *vptr, float seconds)
 {
@@ -245,16 +249,9 @@ static void xshm_video_tick(void *vptr, float seconds)
 	if (!data->xshm)
 		return;
 
-	gs_entercontext(obs_graphics());
-
 	XShmGetImage(data->dpy, XRootWindowOfScreen(data->screen),
 		data->xshm->image, data->x_org, data->y_org, AllPlanes);
-	texture_setimage(data->texture, (void *) data->xshm->image->data,
-		data->width * 4, false);
-
-	xcursor_tick(data->cursor);
-
-	gs_leavecontext();
+	data->texture_dirty = true;
 }
 
 /**
@@ -267,6 +264,14 @@ static void xshm_video_render(void *vptr, effect_t effect)
 	if (!data->xshm)
 		return;
 
+	if (data->texture_dirty) {
+		texture_setimage(data->texture,
+			(void *) data->xshm->image->data,
+			data->width * 4, false);
+		xcursor_tick(data->cursor);
+		data->texture_dirty = false;
+	}
+
 	eparam_t image = effect_getparambyname(effect, "image");
 	effect_settexture(image, data->texture);
 
@@ -300,7 +305,7 @@ static uint32_t xshm_getheight(void *vptr)
 struct obs_source_info xshm_input = {
 	.id           = "xshm_input",
 	.type         = OBS_SOURCE_TYPE_INPUT,
-	.output_flags = OBS_SOURCE_VIDEO,
+	.output_flags = OBS_SOURCE_VIDEO | OBS_SOURCE_THREADSAFE_TICK,
 	.getname      = xshm_getname,
 	.create       = xshm_create,
 	.destroy      = xshm_destroy,
@@ -16,11 +16,11 @@
 ******************************************************************************/
 
 #include <obs-module.h>
-#include <util/circlebuf.h>
 #include <util/threading.h>
 #include <util/dstr.h>
-#include <util/darray.h>
 #include <util/platform.h>
+#include <util/mpsc-queue.h>
+#include <media-io/audio-frame-assembler.h>
 
 #include <libavutil/opt.h>
 #include <libavformat/avformat.h>
@@ -56,16 +56,35 @@ struct ffmpeg_data {
 	enum audio_format  audio_format;
 	size_t             audio_planes;
 	size_t             audio_size;
-	struct circlebuf   excess_frames[MAX_AV_PLANES];
-	uint8_t            *samples[MAX_AV_PLANES];
+	struct audio_frame_assembler audio_frames;
 	AVFrame            *aframe;
 	int                total_samples;
 
-	const char         *filename_test;
+	struct dstr        filename;
+
+	/* file segmenting, only touched by the write thread (apart from
+	 * force_keyframe).  the first segment is written by the encoding
+	 * context itself, later segments get their own contexts. */
+	AVFormatContext    *file;
+	AVFormatContext    *prev_file;
+	struct dstr        segment_path;
+	int64_t            segment_duration;   /* AV_TIME_BASE units */
+	int64_t            segment_size;
+	int64_t            segment_start;      /* AV_TIME_BASE units */
+	int64_t            prev_segment_start;
+	uint32_t           segment_idx;
+	bool               segment_started;
+	bool               rotate_pending;
+	volatile bool      force_keyframe;
 
 	bool               initialized;
 };
 
+/* number of raw video frames that can wait for the encoder.  if the encoder
+ * falls further behind than this, frames are dropped rather than stalling
+ * the video thread */
+#define VIDEO_POOL_SIZE   4
+
 struct ffmpeg_output {
 	obs_output_t       output;
 	volatile bool      active;
@@ -75,14 +94,42 @@ struct ffmpeg_output {
 	pthread_t          start_thread;
 
 	bool               write_thread_active;
-	pthread_mutex_t    write_mutex;
 	pthread_t          write_thread;
 	os_sem_t           write_sem;
 	os_event_t         stop_event;
 
-	DARRAY(AVPacket)   packets;
+	struct mpsc_queue  packets;
+
+	/* the raw callbacks only copy frames in to these queues, encoding
+	 * happens on the video and audio threads */
+	bool               encode_threads_active;
+	pthread_t          video_thread;
+	pthread_t          audio_thread;
+	os_sem_t           video_sem;
+	os_sem_t           audio_sem;
+	os_event_t         encode_stop_event;
+
+	AVFrame            *video_pool[VIDEO_POOL_SIZE];
+	struct mpsc_queue  video_frames;      /* AVFrame*, waiting to encode */
+	struct mpsc_queue  free_video_frames; /* AVFrame*, ready for reuse */
+	struct mpsc_queue  audio_chunks;      /* struct audio_chunk */
+	volatile long      dropped_frames;
+};
+
+/* raw audio copied out of the audio callback, all planes in one allocation
+ * starting at data[0] */
+struct audio_chunk {
+	uint8_t            *data[MAX_AV_PLANES];
+	uint32_t           frames;
 };
 
+/* encoded packets are handed to the write thread through a lock-free queue,
+ * which the write thread drains in batches */
+#define PACKET_QUEUE_SIZE 1024
+#define PACKET_BATCH_SIZE 32
+
+#define AUDIO_QUEUE_SIZE  256
+
 /* ------------------------------------------------------------------------- */
 
 static bool new_stream(struct ffmpeg_data *data, AVStream **stream,
@@ -227,14 +274,8 @@ static bool open_audio_codec(struct ffmpeg_data *data)
 
 	data->frame_size = context->frame_size ? context->frame_size : 1024;
 
-	ret = av_samples_alloc(data->samples, NULL, context->channels,
-			data->frame_size, context->sample_fmt, 0);
-	if (ret < 0) {
-		blog(LOG_WARNING, "Failed to create audio buffer: %s",
-		                av_err2str(ret));
-		return false;
-	}
-
+	audio_frame_assembler_init(&data->audio_frames, data->audio_planes,
+			(size_t)data->frame_size * data->audio_size);
 	return true;
 }
 
@@ -291,11 +332,11 @@ static inline bool open_output_file(struct ffmpeg_data *data)
 	int ret;
 
 	if ((format->flags & AVFMT_NOFILE) == 0) {
-		ret = avio_open(&data->output->pb, data->filename_test,
+		ret = avio_open(&data->output->pb, data->filename.array,
 				AVIO_FLAG_WRITE);
 		if (ret < 0) {
 			blog(LOG_WARNING, "Couldn't open file '%s', %s",
-					data->filename_test, av_err2str(ret));
+					data->filename.array, av_err2str(ret));
 			return false;
 		}
 	}
@@ -303,7 +344,7 @@ static inline bool open_output_file(struct ffmpeg_data *data)
 	ret = avformat_write_header(data->output, NULL);
 	if (ret < 0) {
 		blog(LOG_WARNING, "Error opening file '%s': %s",
-				data->filename_test, av_err2str(ret));
+				data->filename.array, av_err2str(ret));
 		return false;
 	}
 
@@ -319,16 +360,32 @@ static void close_video(struct ffmpeg_data *data)
 
 static void close_audio(struct ffmpeg_data *data)
 {
-	for (size_t i = 0; i < MAX_AV_PLANES; i++)
-		circlebuf_free(&data->excess_frames[i]);
-
-	av_freep(&data->samples[0]);
+	audio_frame_assembler_free(&data->audio_frames);
 	avcodec_close(data->audio->codec);
 	av_frame_free(&data->aframe);
 }
 
+static void close_file(struct ffmpeg_data *data, AVFormatContext *file)
+{
+	av_write_trailer(file);
+
+	if ((file->oformat->flags & AVFMT_NOFILE) == 0) {
+		avio_close(file->pb);
+		file->pb = NULL;
+	}
+
+	if (file == data->output)
+		data->initialized = false;
+	else
+		avformat_free_context(file);
+}
+
 static void ffmpeg_data_free(struct ffmpeg_data *data)
 {
+	if (data->prev_file)
+		close_file(data, data->prev_file);
+	if (data->file && data->file != data->output)
+		close_file(data, data->file);
 	if (data->initialized)
 		av_write_trailer(data->output);
 
@@ -344,6 +401,8 @@ static void ffmpeg_data_free(struct ffmpeg_data *data)
 		avformat_free_context(data->output);
 	}
 
+	dstr_free(&data->segment_path);
+	dstr_free(&data->filename);
 	memset(data, 0, sizeof(struct ffmpeg_data));
 }
 
@@ -353,13 +412,16 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data, const char *filename,
 	bool is_rtmp = false;
 
 	memset(data, 0, sizeof(struct ffmpeg_data));
-	data->filename_test = filename;
 	data->video_bitrate = vbitrate;
 	data->audio_bitrate = abitrate;
 
 	if (!filename || !*filename)
 		return false;
 
+	/* the settings the filename came from are released once the
+	 * output has connected, but segments still need it */
+	dstr_copy(&data->filename, filename);
+
 	av_register_all();
 	avformat_network_init();
 
@@ -367,7 +429,7 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data, const char *filename,
 
 	/* TODO: settings */
 	avformat_alloc_output_context2(&data->output, NULL,
-			is_rtmp ? "flv" : NULL, data->filename_test);
+			is_rtmp ? "flv" : NULL, data->filename.array);
 	if (is_rtmp) {
 		data->output->oformat->video_codec = AV_CODEC_ID_H264;
 		data->output->oformat->audio_codec = AV_CODEC_ID_AAC;
@@ -385,6 +447,7 @@ static bool ffmpeg_data_init(struct ffmpeg_data *data, const char *filename,
 
 	av_dump_format(data->output, 0, NULL, 1);
 
+	data->file        = data->output;
 	data->initialized = true;
 	return true;
 
@@ -413,15 +476,30 @@ static void ffmpeg_log_callback(void *param, int level, const char *format,
 static void *ffmpeg_output_create(obs_data_t settings, obs_output_t output)
 {
 	struct ffmpeg_output *data = bzalloc(sizeof(struct ffmpeg_output));
-	pthread_mutex_init_value(&data->write_mutex);
 	data->output = output;
 
-	if (pthread_mutex_init(&data->write_mutex, NULL) != 0)
+	if (!mpsc_queue_init(&data->packets, sizeof(AVPacket),
+				PACKET_QUEUE_SIZE))
+		goto fail;
+	if (!mpsc_queue_init(&data->video_frames, sizeof(AVFrame*),
+				VIDEO_POOL_SIZE))
+		goto fail;
+	if (!mpsc_queue_init(&data->free_video_frames, sizeof(AVFrame*),
+				VIDEO_POOL_SIZE))
+		goto fail;
+	if (!mpsc_queue_init(&data->audio_chunks, sizeof(struct audio_chunk),
+				AUDIO_QUEUE_SIZE))
 		goto fail;
 	if (os_event_init(&data->stop_event, OS_EVENT_TYPE_AUTO) != 0)
 		goto fail;
+	if (os_event_init(&data->encode_stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
 	if (os_sem_init(&data->write_sem, 0) != 0)
 		goto fail;
+	if (os_sem_init(&data->video_sem, 0) != 0)
+		goto fail;
+	if (os_sem_init(&data->audio_sem, 0) != 0)
+		goto fail;
 
 	av_log_set_callback(ffmpeg_log_callback);
 
@@ -429,8 +507,15 @@ static void *ffmpeg_output_create(obs_data_t settings, obs_output_t output)
 	return data;
 
 fail:
-	pthread_mutex_destroy(&data->write_mutex);
+	mpsc_queue_free(&data->packets);
+	mpsc_queue_free(&data->video_frames);
+	mpsc_queue_free(&data->free_video_frames);
+	mpsc_queue_free(&data->audio_chunks);
 	os_event_destroy(data->stop_event);
+	os_event_destroy(data->encode_stop_event);
+	os_sem_destroy(data->write_sem);
+	os_sem_destroy(data->video_sem);
+	os_sem_destroy(data->audio_sem);
 	bfree(data);
 	return NULL;
 }
@@ -447,9 +532,15 @@ static void ffmpeg_output_destroy(void *data)
 
 		ffmpeg_output_stop(output);
 
-		pthread_mutex_destroy(&output->write_mutex);
+		mpsc_queue_free(&output->packets);
+		mpsc_queue_free(&output->video_frames);
+		mpsc_queue_free(&output->free_video_frames);
+		mpsc_queue_free(&output->audio_chunks);
 		os_sem_destroy(output->write_sem);
+		os_sem_destroy(output->video_sem);
+		os_sem_destroy(output->audio_sem);
 		os_event_destroy(output->stop_event);
+		os_event_destroy(output->encode_stop_event);
 		bfree(data);
 	}
 }
@@ -467,6 +558,12 @@ static inline void copy_data(AVPicture *pic, const struct video_data *frame,
 			frame_rowsize : pic_rowsize;
 		int plane_height = plane == 0 ? height : height/2;
 
+		if (frame_rowsize == pic_rowsize) {
+			memcpy(pic->data[plane], frame->data[plane],
+					(size_t)pic_rowsize * plane_height);
+			continue;
+		}
+
 		for (int y = 0; y < plane_height; y++) {
 			int pos_frame = y * frame_rowsize;
 			int pos_pic   = y * pic_rowsize;
@@ -478,46 +575,65 @@ static inline void copy_data(AVPicture *pic, const struct video_data *frame,
 	}
 }
 
-static void receive_video(void *param, struct video_data *frame)
+static void push_packet(struct ffmpeg_output *output, AVPacket *packet)
 {
-	struct ffmpeg_output *output = param;
-	struct ffmpeg_data   *data   = &output->ff_data;
-	AVCodecContext *context = data->video->codec;
-	AVPacket packet = {0};
-	int ret = 0, got_packet;
+	if (!mpsc_queue_push(&output->packets, packet)) {
+		blog(LOG_WARNING, "push_packet: Packet queue is full, "
+		                  "dropping packet");
+		av_free_packet(packet);
+		return;
+	}
+
+	os_sem_post(output->write_sem);
+}
+
+/* runs on the video thread */
+static void encode_video(struct ffmpeg_output *output, AVFrame *src)
+{
+	struct ffmpeg_data *data    = &output->ff_data;
+	AVCodecContext     *context = data->video->codec;
+	AVFrame            *vframe  = src;
+	AVPacket           packet   = {0};
+	int                ret      = 0, got_packet;
 	enum AVPixelFormat format;
 
 	av_init_packet(&packet);
 
-	if (!data->start_timestamp)
-		data->start_timestamp = frame->timestamp;
-
 	format = obs_to_ffmpeg_video_format(OBS_FFMPEG_VIDEO_FORMAT);
-	if (context->pix_fmt != format)
-		sws_scale(data->swscale, (const uint8_t *const *)frame->data,
-				(const int*)frame->linesize,
-				0, context->height, data->dst_picture.data,
+	if (context->pix_fmt != format) {
+		sws_scale(data->swscale, (const uint8_t *const *)src->data,
+				src->linesize, 0, context->height,
+				data->dst_picture.data,
 				data->dst_picture.linesize);
-	else
-		copy_data(&data->dst_picture, frame, context->height);
+		vframe      = data->vframe;
+		vframe->pts = src->pts;
+	}
+
+	/* requested by the write thread when a segment is full */
+	vframe->pict_type = AV_PICTURE_TYPE_NONE;
+	if (data->force_keyframe) {
+		vframe->pict_type    = AV_PICTURE_TYPE_I;
+		data->force_keyframe = false;
+	}
 
 	if (data->output->flags & AVFMT_RAWPICTURE) {
+		if (vframe == src)
+			av_picture_copy(&data->dst_picture,
+					(const AVPicture*)src, format,
+					context->width, context->height);
+
 		packet.flags        |= AV_PKT_FLAG_KEY;
 		packet.stream_index  = data->video->index;
 		packet.data          = data->dst_picture.data[0];
 		packet.size          = sizeof(AVPicture);
 
-		pthread_mutex_lock(&output->write_mutex);
-		da_push_back(output->packets, &packet);
-		pthread_mutex_unlock(&output->write_mutex);
-		os_sem_post(output->write_sem);
+		push_packet(output, &packet);
 
 	} else {
-		data->vframe->pts = data->total_frames;
-		ret = avcodec_encode_video2(context, &packet, data->vframe,
+		ret = avcodec_encode_video2(context, &packet, vframe,
 				&got_packet);
 		if (ret < 0) {
-			blog(LOG_WARNING, "receive_video: Error encoding "
+			blog(LOG_WARNING, "encode_video: Error encoding "
 			                  "video: %s", av_err2str(ret));
 			return;
 		}
@@ -531,45 +647,64 @@ static void receive_video(void *param, struct video_data *frame)
 					context->time_base,
 					data->video->time_base);
 
-			pthread_mutex_lock(&output->write_mutex);
-			da_push_back(output->packets, &packet);
-			pthread_mutex_unlock(&output->write_mutex);
-			os_sem_post(output->write_sem);
+			push_packet(output, &packet);
 		} else {
 			ret = 0;
 		}
 	}
 
 	if (ret != 0) {
-		blog(LOG_WARNING, "receive_video: Error writing video: %s",
+		blog(LOG_WARNING, "encode_video: Error writing video: %s",
 				av_err2str(ret));
 	}
+}
+
+/* only copies the frame, the video thread must never wait on the encoder */
+static void receive_video(void *param, struct video_data *frame)
+{
+	struct ffmpeg_output *output = param;
+	struct ffmpeg_data   *data   = &output->ff_data;
+	AVFrame              *vframe;
+
+	if (!data->start_timestamp)
+		data->start_timestamp = frame->timestamp;
+
+	/* frames are numbered as they arrive, so a dropped frame leaves a gap
+	 * in the timestamps rather than shifting everything after it */
+	if (!mpsc_queue_pop(&output->free_video_frames, &vframe)) {
+		os_atomic_inc_long(&output->dropped_frames);
+		data->total_frames++;
+		return;
+	}
 
-	data->total_frames++;
+	copy_data((AVPicture*)vframe, frame, data->video->codec->height);
+	vframe->pts = data->total_frames++;
+
+	mpsc_queue_push(&output->video_frames, &vframe);
+	os_sem_post(output->video_sem);
 }
 
 static void encode_audio(struct ffmpeg_output *output,
-		struct AVCodecContext *context, size_t block_size)
+		struct AVCodecContext *context, uint8_t *planes[MAX_AV_PLANES])
 {
 	struct ffmpeg_data *data = &output->ff_data;
 
 	AVPacket packet = {0};
 	int ret, got_packet;
-	size_t total_size = data->frame_size * block_size * context->channels;
+	size_t plane_size = (size_t)data->frame_size * data->audio_size;
 
 	data->aframe->nb_samples = data->frame_size;
 	data->aframe->pts = av_rescale_q(data->total_samples,
 			(AVRational){1, context->sample_rate},
 			context->time_base);
 
-	ret = avcodec_fill_audio_frame(data->aframe, context->channels,
-			context->sample_fmt, data->samples[0],
-			(int)total_size, 1);
-	if (ret < 0) {
-		blog(LOG_WARNING, "encode_audio: avcodec_fill_audio_frame "
-		                  "failed: %s", av_err2str(ret));
-		return;
-	}
+	/* point the frame straight at the assembled audio rather than copying
+	 * it in to a separate buffer */
+	for (size_t i = 0; i < data->audio_planes; i++)
+		data->aframe->data[i] = planes[i];
+
+	data->aframe->linesize[0]   = (int)plane_size;
+	data->aframe->extended_data = data->aframe->data;
 
 	data->total_samples += data->frame_size;
 
@@ -590,10 +725,7 @@ static void encode_audio(struct ffmpeg_output *output,
 			data->audio->time_base);
 	packet.stream_index = data->audio->index;
 
-	pthread_mutex_lock(&output->write_mutex);
-	da_push_back(output->packets, &packet);
-	pthread_mutex_unlock(&output->write_mutex);
-	os_sem_post(output->write_sem);
+	push_packet(output, &packet);
 }
 
 static bool prepare_audio(struct ffmpeg_data *data,
@@ -622,65 +754,413 @@ static bool prepare_audio(struct ffmpeg_data *data,
 	return true;
 }
 
+/* only copies the audio, it's assembled and encoded on the audio thread */
 static void receive_audio(void *param, struct audio_data *frame)
 {
 	struct ffmpeg_output *output = param;
 	struct ffmpeg_data   *data   = &output->ff_data;
-	size_t frame_size_bytes;
-	struct audio_data in;
-
-	AVCodecContext *context = data->audio->codec;
+	struct audio_data    in;
+	struct audio_chunk   chunk;
+	size_t               size;
 
 	if (!data->start_timestamp)
 		return;
 	if (!prepare_audio(data, frame, &in))
 		return;
 
-	frame_size_bytes = (size_t)data->frame_size * data->audio_size;
+	size = in.frames * data->audio_size;
+	chunk.frames  = in.frames;
+	chunk.data[0] = bmalloc(size * data->audio_planes);
 
-	for (size_t i = 0; i < data->audio_planes; i++)
-		circlebuf_push_back(&data->excess_frames[i], in.data[i],
-				in.frames * data->audio_size);
+	for (size_t i = 0; i < data->audio_planes; i++) {
+		chunk.data[i] = chunk.data[0] + size * i;
+		memcpy(chunk.data[i], in.data[i], size);
+	}
 
-	while (data->excess_frames[0].size >= frame_size_bytes) {
-		for (size_t i = 0; i < data->audio_planes; i++)
-			circlebuf_pop_front(&data->excess_frames[i],
-					data->samples[i], frame_size_bytes);
+	if (!mpsc_queue_push(&output->audio_chunks, &chunk)) {
+		blog(LOG_WARNING, "receive_audio: Audio queue is full, "
+		                  "dropping audio");
+		bfree(chunk.data[0]);
+		return;
+	}
+
+	os_sem_post(output->audio_sem);
+}
+
+static void encode_audio_chunk(struct ffmpeg_output *output,
+		struct audio_chunk *chunk)
+{
+	struct ffmpeg_data *data    = &output->ff_data;
+	AVCodecContext     *context = data->audio->codec;
+	uint8_t            *planes[MAX_AV_PLANES];
+
+	audio_frame_assembler_push(&data->audio_frames,
+			(const uint8_t *const*)chunk->data,
+			chunk->frames * data->audio_size);
+	bfree(chunk->data[0]);
+
+	while (audio_frame_assembler_peek(&data->audio_frames, planes)) {
+		encode_audio(output, context, planes);
+		audio_frame_assembler_pop(&data->audio_frames);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* encode threads */
+
+static void *video_thread(void *data)
+{
+	struct ffmpeg_output *output = data;
+	AVFrame              *frame;
+
+	/* everything queued is encoded before checking for the stop event,
+	 * so no frames are lost at the end of a recording */
+	while (os_sem_wait(output->video_sem) == 0) {
+		while (mpsc_queue_pop(&output->video_frames, &frame)) {
+			encode_video(output, frame);
+			mpsc_queue_push(&output->free_video_frames, &frame);
+		}
+
+		if (os_event_try(output->encode_stop_event) == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static void *audio_thread(void *data)
+{
+	struct ffmpeg_output *output = data;
+	struct audio_chunk   chunk;
+
+	while (os_sem_wait(output->audio_sem) == 0) {
+		while (mpsc_queue_pop(&output->audio_chunks, &chunk))
+			encode_audio_chunk(output, &chunk);
+
+		if (os_event_try(output->encode_stop_event) == 0)
+			break;
+	}
+
+	return NULL;
+}
+
+static bool alloc_video_frames(struct ffmpeg_output *output)
+{
+	AVCodecContext     *context = output->ff_data.video->codec;
+	enum AVPixelFormat format;
+
+	format = obs_to_ffmpeg_video_format(OBS_FFMPEG_VIDEO_FORMAT);
+
+	for (size_t i = 0; i < VIDEO_POOL_SIZE; i++) {
+		AVFrame   *frame = av_frame_alloc();
+		AVPicture picture;
+
+		if (!frame)
+			return false;
+
+		output->video_pool[i] = frame;
+
+		if (avpicture_alloc(&picture, format,
+					context->width, context->height) < 0)
+			return false;
+
+		*((AVPicture*)frame) = picture;
+		frame->format = format;
+		frame->width  = context->width;
+		frame->height = context->height;
+
+		mpsc_queue_push(&output->free_video_frames, &frame);
+	}
+
+	return true;
+}
 
-		encode_audio(output, context, data->audio_size);
+static void free_video_frames(struct ffmpeg_output *output)
+{
+	AVFrame            *frame;
+	struct audio_chunk chunk;
+
+	while (mpsc_queue_pop(&output->video_frames, &frame));
+	while (mpsc_queue_pop(&output->free_video_frames, &frame));
+	while (mpsc_queue_pop(&output->audio_chunks, &chunk))
+		bfree(chunk.data[0]);
+
+	for (size_t i = 0; i < VIDEO_POOL_SIZE; i++) {
+		if (output->video_pool[i]) {
+			avpicture_free((AVPicture*)output->video_pool[i]);
+			av_frame_free(&output->video_pool[i]);
+		}
+	}
+}
+
+static bool start_encode_threads(struct ffmpeg_output *output)
+{
+	struct ffmpeg_data *data = &output->ff_data;
+
+	if (data->video) {
+		if (!alloc_video_frames(output)) {
+			blog(LOG_WARNING, "Failed to allocate video frames");
+			return false;
+		}
+
+		if (pthread_create(&output->video_thread, NULL, video_thread,
+					output) != 0)
+			return false;
+	}
+
+	if (data->audio) {
+		if (pthread_create(&output->audio_thread, NULL, audio_thread,
+					output) != 0) {
+			os_event_signal(output->encode_stop_event);
+			if (data->video) {
+				os_sem_post(output->video_sem);
+				pthread_join(output->video_thread, NULL);
+			}
+			os_event_reset(output->encode_stop_event);
+			return false;
+		}
 	}
+
+	output->encode_threads_active = true;
+	return true;
 }
 
-static bool process_packet(struct ffmpeg_output *output)
+/* data capture has ended at this point, so the threads encode whatever is
+ * still queued and then exit */
+static void stop_encode_threads(struct ffmpeg_output *output)
+{
+	struct ffmpeg_data *data = &output->ff_data;
+
+	if (output->encode_threads_active) {
+		os_event_signal(output->encode_stop_event);
+
+		if (data->video) {
+			os_sem_post(output->video_sem);
+			pthread_join(output->video_thread, NULL);
+		}
+		if (data->audio) {
+			os_sem_post(output->audio_sem);
+			pthread_join(output->audio_thread, NULL);
+		}
+
+		os_event_reset(output->encode_stop_event);
+		output->encode_threads_active = false;
+	}
+
+	free_video_frames(output);
+}
+
+static inline void free_packets(struct ffmpeg_output *output)
 {
 	AVPacket packet;
-	bool new_packet = false;
+
+	while (mpsc_queue_pop(&output->packets, &packet))
+		av_free_packet(&packet);
+}
+
+/* ------------------------------------------------------------------------- */
+/* file segmenting */
+
+/* segments after the first are named <name>_001.ext, <name>_002.ext, etc */
+static void get_segment_path(struct dstr *dst, const char *path, uint32_t idx)
+{
+	const char *ext    = strrchr(path, '.');
+	const char *slash  = strrchr(path, '/');
+	const char *bslash = strrchr(path, '\\');
+
+	if (bslash > slash)
+		slash = bslash;
+	if (!ext || ext < slash)
+		ext = path + strlen(path);
+
+	dstr_ncopy(dst, path, ext - path);
+	dstr_catf(dst, "_%03u%s", idx, ext);
+}
+
+/* creates a new file with the same format and streams as the encoding
+ * context, without touching the encoders themselves */
+static AVFormatContext *open_segment(struct ffmpeg_data *data,
+		const char *path)
+{
+	AVFormatContext *file = NULL;
 	int ret;
 
-	pthread_mutex_lock(&output->write_mutex);
-	if (output->packets.num) {
-		packet = output->packets.array[0];
-		da_erase(output->packets, 0);
-		new_packet = true;
+	avformat_alloc_output_context2(&file, data->output->oformat, NULL,
+			path);
+	if (!file) {
+		blog(LOG_WARNING, "Couldn't create avformat context for '%s'",
+				path);
+		return NULL;
 	}
-	pthread_mutex_unlock(&output->write_mutex);
 
-	if (!new_packet)
-		return true;
+	for (unsigned i = 0; i < data->output->nb_streams; i++) {
+		AVStream *src = data->output->streams[i];
+		AVStream *dst = avformat_new_stream(file, src->codec->codec);
+
+		if (!dst || avcodec_copy_context(dst->codec, src->codec) < 0) {
+			blog(LOG_WARNING, "Couldn't copy stream %u to '%s'",
+					i, path);
+			goto fail;
+		}
+
+		dst->id = src->id;
+	}
 
-	/*blog(LOG_DEBUG, "size = %d, flags = %lX, stream = %d, "
-			"packets queued: %lu",
-			packet.size, packet.flags,
-			packet.stream_index, output->packets.num);*/
+	ret = avio_open(&file->pb, path, AVIO_FLAG_WRITE);
+	if (ret < 0) {
+		blog(LOG_WARNING, "Couldn't open file '%s', %s",
+				path, av_err2str(ret));
+		goto fail;
+	}
 
-	ret = av_interleaved_write_frame(output->ff_data.output, &packet);
+	ret = avformat_write_header(file, NULL);
 	if (ret < 0) {
-		av_free_packet(&packet);
-		blog(LOG_WARNING, "receive_audio: Error writing packet: %s",
-				av_err2str(ret));
+		blog(LOG_WARNING, "Error opening file '%s': %s",
+				path, av_err2str(ret));
+		goto fail;
+	}
+
+	return file;
+
+fail:
+	avio_close(file->pb);
+	avformat_free_context(file);
+	return NULL;
+}
+
+/* starts a new segment at the keyframe at the given time.  the previous
+ * segment is kept open until audio has caught up with the split point, so
+ * that no audio is lost between the two files. */
+static bool rotate_segment(struct ffmpeg_data *data, int64_t time)
+{
+	AVFormatContext *file;
+
+	get_segment_path(&data->segment_path, data->filename.array,
+			++data->segment_idx);
+
+	file = open_segment(data, data->segment_path.array);
+	if (!file)
 		return false;
+
+	if (data->prev_file)
+		close_file(data, data->prev_file);
+
+	data->prev_file          = data->file;
+	data->prev_segment_start = data->segment_start;
+	data->file               = file;
+	data->segment_start      = time;
+	data->rotate_pending     = false;
+
+	if (!data->audio) {
+		close_file(data, data->prev_file);
+		data->prev_file = NULL;
 	}
 
+	blog(LOG_INFO, "Continuing recording in '%s'",
+			data->segment_path.array);
+	return true;
+}
+
+static inline bool segment_full(struct ffmpeg_data *data, int64_t time)
+{
+	if (data->segment_duration &&
+	    time - data->segment_start >= data->segment_duration)
+		return true;
+
+	return data->segment_size &&
+		avio_tell(data->file->pb) >= data->segment_size;
+}
+
+/* packets are timestamped for the encoding context, so for later segments
+ * they're rebased to the start of the segment and converted to its stream
+ * time bases */
+static int write_to_file(struct ffmpeg_data *data, AVFormatContext *file,
+		int64_t start, AVPacket *packet)
+{
+	AVRational src = data->output->streams[packet->stream_index]->time_base;
+	AVRational dst = file->streams[packet->stream_index]->time_base;
+	int64_t    offset;
+
+	if (file != data->output) {
+		offset = av_rescale_q(start, AV_TIME_BASE_Q, src);
+
+		if (packet->pts != AV_NOPTS_VALUE)
+			packet->pts = av_rescale_q(packet->pts - offset,
+					src, dst);
+		if (packet->dts != AV_NOPTS_VALUE)
+			packet->dts = av_rescale_q(packet->dts - offset,
+					src, dst);
+		packet->duration = (int)av_rescale_q(packet->duration,
+				src, dst);
+	}
+
+	return av_interleaved_write_frame(file, packet);
+}
+
+static int write_packet(struct ffmpeg_data *data, AVPacket *packet)
+{
+	AVStream *stream = data->output->streams[packet->stream_index];
+	int64_t  time;
+
+	if (!data->segment_duration && !data->segment_size)
+		return av_interleaved_write_frame(data->output, packet);
+
+	time = av_rescale_q(packet->dts, stream->time_base, AV_TIME_BASE_Q);
+
+	if (stream == data->video) {
+		if (!data->segment_started) {
+			data->segment_start   = time;
+			data->segment_started = true;
+		}
+
+		if (!data->rotate_pending && segment_full(data, time)) {
+			data->rotate_pending = true;
+			data->force_keyframe = true;
+		}
+
+		if (data->rotate_pending && (packet->flags & AV_PKT_FLAG_KEY))
+			if (!rotate_segment(data, time))
+				return AVERROR(EIO);
+
+	} else if (data->prev_file) {
+		if (time < data->segment_start)
+			return write_to_file(data, data->prev_file,
+					data->prev_segment_start, packet);
+
+		close_file(data, data->prev_file);
+		data->prev_file = NULL;
+	}
+
+	return write_to_file(data, data->file, data->segment_start, packet);
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* writes every packet that is currently queued */
+static bool process_packets(struct ffmpeg_output *output)
+{
+	AVPacket packets[PACKET_BATCH_SIZE];
+	size_t   num;
+	int      ret;
+
+	do {
+		num = mpsc_queue_pop_batch(&output->packets, packets,
+				PACKET_BATCH_SIZE);
+
+		for (size_t i = 0; i < num; i++) {
+			ret = write_packet(&output->ff_data, packets+i);
+			if (ret < 0) {
+				for (; i < num; i++)
+					av_free_packet(packets+i);
+
+				blog(LOG_WARNING, "process_packets: Error "
+				                  "writing packet: %s",
+				                  av_err2str(ret));
+				return false;
+			}
+		}
+	} while (num == PACKET_BATCH_SIZE);
+
 	return true;
 }
 
@@ -693,7 +1173,7 @@ static void *write_thread(void *data)
 		if (os_event_try(output->stop_event) == 0)
 			break;
 
-		if (!process_packet(output)) {
+		if (!process_packets(output)) {
 			pthread_detach(output->write_thread);
 			output->write_thread_active = false;
 
@@ -711,20 +1191,31 @@ static bool try_connect(struct ffmpeg_output *output)
 	const char *filename_test;
 	obs_data_t settings;
 	int audio_bitrate, video_bitrate;
+	int64_t segment_duration, segment_size;
 	int ret;
 
 	settings = obs_output_get_settings(output->output);
 	filename_test = obs_data_getstring(settings, "filename");
 	video_bitrate = (int)obs_data_getint(settings, "video_bitrate");
 	audio_bitrate = (int)obs_data_getint(settings, "audio_bitrate");
-	obs_data_release(settings);
-
-	if (!filename_test || !*filename_test)
-		return false;
+	segment_duration = obs_data_getint(settings, "segment_duration");
+	segment_size = obs_data_getint(settings, "segment_size");
 
 	if (!ffmpeg_data_init(&output->ff_data, filename_test,
-				video_bitrate, audio_bitrate))
+				video_bitrate, audio_bitrate)) {
+		obs_data_release(settings);
 		return false;
+	}
+
+	obs_data_release(settings);
+
+	/* segments are in seconds and megabytes, and only apply to files */
+	if ((output->ff_data.output->oformat->flags & AVFMT_NOFILE) == 0 &&
+	    astrcmp_n(output->ff_data.filename.array, "rtmp://", 7) != 0) {
+		output->ff_data.segment_duration = segment_duration *
+			AV_TIME_BASE;
+		output->ff_data.segment_size = segment_size * 1024 * 1024;
+	}
 
 	struct audio_convert_info aci = {
 		.format = output->ff_data.audio_format
@@ -739,6 +1230,15 @@ static bool try_connect(struct ffmpeg_output *output)
 	if (!obs_output_can_begin_data_capture(output->output, 0))
 		return false;
 
+	output->dropped_frames = 0;
+
+	if (!start_encode_threads(output)) {
+		blog(LOG_WARNING, "ffmpeg_output_start: failed to create "
+		                  "encode threads.");
+		ffmpeg_output_stop(output);
+		return false;
+	}
+
 	ret = pthread_create(&output->write_thread, NULL, write_thread, output);
 	if (ret != 0) {
 		blog(LOG_WARNING, "ffmpeg_output_start: failed to create write "
@@ -785,6 +1285,10 @@ static void ffmpeg_output_stop(void *data)
 	if (output->active) {
 		obs_output_end_data_capture(output->output);
 
+		/* the encode threads feed the write thread, so they have to
+		 * be stopped first */
+		stop_encode_threads(output);
+
 		if (output->write_thread_active) {
 			os_event_signal(output->stop_event);
 			os_sem_post(output->write_sem);
@@ -792,26 +1296,26 @@ static void ffmpeg_output_stop(void *data)
 			output->write_thread_active = false;
 		}
 
-		pthread_mutex_lock(&output->write_mutex);
-
-		for (size_t i = 0; i < output->packets.num; i++)
-			av_free_packet(output->packets.array+i);
-		da_free(output->packets);
-
-		pthread_mutex_unlock(&output->write_mutex);
-
+		free_packets(output);
 		ffmpeg_data_free(&output->ff_data);
 	}
 }
 
+static int ffmpeg_output_dropped_frames(void *data)
+{
+	struct ffmpeg_output *output = data;
+	return (int)output->dropped_frames;
+}
+
 struct obs_output_info ffmpeg_output = {
-	.id        = "ffmpeg_output",
-	.flags     = OBS_OUTPUT_AUDIO | OBS_OUTPUT_VIDEO,
-	.getname   = ffmpeg_output_getname,
-	.create    = ffmpeg_output_create,
-	.destroy   = ffmpeg_output_destroy,
-	.start     = ffmpeg_output_start,
-	.stop      = ffmpeg_output_stop,
-	.raw_video = receive_video,
-	.raw_audio = receive_audio,
+	.id             = "ffmpeg_output",
+	.flags          = OBS_OUTPUT_AUDIO | OBS_OUTPUT_VIDEO,
+	.getname        = ffmpeg_output_getname,
+	.create         = ffmpeg_output_create,
+	.destroy        = ffmpeg_output_destroy,
+	.start          = ffmpeg_output_start,
+	.stop           = ffmpeg_output_stop,
+	.raw_video      = receive_video,
+	.raw_audio      = receive_audio,
+	.dropped_frames = ffmpeg_output_dropped_frames
 };
@@ -0,0 +1,516 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <util/bmem.h>
+#include <util/base.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include "file-writer.h"
+
+#ifdef _WIN32
+#include <io.h>
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+/* buffer sizes and, with direct I/O, writes and file offsets are all
+ * multiples of this */
+#define FILE_WRITER_ALIGN 4096
+
+/* partially filled buffers are written after this long, so that not too much
+ * is lost if the program stops unexpectedly */
+#define FLUSH_INTERVAL_NS 2000000000ULL
+
+struct file_writer {
+	struct dstr         path;
+#ifdef _WIN32
+	FILE                *file;
+#else
+	int                 fd;
+#endif
+	bool                direct_io;
+	enum file_sync_mode sync_mode;
+	uint64_t            sync_interval_ns;
+
+	uint8_t             *buffers[2];
+	size_t              buffer_size;
+
+	/* used by the writing thread */
+	size_t              fill_idx;
+	size_t              fill_size;
+	int64_t             total_size;
+	uint64_t            last_submit_ns;
+	bool                closed;
+
+	/* used by the I/O thread */
+	pthread_t           io_thread;
+	bool                io_thread_active;
+	os_sem_t            write_sem;
+	os_sem_t            free_sem;
+	size_t              write_sizes[2];
+	size_t              write_idx;
+	volatile bool       writing;
+	volatile bool       exiting;
+	volatile bool       error;
+	uint64_t            file_size;
+	uint64_t            last_sync_ns;
+
+	pthread_mutex_t     stats_mutex;
+	uint64_t            write_time_total;
+	struct file_writer_stats stats;
+};
+
+/* ------------------------------------------------------------------------- */
+/* platform specific file access                                             */
+
+static void *aligned_alloc_buffer(size_t size)
+{
+#ifdef _WIN32
+	return _aligned_malloc(size, FILE_WRITER_ALIGN);
+#else
+	void *ptr;
+	return (posix_memalign(&ptr, FILE_WRITER_ALIGN, size) == 0) ?
+		ptr : NULL;
+#endif
+}
+
+static void aligned_free_buffer(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+#ifdef _WIN32
+
+static bool open_file(struct file_writer *fw, bool direct_io)
+{
+	if (direct_io)
+		blog(LOG_INFO, "file_writer: Direct I/O is not supported on "
+		               "this platform");
+
+	fw->direct_io = false;
+	fw->file = os_fopen(fw->path.array, "wb");
+	return fw->file != NULL;
+}
+
+static bool write_data(struct file_writer *fw, const uint8_t *data,
+		size_t size)
+{
+	return fwrite(data, 1, size, fw->file) == size;
+}
+
+static void sync_file(struct file_writer *fw)
+{
+	fflush(fw->file);
+	_commit(_fileno(fw->file));
+}
+
+static void drop_cached_data(struct file_writer *fw, uint64_t offset,
+		uint64_t size)
+{
+	UNUSED_PARAMETER(fw);
+	UNUSED_PARAMETER(offset);
+	UNUSED_PARAMETER(size);
+}
+
+static void close_file(struct file_writer *fw)
+{
+	if (fw->file) {
+		fclose(fw->file);
+		fw->file = NULL;
+	}
+}
+
+#else
+
+static int open_fd(const char *path, int extra_flags)
+{
+	return open(path, O_WRONLY | O_CREAT | O_TRUNC | extra_flags, 0644);
+}
+
+static bool open_file(struct file_writer *fw, bool direct_io)
+{
+	fw->direct_io = false;
+	fw->fd = -1;
+
+#ifdef O_DIRECT
+	if (direct_io) {
+		fw->fd = open_fd(fw->path.array, O_DIRECT);
+		if (fw->fd != -1)
+			fw->direct_io = true;
+		else
+			blog(LOG_INFO, "file_writer: Direct I/O not supported "
+			               "for '%s' (%d), using buffered I/O",
+			               fw->path.array, errno);
+	}
+#endif
+
+	if (fw->fd == -1)
+		fw->fd = open_fd(fw->path.array, 0);
+	if (fw->fd == -1)
+		return false;
+
+#if defined(F_NOCACHE)
+	if (direct_io)
+		fcntl(fw->fd, F_NOCACHE, 1);
+#endif
+#if defined(POSIX_FADV_SEQUENTIAL)
+	posix_fadvise(fw->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	return true;
+}
+
+static bool write_data(struct file_writer *fw, const uint8_t *data,
+		size_t size)
+{
+	while (size) {
+		ssize_t ret = write(fw->fd, data, size);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		data += ret;
+		size -= (size_t)ret;
+	}
+
+	return true;
+}
+
+static void sync_file(struct file_writer *fw)
+{
+#if defined(__linux__)
+	fdatasync(fw->fd);
+#else
+	fsync(fw->fd);
+#endif
+}
+
+/* data that has been written out doesn't need to stay in the page cache,
+ * this also gets the system to start writing it out */
+static void drop_cached_data(struct file_writer *fw, uint64_t offset,
+		uint64_t size)
+{
+#if defined(POSIX_FADV_DONTNEED)
+	if (!fw->direct_io)
+		posix_fadvise(fw->fd, (off_t)offset, (off_t)size,
+				POSIX_FADV_DONTNEED);
+#else
+	UNUSED_PARAMETER(fw);
+	UNUSED_PARAMETER(offset);
+	UNUSED_PARAMETER(size);
+#endif
+}
+
+static void close_file(struct file_writer *fw)
+{
+	if (fw->fd == -1)
+		return;
+
+	/* direct writes are padded to the alignment, so cut the padding
+	 * back off */
+	if (fw->direct_io && ftruncate(fw->fd, (off_t)fw->total_size) != 0)
+		blog(LOG_WARNING, "file_writer: Failed to truncate '%s'",
+				fw->path.array);
+
+	close(fw->fd);
+	fw->fd = -1;
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* I/O thread                                                                */
+
+static void sync_data(struct file_writer *fw)
+{
+	uint64_t start = os_gettime_ns();
+	uint64_t time;
+
+	sync_file(fw);
+	time = os_gettime_ns() - start;
+	fw->last_sync_ns = start;
+
+	pthread_mutex_lock(&fw->stats_mutex);
+	fw->stats.syncs++;
+	if (time > fw->stats.max_sync_time)
+		fw->stats.max_sync_time = time;
+	pthread_mutex_unlock(&fw->stats_mutex);
+}
+
+static void write_buffer(struct file_writer *fw, const uint8_t *data,
+		size_t size)
+{
+	struct file_writer_stats *stats = &fw->stats;
+	uint64_t                 start;
+	uint64_t                 time;
+
+	if (!size || fw->error)
+		return;
+
+	start = os_gettime_ns();
+	if (!write_data(fw, data, size)) {
+		blog(LOG_WARNING, "file_writer: Failed to write to '%s' (%d)",
+				fw->path.array, errno);
+		fw->error = true;
+		return;
+	}
+	time = os_gettime_ns() - start;
+
+	pthread_mutex_lock(&fw->stats_mutex);
+	fw->write_time_total   += time;
+	stats->bytes_written   += size;
+	stats->writes++;
+	stats->last_write_time  = time;
+	stats->avg_write_time   = fw->write_time_total / stats->writes;
+	if (time > stats->max_write_time)
+		stats->max_write_time = time;
+	pthread_mutex_unlock(&fw->stats_mutex);
+
+	drop_cached_data(fw, fw->file_size, size);
+	fw->file_size += size;
+
+	if (fw->sync_mode == FILE_SYNC_WRITE ||
+	    (fw->sync_mode == FILE_SYNC_INTERVAL &&
+	     start - fw->last_sync_ns >= fw->sync_interval_ns))
+		sync_data(fw);
+}
+
+static void *io_thread(void *data)
+{
+	struct file_writer *fw = data;
+
+	while (os_sem_wait(fw->write_sem) == 0) {
+		size_t idx = fw->write_idx;
+
+		write_buffer(fw, fw->buffers[idx], fw->write_sizes[idx]);
+
+		/* the last buffer is only submitted once the other one has
+		 * been written */
+		if (fw->exiting)
+			break;
+
+		fw->write_idx = idx ^ 1;
+		fw->writing   = false;
+		os_sem_post(fw->free_sem);
+	}
+
+	if (fw->sync_mode != FILE_SYNC_NONE && !fw->error)
+		sync_data(fw);
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/* hands the buffer being filled to the I/O thread, and continues with the
+ * other one once the I/O thread is done with it.  with direct I/O only whole
+ * blocks can be written, so the rest is carried over to the next buffer
+ * unless it's the last buffer, which is padded instead. */
+static void submit_buffer(struct file_writer *fw, bool last)
+{
+	size_t  idx  = fw->fill_idx;
+	size_t  size = fw->fill_size;
+	size_t  tail = 0;
+	uint64_t start = os_gettime_ns();
+	uint64_t wait_time;
+
+	os_sem_wait(fw->free_sem);
+
+	wait_time = os_gettime_ns() - start;
+	if (wait_time > 1000000) {
+		pthread_mutex_lock(&fw->stats_mutex);
+		fw->stats.stalls++;
+		fw->stats.stall_time += wait_time;
+		pthread_mutex_unlock(&fw->stats_mutex);
+	}
+
+	if (fw->direct_io) {
+		if (last) {
+			size_t padded = (size + FILE_WRITER_ALIGN - 1) &
+				~(size_t)(FILE_WRITER_ALIGN - 1);
+			memset(fw->buffers[idx] + size, 0, padded - size);
+			size = padded;
+		} else {
+			tail  = size & (FILE_WRITER_ALIGN - 1);
+			size -= tail;
+			memcpy(fw->buffers[idx ^ 1], fw->buffers[idx] + size,
+					tail);
+		}
+	}
+
+	fw->write_sizes[idx] = size;
+	fw->writing          = true;
+	fw->exiting          = last;
+	os_sem_post(fw->write_sem);
+
+	fw->fill_idx       = idx ^ 1;
+	fw->fill_size      = tail;
+	fw->last_submit_ns = start;
+}
+
+void file_writer_write(struct file_writer *fw, const void *data, size_t size)
+{
+	const uint8_t *ptr = data;
+
+	if (!fw || fw->closed)
+		return;
+
+	fw->total_size += (int64_t)size;
+
+	while (size) {
+		size_t left = fw->buffer_size - fw->fill_size;
+		if (left > size)
+			left = size;
+
+		memcpy(fw->buffers[fw->fill_idx] + fw->fill_size, ptr, left);
+		fw->fill_size += left;
+		ptr           += left;
+		size          -= left;
+
+		if (fw->fill_size == fw->buffer_size)
+			submit_buffer(fw, false);
+	}
+
+	/* don't wait on the I/O thread just to write a partial buffer */
+	if (fw->fill_size && !fw->writing &&
+	    os_gettime_ns() - fw->last_submit_ns >= FLUSH_INTERVAL_NS)
+		submit_buffer(fw, false);
+}
+
+struct file_writer *file_writer_create(const char *path,
+		const struct file_writer_info *info)
+{
+	struct file_writer *fw = bzalloc(sizeof(struct file_writer));
+	size_t             size;
+
+	pthread_mutex_init_value(&fw->stats_mutex);
+#ifndef _WIN32
+	fw->fd = -1;
+#endif
+
+	dstr_copy(&fw->path, path);
+	fw->sync_mode        = info->sync_mode;
+	fw->sync_interval_ns = (uint64_t)info->sync_interval_ms * 1000000;
+	fw->last_submit_ns   = os_gettime_ns();
+	fw->last_sync_ns     = fw->last_submit_ns;
+
+	size = info->buffer_size < FILE_WRITER_ALIGN ?
+		FILE_WRITER_ALIGN : info->buffer_size;
+	fw->buffer_size = (size + FILE_WRITER_ALIGN - 1) &
+		~(size_t)(FILE_WRITER_ALIGN - 1);
+
+	if (pthread_mutex_init(&fw->stats_mutex, NULL) != 0)
+		goto fail;
+	if (os_sem_init(&fw->write_sem, 0) != 0)
+		goto fail;
+	if (os_sem_init(&fw->free_sem, 1) != 0)
+		goto fail;
+
+	for (size_t i = 0; i < 2; i++) {
+		fw->buffers[i] = aligned_alloc_buffer(fw->buffer_size);
+		if (!fw->buffers[i])
+			goto fail;
+	}
+
+	if (!open_file(fw, info->direct_io)) {
+		blog(LOG_WARNING, "file_writer: Unable to open '%s'", path);
+		goto fail;
+	}
+
+	if (pthread_create(&fw->io_thread, NULL, io_thread, fw) != 0) {
+		blog(LOG_WARNING, "file_writer: Failed to create I/O thread");
+		goto fail;
+	}
+
+	fw->io_thread_active = true;
+	return fw;
+
+fail:
+	file_writer_destroy(fw);
+	return NULL;
+}
+
+bool file_writer_close(struct file_writer *fw)
+{
+	if (!fw || fw->closed)
+		return false;
+
+	fw->closed = true;
+
+	if (fw->io_thread_active) {
+		submit_buffer(fw, true);
+		pthread_join(fw->io_thread, NULL);
+		fw->io_thread_active = false;
+	}
+
+	close_file(fw);
+	return !fw->error;
+}
+
+void file_writer_destroy(struct file_writer *fw)
+{
+	if (!fw)
+		return;
+
+	if (!fw->closed)
+		file_writer_close(fw);
+	else
+		close_file(fw);
+
+	for (size_t i = 0; i < 2; i++)
+		aligned_free_buffer(fw->buffers[i]);
+
+	os_sem_destroy(fw->write_sem);
+	os_sem_destroy(fw->free_sem);
+	pthread_mutex_destroy(&fw->stats_mutex);
+	dstr_free(&fw->path);
+	bfree(fw);
+}
+
+int64_t file_writer_tell(struct file_writer *fw)
+{
+	return fw ? fw->total_size : 0;
+}
+
+void file_writer_get_stats(struct file_writer *fw,
+		struct file_writer_stats *stats)
+{
+	if (!fw || !stats)
+		return;
+
+	pthread_mutex_lock(&fw->stats_mutex);
+	*stats = fw->stats;
+	pthread_mutex_unlock(&fw->stats_mutex);
+}
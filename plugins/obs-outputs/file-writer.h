@@ -0,0 +1,79 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#pragma once
+
+#include <util/c99defs.h>
+
+/*
+ * Buffered file writer
+ *
+ *   Writes a file from its own I/O thread.  Data is copied in to one of two
+ * large aligned buffers, and each buffer is handed to the I/O thread once
+ * it's full (or has been partially filled for a while), so the caller only
+ * waits for the disk when both buffers are in use.
+ *
+ *   Only one thread may write to a file writer at a time.
+ */
+
+enum file_sync_mode {
+	FILE_SYNC_NONE,     /* leave flushing to the system */
+	FILE_SYNC_CLOSE,    /* sync when the file is closed */
+	FILE_SYNC_INTERVAL, /* sync every sync_interval_ms, and on close */
+	FILE_SYNC_WRITE     /* sync after every buffer write, and on close */
+};
+
+struct file_writer_info {
+	size_t              buffer_size;
+	bool                direct_io;
+	enum file_sync_mode sync_mode;
+	uint32_t            sync_interval_ms;
+};
+
+struct file_writer_stats {
+	uint64_t            bytes_written;
+	uint64_t            writes;
+	uint64_t            last_write_time; /* ns */
+	uint64_t            avg_write_time;  /* ns */
+	uint64_t            max_write_time;  /* ns */
+	uint64_t            syncs;
+	uint64_t            max_sync_time;   /* ns */
+	uint64_t            stalls;          /* waits for a free buffer */
+	uint64_t            stall_time;      /* total ns spent waiting */
+};
+
+struct file_writer;
+
+extern struct file_writer *file_writer_create(const char *path,
+		const struct file_writer_info *info);
+extern void file_writer_destroy(struct file_writer *fw);
+
+extern void file_writer_write(struct file_writer *fw, const void *data,
+		size_t size);
+
+/**
+ * Writes everything that is buffered, syncs the file according to the sync
+ * mode, and closes it.  Returns false if any write failed.  Statistics can
+ * still be queried afterward.
+ */
+extern bool file_writer_close(struct file_writer *fw);
+
+/** Returns the number of bytes written to the file writer so far */
+extern int64_t file_writer_tell(struct file_writer *fw);
+
+extern void file_writer_get_stats(struct file_writer *fw,
+		struct file_writer_stats *stats);
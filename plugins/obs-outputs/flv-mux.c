@@ -160,19 +160,37 @@ void flv_meta_data(obs_output_t context, uint8_t **output, size_t *size,
 static int32_t last_time = 0;
 #endif
 
-static void flv_video(struct serializer *s, struct encoder_packet *packet,
+size_t flv_body_header(struct encoder_packet *packet, uint8_t *header,
 		bool is_header)
 {
-	int64_t offset  = packet->pts - packet->dts;
-	int32_t time_ms = get_ms_time(packet, packet->dts);
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		uint32_t offset = get_ms_time(packet, packet->pts - packet->dts);
+
+		header[0] = packet->keyframe ? 0x17 : 0x27;
+		header[1] = is_header ? 0 : 1;
+		header[2] = (uint8_t)(offset >> 16);
+		header[3] = (uint8_t)(offset >> 8);
+		header[4] = (uint8_t)offset;
+		return 5;
+	}
 
-	if (!packet->data || !packet->size)
-		return;
+	header[0] = 0xaf;
+	header[1] = is_header ? 0 : 1;
+	return 2;
+}
 
-	s_w8(s, RTMP_PACKET_TYPE_VIDEO);
+size_t flv_tag_header(struct encoder_packet *packet, uint8_t *header,
+		bool is_header)
+{
+	int32_t  time_ms   = get_ms_time(packet, packet->dts);
+	size_t   body_size = flv_body_header(packet,
+			header + FLV_TAG_HEADER_SIZE, is_header);
+	uint32_t data_size = (uint32_t)(packet->size + body_size);
 
 #ifdef DEBUG_TIMESTAMPS
-	blog(LOG_DEBUG, "Video: %lu", time_ms);
+	blog(LOG_DEBUG, "%s: %lu",
+			packet->type == OBS_ENCODER_VIDEO ? "Video" : "Audio",
+			time_ms);
 
 	if (last_time > time_ms)
 		blog(LOG_DEBUG, "Non-monotonic");
@@ -180,52 +198,49 @@ static void flv_video(struct serializer *s, struct encoder_packet *packet,
 	last_time = time_ms;
 #endif
 
-	s_wb24(s, (uint32_t)packet->size + 5);
-	s_wb24(s, time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
+	header[0]  = (packet->type == OBS_ENCODER_VIDEO) ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+	header[1]  = (uint8_t)(data_size >> 16);
+	header[2]  = (uint8_t)(data_size >> 8);
+	header[3]  = (uint8_t)data_size;
+	header[4]  = (uint8_t)(time_ms >> 16);
+	header[5]  = (uint8_t)(time_ms >> 8);
+	header[6]  = (uint8_t)time_ms;
+	header[7]  = (uint8_t)((time_ms >> 24) & 0x7F);
+	header[8]  = 0;
+	header[9]  = 0;
+	header[10] = 0;
+
+	return FLV_TAG_HEADER_SIZE + body_size;
+}
 
-	/* these are the 5 extra bytes mentioned above */
-	s_w8(s, packet->keyframe ? 0x17 : 0x27);
-	s_w8(s, is_header ? 0 : 1);
-	s_wb24(s, get_ms_time(packet, offset));
-	s_write(s, packet->data, packet->size);
+void flv_tag_trailer(size_t tag_size, uint8_t *trailer)
+{
+	/* tag size (starting byte doesnt count) */
+	uint32_t size = (uint32_t)tag_size + 4 - 1;
 
-	/* write tag size (starting byte doesnt count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) + 4 - 1);
+	trailer[0] = (uint8_t)(size >> 24);
+	trailer[1] = (uint8_t)(size >> 16);
+	trailer[2] = (uint8_t)(size >> 8);
+	trailer[3] = (uint8_t)size;
 }
 
-static void flv_audio(struct serializer *s, struct encoder_packet *packet,
+static void flv_tag(struct serializer *s, struct encoder_packet *packet,
 		bool is_header)
 {
-	int32_t time_ms = get_ms_time(packet, packet->dts);
+	uint8_t header[FLV_TAG_HEADER_MAX];
+	uint8_t trailer[FLV_TAG_TRAILER_SIZE];
+	size_t  header_size;
 
 	if (!packet->data || !packet->size)
 		return;
 
-	s_w8(s, RTMP_PACKET_TYPE_AUDIO);
+	header_size = flv_tag_header(packet, header, is_header);
+	flv_tag_trailer(header_size + packet->size, trailer);
 
-#ifdef DEBUG_TIMESTAMPS
-	blog(LOG_DEBUG, "Audio: %lu", time_ms);
-
-	if (last_time > time_ms)
-		blog(LOG_DEBUG, "Non-monotonic");
-
-	last_time = time_ms;
-#endif
-
-	s_wb24(s, (uint32_t)packet->size + 2);
-	s_wb24(s, time_ms);
-	s_w8(s, (time_ms >> 24) & 0x7F);
-	s_wb24(s, 0);
-
-	/* these are the two extra bytes mentioned above */
-	s_w8(s, 0xaf);
-	s_w8(s, is_header ? 0 : 1);
+	s_write(s, header, header_size);
 	s_write(s, packet->data, packet->size);
-
-	/* write tag size (starting byte doesnt count) */
-	s_wb32(s, (uint32_t)serializer_get_pos(s) + 4 - 1);
+	s_write(s, trailer, sizeof(trailer));
 }
 
 void flv_packet_mux(struct encoder_packet *packet,
@@ -236,10 +251,7 @@ void flv_packet_mux(struct encoder_packet *packet,
 
 	array_output_serializer_init(&s, &data);
 
-	if (packet->type == OBS_ENCODER_VIDEO)
-		flv_video(&s, packet, is_header);
-	else
-		flv_audio(&s, packet, is_header);
+	flv_tag(&s, packet, is_header);
 
 	*output = data.bytes.array;
 	*size   = data.bytes.num;
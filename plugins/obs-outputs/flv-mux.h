@@ -21,6 +21,15 @@
 
 #define MILLISECOND_DEN   1000
 
+/* maximum size of the codec header at the start of an FLV tag body */
+#define FLV_BODY_HEADER_MAX 5
+
+/* FLV tags are written as the tag header plus codec header, then the packet
+ * data, then the size trailer */
+#define FLV_TAG_HEADER_SIZE  11
+#define FLV_TAG_HEADER_MAX   (FLV_TAG_HEADER_SIZE + FLV_BODY_HEADER_MAX)
+#define FLV_TAG_TRAILER_SIZE 4
+
 static uint32_t get_ms_time(struct encoder_packet *packet, int64_t val)
 {
 	return (uint32_t)(val * MILLISECOND_DEN / packet->timebase_den);
@@ -30,5 +39,13 @@ extern void write_file_info(FILE *file, int64_t duration_ms, int64_t size);
 
 extern void flv_meta_data(obs_output_t context, uint8_t **output, size_t *size,
 		bool write_header);
+/* writes the codec header of the FLV tag body of a packet, returns its size */
+extern size_t flv_body_header(struct encoder_packet *packet, uint8_t *header,
+		bool is_header);
+/* writes the header of the FLV tag of a packet, returns its size */
+extern size_t flv_tag_header(struct encoder_packet *packet, uint8_t *header,
+		bool is_header);
+/* writes the size trailer of an FLV tag of tag_size bytes */
+extern void flv_tag_trailer(size_t tag_size, uint8_t *trailer);
 extern void flv_packet_mux(struct encoder_packet *packet,
 		uint8_t **output, size_t *size, bool is_header);
@@ -21,15 +21,55 @@
 #include <util/platform.h>
 #include <util/dstr.h>
 #include <util/threading.h>
+#include <util/mpsc-queue.h>
 #include <inttypes.h>
 #include "flv-mux.h"
+#include "file-writer.h"
+
+#define OPT_PATH             "path"
+#define OPT_BUFFER_SIZE      "buffer_size_mb"
+#define OPT_DIRECT_IO        "direct_io"
+#define OPT_SYNC_MODE        "sync_mode"
+#define OPT_SYNC_INTERVAL    "sync_interval_ms"
+#define OPT_SEGMENT_DURATION "segment_duration_sec"
+#define OPT_SEGMENT_SIZE     "segment_size_mb"
+
+/* packets from the encoders are handed to the mux thread through a lock-free
+ * queue, the mux thread copies them in to the file writer's buffers */
+#define PACKET_QUEUE_SIZE 4096
+#define PACKET_BATCH_SIZE 64
 
 struct flv_output {
-	obs_output_t output;
-	struct dstr  path;
-	FILE         *file;
-	bool         active;
-	int64_t      last_packet_ts;
+	obs_output_t       output;
+	struct dstr        base_path;
+	struct dstr        path;
+	bool               active;
+	int64_t            last_packet_ts;
+
+	/* segmenting, only used by the mux thread once started */
+	struct file_writer_info writer_info;
+	int64_t            segment_duration_usec;
+	int64_t            segment_size;
+	uint32_t           segment_idx;
+	bool               segment_started;
+	int64_t            segment_start_usec;
+	int64_t            segment_start_ms;
+	bool               rotate_pending;
+	bool               write_failed;
+	bool               mux_thread_active;
+
+	struct mpsc_queue  packets;
+	volatile long      queue_drops;
+	volatile long      write_pending;
+	bool               wait_keyframe;   /* only used by the callback */
+	os_sem_t           packet_sem;
+	os_event_t         stop_event;
+	pthread_t          mux_thread;
+
+	pthread_mutex_t    writer_mutex;
+	struct file_writer *writer;
+	struct file_writer_stats last_stats;
+	int64_t            prev_segments_size;
 };
 
 static const char *flv_output_getname(void)
@@ -37,6 +77,14 @@ static const char *flv_output_getname(void)
 	return obs_module_text("FLVOutput");
 }
 
+static void free_packets(struct flv_output *stream)
+{
+	struct encoder_packet packet;
+
+	while (mpsc_queue_pop(&stream->packets, &packet))
+		obs_encoder_packet_release(&packet);
+}
+
 static void flv_output_stop(void *data);
 
 static void flv_output_destroy(void *data)
@@ -46,49 +94,326 @@ static void flv_output_destroy(void *data)
 	if (stream->active)
 		flv_output_stop(data);
 
+	free_packets(stream);
+	mpsc_queue_free(&stream->packets);
+	os_sem_destroy(stream->packet_sem);
+	os_event_destroy(stream->stop_event);
+	pthread_mutex_destroy(&stream->writer_mutex);
+	dstr_free(&stream->base_path);
 	dstr_free(&stream->path);
 	bfree(stream);
 }
 
+static void get_write_stats(struct flv_output *stream,
+		struct file_writer_stats *stats)
+{
+	pthread_mutex_lock(&stream->writer_mutex);
+	if (stream->writer)
+		file_writer_get_stats(stream->writer, stats);
+	else
+		*stats = stream->last_stats;
+	pthread_mutex_unlock(&stream->writer_mutex);
+}
+
+static void get_write_stats_proc(void *data, calldata_t params)
+{
+	struct file_writer_stats stats;
+	get_write_stats(data, &stats);
+
+	calldata_setint(params, "bytes_written", (long long)stats.bytes_written);
+	calldata_setint(params, "writes",        (long long)stats.writes);
+	calldata_setint(params, "last_write_time",
+			(long long)stats.last_write_time);
+	calldata_setint(params, "avg_write_time",
+			(long long)stats.avg_write_time);
+	calldata_setint(params, "max_write_time",
+			(long long)stats.max_write_time);
+	calldata_setint(params, "syncs",         (long long)stats.syncs);
+	calldata_setint(params, "max_sync_time", (long long)stats.max_sync_time);
+	calldata_setint(params, "stalls",        (long long)stats.stalls);
+	calldata_setint(params, "stall_time",    (long long)stats.stall_time);
+}
+
+static const char *get_write_stats_decl =
+	"void get_write_stats(out int bytes_written, out int writes, "
+		"out int last_write_time, out int avg_write_time, "
+		"out int max_write_time, out int syncs, out int max_sync_time, "
+		"out int stalls, out int stall_time)";
+
 static void *flv_output_create(obs_data_t settings, obs_output_t output)
 {
 	struct flv_output *stream = bzalloc(sizeof(struct flv_output));
 	stream->output = output;
+	pthread_mutex_init_value(&stream->writer_mutex);
+
+	if (pthread_mutex_init(&stream->writer_mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+	if (!mpsc_queue_init(&stream->packets, sizeof(struct encoder_packet),
+				PACKET_QUEUE_SIZE))
+		goto fail;
+
+	proc_handler_add(obs_output_prochandler(output), get_write_stats_decl,
+			get_write_stats_proc, stream);
 
 	UNUSED_PARAMETER(settings);
 	return stream;
+
+fail:
+	flv_output_destroy(stream);
+	return NULL;
 }
 
-static void flv_output_stop(void *data)
+/* every segment starts at timestamp 0.  the offset is rounded up so that the
+ * keyframe a segment starts with ends up at exactly 0 */
+static inline int64_t segment_offset(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	return (stream->segment_start_ms * packet->timebase_den + 999) / 1000;
+}
+
+static int write_packet(struct flv_output *stream,
+		struct encoder_packet *packet, bool is_header)
+{
+	struct encoder_packet rebased = *packet;
+	uint8_t               header[FLV_TAG_HEADER_MAX];
+	uint8_t               trailer[FLV_TAG_TRAILER_SIZE];
+	size_t                header_size;
+
+	if (!packet->data || !packet->size)
+		return 0;
+
+	if (!is_header && stream->segment_start_ms) {
+		int64_t offset = segment_offset(stream, packet);
+
+		rebased.dts = (packet->dts > offset) ? packet->dts - offset : 0;
+		rebased.pts = rebased.dts + (packet->pts - packet->dts);
+	}
+
+	stream->last_packet_ts = get_ms_time(&rebased, rebased.dts);
+
+	/* the tag is written in pieces straight in to the write buffer */
+	header_size = flv_tag_header(&rebased, header, is_header);
+	flv_tag_trailer(header_size + packet->size, trailer);
+
+	file_writer_write(stream->writer, header, header_size);
+	file_writer_write(stream->writer, packet->data, packet->size);
+	file_writer_write(stream->writer, trailer, sizeof(trailer));
+	return 0;
+}
+
+static void write_file_size(struct flv_output *stream, int64_t size)
+{
+	FILE *file = os_fopen(stream->path.array, "r+b");
+
+	if (!file) {
+		blog(LOG_WARNING, "Unable to reopen FLV file '%s' to write "
+		                  "the file info", stream->path.array);
+		return;
+	}
+
+	write_file_info(file, stream->last_packet_ts, size);
+	fclose(file);
+}
+
+static bool open_writer(struct flv_output *stream)
+{
+	struct file_writer *writer;
+
+	writer = file_writer_create(stream->path.array, &stream->writer_info);
+	if (!writer) {
+		blog(LOG_WARNING, "Unable to open FLV file '%s'",
+				stream->path.array);
+		return false;
+	}
+
+	pthread_mutex_lock(&stream->writer_mutex);
+	stream->writer = writer;
+	pthread_mutex_unlock(&stream->writer_mutex);
+	return true;
+}
+
+static void close_writer(struct flv_output *stream)
+{
+	struct file_writer *writer = stream->writer;
+	int64_t            size;
+
+	if (!writer)
+		return;
+
+	size = file_writer_tell(writer);
+
+	if (!file_writer_close(writer))
+		blog(LOG_WARNING, "Failed to write FLV file '%s'",
+				stream->path.array);
+
+	pthread_mutex_lock(&stream->writer_mutex);
+	file_writer_get_stats(writer, &stream->last_stats);
+	stream->prev_segments_size += size;
+	stream->writer = NULL;
+	pthread_mutex_unlock(&stream->writer_mutex);
+
+	file_writer_destroy(writer);
+	write_file_size(stream, size);
+}
+
+/* segments after the first are named <name>_001.flv, <name>_002.flv, etc */
+static void get_segment_path(struct dstr *dst, const char *path, uint32_t idx)
+{
+	const char *ext   = strrchr(path, '.');
+	const char *slash = strrchr(path, '/');
+	const char *bslash = strrchr(path, '\\');
+
+	if (!idx) {
+		dstr_copy(dst, path);
+		return;
+	}
+
+	if (bslash > slash)
+		slash = bslash;
+	if (!ext || ext < slash)
+		ext = path + strlen(path);
+
+	dstr_ncopy(dst, path, ext - path);
+	dstr_catf(dst, "_%03u%s", idx, ext);
+}
+
+static void write_headers(struct flv_output *stream);
+
+/* closes the current file and continues in a new one, starting with the
+ * given keyframe.  the encoders keep running, so no packets are lost or
+ * written twice. */
+static void rotate_segment(struct flv_output *stream,
+		struct encoder_packet *keyframe)
+{
+	close_writer(stream);
+
+	get_segment_path(&stream->path, stream->base_path.array,
+			++stream->segment_idx);
+	stream->segment_start_usec = keyframe->dts_usec;
+	stream->segment_start_ms   = get_ms_time(keyframe, keyframe->dts);
+	stream->last_packet_ts     = 0;
+	stream->rotate_pending     = false;
+
+	if (!open_writer(stream)) {
+		stream->write_failed = true;
+		return;
+	}
+
+	blog(LOG_INFO, "Continuing FLV recording in '%s'", stream->path.array);
+	write_headers(stream);
+}
+
+static inline bool segment_full(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	if (stream->segment_duration_usec &&
+	    packet->dts_usec - stream->segment_start_usec >=
+	    stream->segment_duration_usec)
+		return true;
+
+	return stream->segment_size &&
+		file_writer_tell(stream->writer) >= stream->segment_size;
+}
+
+static void write_queued_packet(struct flv_output *stream,
+		struct encoder_packet *packet)
+{
+	bool segmenting = stream->segment_duration_usec || stream->segment_size;
+
+	if (stream->write_failed)
+		return;
+
+	/* once a segment is full, a keyframe is requested so that the next
+	 * segment can start as soon as possible */
+	if (segmenting && packet->type == OBS_ENCODER_VIDEO) {
+		if (!stream->segment_started) {
+			stream->segment_start_usec = packet->dts_usec;
+			stream->segment_started    = true;
+		}
+
+		if (!stream->rotate_pending && segment_full(stream, packet)) {
+			stream->rotate_pending = true;
+			obs_encoder_request_keyframe(
+				obs_output_get_video_encoder(stream->output));
+		}
+
+		if (stream->rotate_pending && packet->keyframe)
+			rotate_segment(stream, packet);
+	}
+
+	write_packet(stream, packet, false);
+}
+
+static void write_queued_packets(struct flv_output *stream)
+{
+	struct encoder_packet packets[PACKET_BATCH_SIZE];
+	size_t                num;
+
+	do {
+		num = mpsc_queue_pop_batch(&stream->packets, packets,
+				PACKET_BATCH_SIZE);
+
+		for (size_t i = 0; i < num; i++) {
+			write_queued_packet(stream, packets+i);
+			obs_encoder_packet_release(packets+i);
+		}
+	} while (num == PACKET_BATCH_SIZE);
+}
+
+static void *mux_thread(void *data)
 {
 	struct flv_output *stream = data;
 
-	if (stream->active) {
-		if (stream->file)
-			write_file_info(stream->file, stream->last_packet_ts,
-					os_ftelli64(stream->file));
+	/* the semaphore is only posted again for packets queued after the
+	 * flag is cleared */
+	while (os_sem_wait(stream->packet_sem) == 0) {
+		os_atomic_compare_swap_long(&stream->write_pending, 1, 0);
+		write_queued_packets(stream);
 
-		fclose(stream->file);
-		obs_output_end_data_capture(stream->output);
-		stream->active = false;
+		if (stream->write_failed)
+			break;
+		if (os_event_try(stream->stop_event) != EAGAIN)
+			break;
 	}
+
+	write_queued_packets(stream);
+
+	/* the next segment could not be opened, so stop rather than silently
+	 * discard everything from here on */
+	if (stream->write_failed && os_event_try(stream->stop_event) == EAGAIN) {
+		pthread_detach(stream->mux_thread);
+		stream->mux_thread_active = false;
+		obs_output_signal_stop(stream->output, OBS_OUTPUT_ERROR);
+	}
+
+	return NULL;
 }
 
-static int write_packet(struct flv_output *stream,
-		struct encoder_packet *packet, bool is_header)
+static void flv_output_stop(void *data)
 {
-	uint8_t *data;
-	size_t  size;
-	int     ret = 0;
+	struct flv_output *stream = data;
 
-	stream->last_packet_ts = get_ms_time(packet, packet->dts);
+	if (stream->active) {
+		obs_output_end_data_capture(stream->output);
+
+		if (stream->mux_thread_active) {
+			os_event_signal(stream->stop_event);
+			os_sem_post(stream->packet_sem);
+			pthread_join(stream->mux_thread, NULL);
+			stream->mux_thread_active = false;
+		}
+		os_event_reset(stream->stop_event);
 
-	flv_packet_mux(packet, &data, &size, is_header);
-	fwrite(data, 1, size, stream->file);
-	bfree(data);
-	obs_free_encoder_packet(packet);
+		close_writer(stream);
 
-	return ret;
+		if (stream->queue_drops)
+			blog(LOG_WARNING, "FLV output dropped %d video frames",
+					(int)stream->queue_drops);
+
+		stream->active = false;
+	}
 }
 
 static void write_meta_data(struct flv_output *stream)
@@ -97,7 +422,7 @@ static void write_meta_data(struct flv_output *stream)
 	size_t  meta_data_size;
 
 	flv_meta_data(stream->output, &meta_data, &meta_data_size, true);
-	fwrite(meta_data, 1, meta_data_size, stream->file);
+	file_writer_write(stream->writer, meta_data, meta_data_size);
 	bfree(meta_data);
 }
 
@@ -113,7 +438,7 @@ static void write_audio_header(struct flv_output *stream)
 	};
 
 	obs_encoder_get_extra_data(aencoder, &header, &packet.size);
-	packet.data = bmemdup(header, packet.size);
+	packet.data = header;
 	write_packet(stream, &packet, true);
 }
 
@@ -133,6 +458,7 @@ static void write_video_header(struct flv_output *stream)
 	obs_encoder_get_extra_data(vencoder, &header, &size);
 	packet.size = obs_parse_avc_header(&packet.data, header, size);
 	write_packet(stream, &packet, true);
+	bfree(packet.data);
 }
 
 static void write_headers(struct flv_output *stream)
@@ -142,11 +468,22 @@ static void write_headers(struct flv_output *stream)
 	write_video_header(stream);
 }
 
+static inline void get_writer_info(obs_data_t settings,
+		struct file_writer_info *info)
+{
+	info->buffer_size      = (size_t)obs_data_getint(settings,
+			OPT_BUFFER_SIZE) * 1024 * 1024;
+	info->direct_io        = obs_data_getbool(settings, OPT_DIRECT_IO);
+	info->sync_mode        = (enum file_sync_mode)obs_data_getint(settings,
+			OPT_SYNC_MODE);
+	info->sync_interval_ms = (uint32_t)obs_data_getint(settings,
+			OPT_SYNC_INTERVAL);
+}
+
 static bool flv_output_start(void *data)
 {
 	struct flv_output *stream = data;
-	obs_data_t settings;
-	const char *path;
+	obs_data_t        settings;
 
 	if (!obs_output_can_begin_data_capture(stream->output, 0))
 		return false;
@@ -155,16 +492,43 @@ static bool flv_output_start(void *data)
 
 	/* get path */
 	settings = obs_output_get_settings(stream->output);
-	path = obs_data_getstring(settings, "path");
-	dstr_copy(&stream->path, path);
+	dstr_copy(&stream->base_path, obs_data_getstring(settings, OPT_PATH));
+	dstr_copy(&stream->path, stream->base_path.array);
+	get_writer_info(settings, &stream->writer_info);
+	stream->segment_duration_usec = obs_data_getint(settings,
+			OPT_SEGMENT_DURATION) * 1000000LL;
+	stream->segment_size = obs_data_getint(settings,
+			OPT_SEGMENT_SIZE) * 1024 * 1024;
 	obs_data_release(settings);
 
-	stream->file = os_fopen(stream->path.array, "wb");
-	if (!stream->file) {
-		blog(LOG_WARNING, "Unable to open FLV file '%s'",
-				stream->path.array);
+	stream->segment_idx        = 0;
+	stream->segment_started    = false;
+	stream->segment_start_usec = 0;
+	stream->segment_start_ms   = 0;
+	stream->rotate_pending     = false;
+	stream->write_failed       = false;
+
+	pthread_mutex_lock(&stream->writer_mutex);
+	stream->prev_segments_size = 0;
+	pthread_mutex_unlock(&stream->writer_mutex);
+
+	if (!open_writer(stream))
 		return false;
-	}
+
+	os_sem_destroy(stream->packet_sem);
+	if (os_sem_init(&stream->packet_sem, 0) != 0)
+		goto fail;
+
+	free_packets(stream);
+	stream->queue_drops    = 0;
+	stream->write_pending  = 0;
+	stream->wait_keyframe  = false;
+	stream->last_packet_ts = 0;
+
+	if (pthread_create(&stream->mux_thread, NULL, mux_thread,
+				stream) != 0)
+		goto fail;
+	stream->mux_thread_active = true;
 
 	/* write headers and start capture */
 	stream->active = true;
@@ -172,32 +536,152 @@ static bool flv_output_start(void *data)
 	obs_output_begin_data_capture(stream->output, 0);
 
 	return true;
+
+fail:
+	blog(LOG_WARNING, "Failed to start FLV output");
+	pthread_mutex_lock(&stream->writer_mutex);
+	file_writer_destroy(stream->writer);
+	stream->writer = NULL;
+	pthread_mutex_unlock(&stream->writer_mutex);
+	return false;
 }
 
+/* encoder callbacks only queue the packets, everything else happens on the
+ * mux and I/O threads */
 static void flv_output_data(void *data, struct encoder_packet *packet)
 {
 	struct flv_output     *stream = data;
-	struct encoder_packet parsed_packet;
+	struct encoder_packet new_packet;
 
+	/* video was dropped on a full queue, so everything up to the next
+	 * keyframe would reference a missing frame */
 	if (packet->type == OBS_ENCODER_VIDEO) {
-		obs_parse_avc_packet(&parsed_packet, packet);
-		write_packet(stream, &parsed_packet, false);
-		obs_free_encoder_packet(&parsed_packet);
+		if (stream->wait_keyframe && !packet->keyframe) {
+			os_atomic_inc_long(&stream->queue_drops);
+			return;
+		}
+
+		stream->wait_keyframe = false;
+	}
+
+	/* video packets are already in AVCC form */
+	obs_encoder_packet_ref(&new_packet, packet);
+
+	if (mpsc_queue_push(&stream->packets, &new_packet)) {
+		if (os_atomic_compare_swap_long(&stream->write_pending, 0, 1))
+			os_sem_post(stream->packet_sem);
 	} else {
-		write_packet(stream, packet, false);
+		if (packet->type == OBS_ENCODER_VIDEO) {
+			os_atomic_inc_long(&stream->queue_drops);
+			stream->wait_keyframe = true;
+		}
+		obs_encoder_packet_release(&new_packet);
 	}
 }
 
+static void flv_output_defaults(obs_data_t defaults)
+{
+	obs_data_set_default_int(defaults, OPT_BUFFER_SIZE, 8);
+	obs_data_set_default_bool(defaults, OPT_DIRECT_IO, false);
+	obs_data_set_default_int(defaults, OPT_SYNC_MODE, FILE_SYNC_CLOSE);
+	obs_data_set_default_int(defaults, OPT_SYNC_INTERVAL, 5000);
+	obs_data_set_default_int(defaults, OPT_SEGMENT_DURATION, 0);
+	obs_data_set_default_int(defaults, OPT_SEGMENT_SIZE, 0);
+}
+
 static obs_properties_t flv_output_properties(void)
 {
 	obs_properties_t props = obs_properties_create();
+	obs_property_t   list;
 
-	obs_properties_add_text(props, "path",
+	obs_properties_add_text(props, OPT_PATH,
 			obs_module_text("FLVOutput.FilePath"),
 			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_BUFFER_SIZE,
+			obs_module_text("FLVOutput.BufferSize"), 1, 64, 1);
+	obs_properties_add_bool(props, OPT_DIRECT_IO,
+			obs_module_text("FLVOutput.DirectIO"));
+
+	list = obs_properties_add_list(props, OPT_SYNC_MODE,
+			obs_module_text("FLVOutput.SyncMode"),
+			OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(list,
+			obs_module_text("FLVOutput.SyncMode.None"),
+			FILE_SYNC_NONE);
+	obs_property_list_add_int(list,
+			obs_module_text("FLVOutput.SyncMode.Close"),
+			FILE_SYNC_CLOSE);
+	obs_property_list_add_int(list,
+			obs_module_text("FLVOutput.SyncMode.Interval"),
+			FILE_SYNC_INTERVAL);
+	obs_property_list_add_int(list,
+			obs_module_text("FLVOutput.SyncMode.Write"),
+			FILE_SYNC_WRITE);
+
+	obs_properties_add_int(props, OPT_SYNC_INTERVAL,
+			obs_module_text("FLVOutput.SyncInterval"),
+			100, 60000, 100);
+
+	/* 0 disables either threshold */
+	obs_properties_add_int(props, OPT_SEGMENT_DURATION,
+			obs_module_text("FLVOutput.SegmentDuration"),
+			0, 86400, 1);
+	obs_properties_add_int(props, OPT_SEGMENT_SIZE,
+			obs_module_text("FLVOutput.SegmentSize"),
+			0, 1024 * 1024, 1);
 	return props;
 }
 
+static int64_t get_segment_size(struct flv_output *stream)
+{
+	int64_t size;
+
+	pthread_mutex_lock(&stream->writer_mutex);
+	size = stream->writer ? file_writer_tell(stream->writer) : 0;
+	pthread_mutex_unlock(&stream->writer_mutex);
+
+	return size;
+}
+
+/* includes the sizes of all previous segments */
+static uint64_t flv_output_total_bytes(void *data)
+{
+	struct flv_output *stream = data;
+	int64_t           bytes;
+
+	pthread_mutex_lock(&stream->writer_mutex);
+	bytes = stream->prev_segments_size;
+	if (stream->writer)
+		bytes += file_writer_tell(stream->writer);
+	pthread_mutex_unlock(&stream->writer_mutex);
+
+	return (uint64_t)bytes;
+}
+
+static int flv_output_dropped_frames(void *data)
+{
+	struct flv_output *stream = data;
+	return (int)stream->queue_drops;
+}
+
+/* write latency is reported as the send time */
+static void flv_output_get_stats(void *data, struct obs_output_stats *stats)
+{
+	struct flv_output        *stream = data;
+	struct file_writer_stats write_stats;
+	uint64_t                 total;
+
+	/* write statistics only cover the current segment */
+	get_write_stats(stream, &write_stats);
+	total = (uint64_t)get_segment_size(stream);
+
+	stats->avg_send_time    = write_stats.avg_write_time;
+	stats->max_send_time    = write_stats.max_write_time;
+	stats->send_queue_bytes = (total > write_stats.bytes_written) ?
+		total - write_stats.bytes_written : 0;
+	stats->congested        = write_stats.stalls != 0;
+}
+
 struct obs_output_info flv_output_info = {
 	.id             = "flv_output",
 	.flags          = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
@@ -207,5 +691,9 @@ struct obs_output_info flv_output_info = {
 	.start          = flv_output_start,
 	.stop           = flv_output_stop,
 	.encoded_packet = flv_output_data,
-	.properties     = flv_output_properties
+	.defaults       = flv_output_defaults,
+	.properties     = flv_output_properties,
+	.total_bytes    = flv_output_total_bytes,
+	.dropped_frames = flv_output_dropped_frames,
+	.get_stats      = flv_output_get_stats
 };
@@ -4262,18 +4262,14 @@ RTMP_SendChunk(RTMP *r, RTMPChunk *chunk)
     return wrote;
 }
 
-int
-RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+/* picks the header type of a packet based on the last packet sent on its
+ * channel, and returns the timestamp the header is relative to */
+static int
+PreparePacketHeader(RTMP *r, RTMPPacket *packet, uint32_t *last)
 {
     const RTMPPacket *prevPacket;
-    uint32_t last = 0;
-    int nSize;
-    int hSize, cSize;
-    char *header, *hptr, *hend, hbuf[RTMP_MAX_HEADER_SIZE], c;
-    uint32_t t;
-    char *buffer, *tbuf = NULL, *toff = NULL;
-    int nChunkSize;
-    int tlen;
+
+    *last = 0;
 
     if (packet->m_nChannel >= r->m_channelsAllocatedOut)
     {
@@ -4303,7 +4299,7 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         if (prevPacket->m_nTimeStamp == packet->m_nTimeStamp
                 && packet->m_headerType == RTMP_PACKET_SIZE_SMALL)
             packet->m_headerType = RTMP_PACKET_SIZE_MINIMUM;
-        last = prevPacket->m_nTimeStamp;
+        *last = prevPacket->m_nTimeStamp;
     }
 
     if (packet->m_headerType > 3)	/* sanity */
@@ -4313,21 +4309,20 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
         return FALSE;
     }
 
-    nSize = packetSize[packet->m_headerType];
-    hSize = nSize;
-    cSize = 0;
-    t = packet->m_nTimeStamp - last;
+    return TRUE;
+}
 
-    if (packet->m_body)
-    {
-        header = packet->m_body - nSize;
-        hend = packet->m_body;
-    }
-    else
-    {
-        header = hbuf + 6;
-        hend = hbuf + sizeof(hbuf);
-    }
+/* encodes the chunk header of the first chunk of a packet so that it ends
+ * at hend, and returns its size.  *cOut receives the basic header byte and
+ * *cSizeOut the number of extra channel id bytes. */
+static int
+EncodePacketHeader(RTMPPacket *packet, uint32_t last, char *hend,
+                   char **headerOut, char *cOut, int *cSizeOut)
+{
+    int nSize = packetSize[packet->m_headerType];
+    int hSize = nSize, cSize = 0;
+    char *header = hend - nSize, *hptr, c;
+    uint32_t t = packet->m_nTimeStamp - last;
 
     if (packet->m_nChannel > 319)
         cSize = 2;
@@ -4384,6 +4379,30 @@ RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
     if (nSize > 1 && t >= 0xffffff)
         hptr = AMF_EncodeInt32(hptr, hend, t);
 
+    *headerOut = header;
+    *cOut = c;
+    *cSizeOut = cSize;
+    return hSize;
+}
+
+int
+RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue)
+{
+    uint32_t last;
+    int nSize;
+    int hSize, cSize;
+    char *header, hbuf[RTMP_MAX_HEADER_SIZE], c;
+    char *buffer, *tbuf = NULL, *toff = NULL;
+    int nChunkSize;
+    int tlen;
+
+    if (!PreparePacketHeader(r, packet, &last))
+        return FALSE;
+
+    hSize = EncodePacketHeader(packet, last,
+                               packet->m_body ? packet->m_body : hbuf + sizeof(hbuf),
+                               &header, &c, &cSize);
+
     nSize = packet->m_nBodySize;
     buffer = packet->m_body;
     nChunkSize = r->m_outChunkSize;
@@ -5468,6 +5487,223 @@ fail:
     return total;
 }
 
+#ifdef _WIN32
+typedef WSABUF NativeIOVec;
+#define IOV_BASE(v)	((v)->buf)
+#define IOV_LEN(v)	((int)(v)->len)
+#else
+typedef struct iovec NativeIOVec;
+#define IOV_BASE(v)	((char *)(v)->iov_base)
+#define IOV_LEN(v)	((int)(v)->iov_len)
+#endif
+
+static inline void
+SetIOVec(NativeIOVec *v, const char *ptr, int len)
+{
+#ifdef _WIN32
+    v->buf = (CHAR *)ptr;
+    v->len = (ULONG)len;
+#else
+    v->iov_base = (void *)ptr;
+    v->iov_len = (size_t)len;
+#endif
+}
+
+/* vectors gathered per system call */
+#define RTMP_IOV_MAX 128
+
+static int
+SendV(RTMPSockBuf *sb, NativeIOVec *vec, int count)
+{
+#ifdef _WIN32
+    DWORD sent = 0;
+    if (WSASend(sb->sb_socket, vec, count, &sent, 0, NULL, NULL) != 0)
+        return -1;
+    return (int)sent;
+#else
+    return (int)writev(sb->sb_socket, vec, count);
+#endif
+}
+
+/* writes a list of buffers with as few system calls as possible.  HTTP
+ * tunneling, custom send functions and encryption all need the data in one
+ * buffer, so for those the buffers are gathered and written with WriteN */
+static int
+WriteV(RTMP *r, NativeIOVec *vec, int count)
+{
+    int i;
+
+    if ((r->Link.protocol & RTMP_FEATURE_HTTP)
+            || (r->m_bCustomSend && r->m_customSendFunc)
+#ifdef CRYPTO
+            || r->Link.rc4keyOut
+#if !defined(NO_SSL)
+            || r->m_sb.sb_ssl
+#endif
+#endif
+       )
+    {
+        char *buf, *ptr;
+        int total = 0, ret;
+
+        for (i = 0; i < count; i++)
+            total += IOV_LEN(&vec[i]);
+
+        ptr = buf = malloc(total);
+        if (!buf)
+            return FALSE;
+
+        for (i = 0; i < count; i++)
+        {
+            memcpy(ptr, IOV_BASE(&vec[i]), IOV_LEN(&vec[i]));
+            ptr += IOV_LEN(&vec[i]);
+        }
+
+        ret = WriteN(r, buf, total);
+        free(buf);
+        return ret;
+    }
+
+    while (count > 0)
+    {
+        int nBytes = SendV(&r->m_sb, vec, count);
+
+        if (nBytes < 0)
+        {
+            int sockerr = GetSockError();
+            RTMP_Log(RTMP_LOGERROR, "%s, RTMP send error %d", __FUNCTION__,
+                     sockerr);
+
+            if (sockerr == EINTR && !RTMP_ctrlC)
+                continue;
+
+            RTMP_Close(r);
+            return FALSE;
+        }
+
+        if (nBytes == 0)
+            return FALSE;
+
+        /* skip past whatever was written, the last vector may have only
+         * been partially written */
+        while (count > 0 && nBytes >= IOV_LEN(vec))
+        {
+            nBytes -= IOV_LEN(vec);
+            vec++;
+            count--;
+        }
+
+        if (count > 0 && nBytes)
+            SetIOVec(vec, IOV_BASE(vec) + nBytes, IOV_LEN(vec) - nBytes);
+    }
+
+    return TRUE;
+}
+
+int
+RTMP_SendPacketV(RTMP *r, RTMPPacket *packet, const RTMPIOVec *body, int count)
+{
+    NativeIOVec vec[RTMP_IOV_MAX];
+    uint32_t last;
+    int hSize, cSize, nVec = 0;
+    int nSize = packet->m_nBodySize, nChunkSize = r->m_outChunkSize;
+    int idx = 0, off = 0;
+    char *header, hbuf[RTMP_MAX_HEADER_SIZE], cbuf[3], c;
+
+    if (r->Link.protocol & RTMP_FEATURE_HTTP)
+    {
+        /* RTMPT sends the entire packet in one request anyway */
+        RTMPPacket copy = *packet;
+        char *ptr;
+        int ret, i;
+
+        if (!RTMPPacket_Alloc(&copy, nSize))
+            return FALSE;
+
+        ptr = copy.m_body;
+        for (i = 0; i < count; i++)
+        {
+            memcpy(ptr, body[i].iov_base, body[i].iov_len);
+            ptr += body[i].iov_len;
+        }
+
+        ret = RTMP_SendPacket(r, &copy, FALSE);
+        packet->m_headerType = copy.m_headerType;
+        RTMPPacket_Free(&copy);
+        return ret;
+    }
+
+    packet->m_body = NULL;
+
+    if (!PreparePacketHeader(r, packet, &last))
+        return FALSE;
+
+    hSize = EncodePacketHeader(packet, last, hbuf + sizeof(hbuf), &header,
+                               &c, &cSize);
+
+    /* every chunk after the first uses the same one to three byte header */
+    cbuf[0] = (0xc0 | c);
+    if (cSize)
+    {
+        int tmp = packet->m_nChannel - 64;
+        cbuf[1] = tmp & 0xff;
+        if (cSize == 2)
+            cbuf[2] = tmp >> 8;
+    }
+
+    SetIOVec(&vec[nVec++], header, hSize);
+
+    while (nSize > 0)
+    {
+        int left = nSize < nChunkSize ? nSize : nChunkSize;
+        nSize -= left;
+
+        while (left > 0)
+        {
+            int len = body[idx].iov_len - off;
+            if (len > left)
+                len = left;
+
+            if (nVec == RTMP_IOV_MAX)
+            {
+                if (!WriteV(r, vec, nVec))
+                    return FALSE;
+                nVec = 0;
+            }
+
+            SetIOVec(&vec[nVec++], body[idx].iov_base + off, len);
+            left -= len;
+            off += len;
+
+            if (off == body[idx].iov_len)
+            {
+                idx++;
+                off = 0;
+            }
+        }
+
+        if (nSize > 0)
+        {
+            if (nVec == RTMP_IOV_MAX)
+            {
+                if (!WriteV(r, vec, nVec))
+                    return FALSE;
+                nVec = 0;
+            }
+
+            SetIOVec(&vec[nVec++], cbuf, cSize + 1);
+        }
+    }
+
+    if (!WriteV(r, vec, nVec))
+        return FALSE;
+
+    if (!r->m_vecChannelsOut[packet->m_nChannel])
+        r->m_vecChannelsOut[packet->m_nChannel] = malloc(sizeof(RTMPPacket));
+    memcpy(r->m_vecChannelsOut[packet->m_nChannel], packet, sizeof(RTMPPacket));
+    return TRUE;
+}
+
 static const AVal av_setDataFrame = AVC("@setDataFrame");
 
 int
@@ -123,6 +123,12 @@ extern "C"
         char c_header[RTMP_MAX_HEADER_SIZE];
     } RTMPChunk;
 
+    typedef struct RTMPIOVec
+    {
+        const char *iov_base;
+        int iov_len;
+    } RTMPIOVec;
+
     typedef struct RTMPPacket
     {
         uint8_t m_headerType;
@@ -356,6 +362,12 @@ extern "C"
 
     int RTMP_ReadPacket(RTMP *r, RTMPPacket *packet);
     int RTMP_SendPacket(RTMP *r, RTMPPacket *packet, int queue);
+
+    /* sends a packet whose body is split across several buffers without
+     * copying them.  m_nBodySize must be the total size of the buffers, and
+     * m_body is ignored. */
+    int RTMP_SendPacketV(RTMP *r, RTMPPacket *packet,
+                         const RTMPIOVec *body, int count);
     int RTMP_SendChunk(RTMP *r, RTMPChunk *chunk);
     int RTMP_IsConnected(RTMP *r);
     SOCKET RTMP_Socket(RTMP *r);
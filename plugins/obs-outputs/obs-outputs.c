@@ -10,6 +10,10 @@ OBS_MODULE_USE_DEFAULT_LOCALE("obs-outputs", "en-US")
 
 extern struct obs_output_info rtmp_output_info;
 extern struct obs_output_info flv_output_info;
+extern struct obs_output_info replay_buffer_info;
+#ifdef __linux__
+extern struct obs_output_info rtmp_multi_output_info;
+#endif
 
 bool obs_module_load(uint32_t libobs_ver)
 {
@@ -20,6 +24,10 @@ bool obs_module_load(uint32_t libobs_ver)
 
 	obs_register_output(&rtmp_output_info);
 	obs_register_output(&flv_output_info);
+	obs_register_output(&replay_buffer_info);
+#ifdef __linux__
+	obs_register_output(&rtmp_multi_output_info);
+#endif
 
 	UNUSED_PARAMETER(libobs_ver);
 	return true;
@@ -0,0 +1,578 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+#include <stdio.h>
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/platform.h>
+#include <util/dstr.h>
+#include <util/darray.h>
+#include <util/circlebuf.h>
+#include <util/threading.h>
+#include "flv-mux.h"
+#include "file-writer.h"
+
+/*
+ * Replay buffer
+ *
+ *   Keeps the most recent encoded packets in memory, and writes them to an
+ * FLV file on request.  The buffer is limited both by duration and by
+ * memory, so it can be left running indefinitely.  Saved files always start
+ * at the first keyframe inside the buffered window.
+ *
+ *   Packets are only referenced, not copied, and saving takes its own
+ * references, so the buffer keeps running while a save is in progress.
+ * Packets that have left the buffer but are still held by a save keep
+ * counting towards the memory limit until the save finishes.
+ */
+
+#define OPT_PATH     "path"
+#define OPT_MAX_TIME "max_time_sec"
+#define OPT_MAX_SIZE "max_size_mb"
+
+#define SAVE_BUFFER_SIZE (1024 * 1024)
+
+struct replay_save {
+	struct replay_buffer *rb;
+	struct dstr          path;
+
+	uint8_t              *headers;
+	size_t               headers_size;
+
+	DARRAY(struct encoder_packet) packets;
+};
+
+struct replay_buffer {
+	obs_output_t         output;
+	bool                 active;
+
+	pthread_mutex_t      mutex;
+
+	/* packets are pushed and popped one at a time, so the capacity of
+	 * the buffer always stays a multiple of the packet size and packets
+	 * never wrap around the end of the buffer */
+	struct circlebuf     packets;    /* struct encoder_packet */
+	struct circlebuf     keyframes;  /* int64_t packet sequence numbers */
+	int64_t              first_seq;
+	size_t               mem_size;
+
+	int64_t              max_time_usec;
+	size_t               max_size;
+
+	bool                 saving;
+	int64_t              save_start_seq;
+	int64_t              save_end_seq;
+	size_t               save_mem_size;
+	bool                 save_thread_active;
+	pthread_t            save_thread;
+};
+
+static const char *replay_buffer_getname(void)
+{
+	return obs_module_text("ReplayBuffer");
+}
+
+static inline size_t packet_mem_size(struct encoder_packet *packet)
+{
+	return packet->size + sizeof(struct encoder_packet);
+}
+
+static inline struct encoder_packet *get_packet(struct replay_buffer *rb,
+		int64_t seq)
+{
+	size_t pos = rb->packets.start_pos +
+		(size_t)(seq - rb->first_seq) * sizeof(struct encoder_packet);
+
+	if (pos >= rb->packets.capacity)
+		pos -= rb->packets.capacity;
+
+	return (struct encoder_packet*)((uint8_t*)rb->packets.data + pos);
+}
+
+static inline size_t num_packets(struct replay_buffer *rb)
+{
+	return rb->packets.size / sizeof(struct encoder_packet);
+}
+
+static void pop_packet(struct replay_buffer *rb)
+{
+	struct encoder_packet packet;
+	int64_t               seq;
+
+	circlebuf_pop_front(&rb->packets, &packet, sizeof(packet));
+	rb->mem_size -= packet_mem_size(&packet);
+
+	/* still referenced by the save in progress */
+	if (rb->saving && rb->first_seq >= rb->save_start_seq &&
+	                  rb->first_seq <  rb->save_end_seq)
+		rb->save_mem_size += packet_mem_size(&packet);
+
+	obs_encoder_packet_release(&packet);
+	rb->first_seq++;
+
+	while (rb->keyframes.size) {
+		circlebuf_peek_front(&rb->keyframes, &seq, sizeof(seq));
+		if (seq >= rb->first_seq)
+			break;
+
+		circlebuf_pop_front(&rb->keyframes, NULL, sizeof(seq));
+	}
+}
+
+static void free_packets(struct replay_buffer *rb)
+{
+	pthread_mutex_lock(&rb->mutex);
+	while (rb->packets.size)
+		pop_packet(rb);
+	rb->first_seq = 0;
+	pthread_mutex_unlock(&rb->mutex);
+}
+
+/* drops the oldest packets until the buffer is within both limits */
+static void trim_packets(struct replay_buffer *rb, int64_t newest_usec)
+{
+	while (rb->packets.size) {
+		struct encoder_packet *oldest = get_packet(rb, rb->first_seq);
+
+		if (rb->mem_size + rb->save_mem_size <= rb->max_size &&
+		    newest_usec - oldest->dts_usec <= rb->max_time_usec)
+			break;
+
+		pop_packet(rb);
+	}
+}
+
+static void replay_buffer_data(void *data, struct encoder_packet *packet)
+{
+	struct replay_buffer  *rb = data;
+	struct encoder_packet new_packet;
+	int64_t               seq;
+
+	obs_encoder_packet_ref(&new_packet, packet);
+
+	pthread_mutex_lock(&rb->mutex);
+
+	seq = rb->first_seq + (int64_t)num_packets(rb);
+	circlebuf_push_back(&rb->packets, &new_packet, sizeof(new_packet));
+	rb->mem_size += packet_mem_size(&new_packet);
+
+	if (packet->type == OBS_ENCODER_VIDEO && packet->keyframe)
+		circlebuf_push_back(&rb->keyframes, &seq, sizeof(seq));
+
+	trim_packets(rb, packet->dts_usec);
+
+	pthread_mutex_unlock(&rb->mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* saving */
+
+static void free_save(struct replay_save *save)
+{
+	for (size_t i = 0; i < save->packets.num; i++)
+		obs_encoder_packet_release(save->packets.array+i);
+
+	da_free(save->packets);
+	dstr_free(&save->path);
+	bfree(save->headers);
+	bfree(save);
+}
+
+static void append_header(struct replay_save *save,
+		struct encoder_packet *packet)
+{
+	uint8_t *tag;
+	size_t  size;
+
+	flv_packet_mux(packet, &tag, &size, true);
+
+	save->headers = brealloc(save->headers, save->headers_size + size);
+	memcpy(save->headers + save->headers_size, tag, size);
+	save->headers_size += size;
+	bfree(tag);
+}
+
+/* the headers are taken from the encoders when the save is requested, the
+ * save thread never touches the encoders */
+static void get_headers(struct replay_save *save, obs_output_t output)
+{
+	obs_encoder_t aencoder = obs_output_get_audio_encoder(output);
+	obs_encoder_t vencoder = obs_output_get_video_encoder(output);
+	uint8_t       *header;
+	size_t        size;
+
+	struct encoder_packet audio = {
+		.type         = OBS_ENCODER_AUDIO,
+		.timebase_den = 1
+	};
+
+	struct encoder_packet video = {
+		.type         = OBS_ENCODER_VIDEO,
+		.timebase_den = 1,
+		.keyframe     = true
+	};
+
+	flv_meta_data(output, &save->headers, &save->headers_size, true);
+
+	obs_encoder_get_extra_data(aencoder, &header, &audio.size);
+	audio.data = header;
+	append_header(save, &audio);
+
+	obs_encoder_get_extra_data(vencoder, &header, &size);
+	video.size = obs_parse_avc_header(&video.data, header, size);
+	append_header(save, &video);
+	bfree(video.data);
+}
+
+/* packets are rebased so that the starting keyframe is at timestamp 0 */
+static int64_t write_packet(struct file_writer *writer,
+		struct encoder_packet *packet, int64_t start_ms)
+{
+	struct encoder_packet rebased = *packet;
+	int64_t               offset;
+	uint8_t               header[FLV_TAG_HEADER_MAX];
+	uint8_t               trailer[FLV_TAG_TRAILER_SIZE];
+	size_t                header_size;
+
+	offset = (start_ms * packet->timebase_den + 999) / 1000;
+	rebased.dts = (packet->dts > offset) ? packet->dts - offset : 0;
+	rebased.pts = rebased.dts + (packet->pts - packet->dts);
+
+	header_size = flv_tag_header(&rebased, header, false);
+	flv_tag_trailer(header_size + packet->size, trailer);
+
+	file_writer_write(writer, header, header_size);
+	file_writer_write(writer, packet->data, packet->size);
+	file_writer_write(writer, trailer, sizeof(trailer));
+
+	return get_ms_time(&rebased, rebased.dts);
+}
+
+static bool write_save(struct replay_save *save)
+{
+	struct file_writer_info info = {
+		.buffer_size = SAVE_BUFFER_SIZE,
+		.sync_mode   = FILE_SYNC_CLOSE
+	};
+
+	struct file_writer    *writer;
+	struct encoder_packet *keyframe = save->packets.array;
+	int64_t               start_ms  = get_ms_time(keyframe, keyframe->dts);
+	int64_t               last_ts   = 0;
+	int64_t               size;
+	bool                  success;
+	FILE                  *file;
+
+	writer = file_writer_create(save->path.array, &info);
+	if (!writer) {
+		blog(LOG_WARNING, "Unable to open replay file '%s'",
+				save->path.array);
+		return false;
+	}
+
+	file_writer_write(writer, save->headers, save->headers_size);
+
+	for (size_t i = 0; i < save->packets.num; i++) {
+		struct encoder_packet *packet = save->packets.array+i;
+
+		/* skip audio from before the starting keyframe */
+		if (packet->dts_usec < keyframe->dts_usec)
+			continue;
+
+		last_ts = write_packet(writer, packet, start_ms);
+	}
+
+	size    = file_writer_tell(writer);
+	success = file_writer_close(writer);
+	file_writer_destroy(writer);
+
+	if (!success) {
+		blog(LOG_WARNING, "Failed to write replay file '%s'",
+				save->path.array);
+		return false;
+	}
+
+	file = os_fopen(save->path.array, "r+b");
+	if (file) {
+		write_file_info(file, last_ts, size);
+		fclose(file);
+	}
+
+	return true;
+}
+
+static void *save_thread(void *data)
+{
+	struct replay_save   *save = data;
+	struct replay_buffer *rb   = save->rb;
+	struct calldata      params = {0};
+	bool                 success;
+
+	success = write_save(save);
+	if (success)
+		blog(LOG_INFO, "Saved replay to '%s' (%d packets)",
+				save->path.array, (int)save->packets.num);
+
+	calldata_setptr(&params, "output", rb->output);
+	calldata_setstring(&params, "path", save->path.array);
+	calldata_setbool(&params, "success", success);
+	signal_handler_signal(obs_output_signalhandler(rb->output),
+			"replay_saved", &params);
+	calldata_free(&params);
+
+	free_save(save);
+
+	pthread_mutex_lock(&rb->mutex);
+	rb->saving        = false;
+	rb->save_mem_size = 0;
+	pthread_mutex_unlock(&rb->mutex);
+	return NULL;
+}
+
+/* takes references to every packet from the first buffered keyframe on */
+static bool get_save_packets(struct replay_buffer *rb,
+		struct replay_save *save)
+{
+	int64_t first_keyframe;
+	int64_t end_seq;
+
+	if (!rb->keyframes.size)
+		return false;
+
+	circlebuf_peek_front(&rb->keyframes, &first_keyframe,
+			sizeof(first_keyframe));
+	end_seq = rb->first_seq + (int64_t)num_packets(rb);
+
+	da_reserve(save->packets, (size_t)(end_seq - first_keyframe));
+
+	for (int64_t seq = first_keyframe; seq < end_seq; seq++) {
+		struct encoder_packet *packet = da_push_back_new(save->packets);
+		obs_encoder_packet_ref(packet, get_packet(rb, seq));
+	}
+
+	rb->save_start_seq = first_keyframe;
+	rb->save_end_seq   = end_seq;
+	rb->save_mem_size  = 0;
+	return true;
+}
+
+static void join_save_thread(struct replay_buffer *rb)
+{
+	if (rb->save_thread_active) {
+		pthread_join(rb->save_thread, NULL);
+		rb->save_thread_active = false;
+	}
+}
+
+static bool replay_buffer_save(struct replay_buffer *rb, const char *path)
+{
+	struct replay_save *save;
+	bool               busy;
+	bool               success;
+
+	if (!rb->active || !path || !*path)
+		return false;
+
+	save = bzalloc(sizeof(struct replay_save));
+	save->rb = rb;
+	dstr_copy(&save->path, path);
+
+	pthread_mutex_lock(&rb->mutex);
+	busy    = rb->saving;
+	success = !busy && get_save_packets(rb, save);
+	if (success)
+		rb->saving = true;
+	pthread_mutex_unlock(&rb->mutex);
+
+	if (!success) {
+		blog(LOG_WARNING, "Replay buffer: %s",
+				busy ? "A save is already in progress" :
+				       "No keyframe buffered yet");
+		free_save(save);
+		return false;
+	}
+
+	get_headers(save, rb->output);
+
+	/* the previous save has finished at this point */
+	join_save_thread(rb);
+
+	if (pthread_create(&rb->save_thread, NULL, save_thread, save) != 0) {
+		blog(LOG_WARNING, "Replay buffer: Failed to create save "
+		                  "thread");
+		free_save(save);
+
+		pthread_mutex_lock(&rb->mutex);
+		rb->saving        = false;
+		rb->save_mem_size = 0;
+		pthread_mutex_unlock(&rb->mutex);
+		return false;
+	}
+
+	rb->save_thread_active = true;
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static void save_proc(void *data, calldata_t params)
+{
+	struct replay_buffer *rb   = data;
+	const char           *path = calldata_string(params, "path");
+	obs_data_t           settings;
+	bool                 success;
+
+	settings = obs_output_get_settings(rb->output);
+	if (!path || !*path)
+		path = obs_data_getstring(settings, OPT_PATH);
+
+	success = replay_buffer_save(rb, path);
+	obs_data_release(settings);
+
+	calldata_setbool(params, "success", success);
+}
+
+static const char *save_decl =
+	"void save(in string path, out bool success)";
+
+static const char *replay_saved_decl =
+	"void replay_saved(ptr output, string path, bool success)";
+
+static void replay_buffer_stop(void *data);
+
+static void replay_buffer_destroy(void *data)
+{
+	struct replay_buffer *rb = data;
+
+	if (rb->active)
+		replay_buffer_stop(data);
+
+	join_save_thread(rb);
+	free_packets(rb);
+	circlebuf_free(&rb->packets);
+	circlebuf_free(&rb->keyframes);
+	pthread_mutex_destroy(&rb->mutex);
+	bfree(rb);
+}
+
+static void *replay_buffer_create(obs_data_t settings, obs_output_t output)
+{
+	struct replay_buffer *rb = bzalloc(sizeof(struct replay_buffer));
+	rb->output = output;
+
+	if (pthread_mutex_init(&rb->mutex, NULL) != 0) {
+		bfree(rb);
+		return NULL;
+	}
+
+	proc_handler_add(obs_output_prochandler(output), save_decl,
+			save_proc, rb);
+	signal_handler_add(obs_output_signalhandler(output),
+			replay_saved_decl);
+
+	UNUSED_PARAMETER(settings);
+	return rb;
+}
+
+static bool replay_buffer_start(void *data)
+{
+	struct replay_buffer *rb = data;
+	obs_data_t           settings;
+
+	if (!obs_output_can_begin_data_capture(rb->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(rb->output, 0))
+		return false;
+
+	settings = obs_output_get_settings(rb->output);
+	rb->max_time_usec = obs_data_getint(settings, OPT_MAX_TIME) * 1000000LL;
+	rb->max_size      = (size_t)obs_data_getint(settings, OPT_MAX_SIZE) *
+		1024 * 1024;
+	obs_data_release(settings);
+
+	free_packets(rb);
+
+	rb->active = true;
+	obs_output_begin_data_capture(rb->output, 0);
+	return true;
+}
+
+static void replay_buffer_stop(void *data)
+{
+	struct replay_buffer *rb = data;
+
+	if (rb->active) {
+		obs_output_end_data_capture(rb->output);
+		rb->active = false;
+
+		/* a save in progress holds its own packet references */
+		free_packets(rb);
+	}
+}
+
+static void replay_buffer_defaults(obs_data_t defaults)
+{
+	obs_data_set_default_int(defaults, OPT_MAX_TIME, 20);
+	obs_data_set_default_int(defaults, OPT_MAX_SIZE, 512);
+}
+
+static obs_properties_t replay_buffer_properties(void)
+{
+	obs_properties_t props = obs_properties_create();
+
+	obs_properties_add_text(props, OPT_PATH,
+			obs_module_text("ReplayBuffer.FilePath"),
+			OBS_TEXT_DEFAULT);
+	obs_properties_add_int(props, OPT_MAX_TIME,
+			obs_module_text("ReplayBuffer.MaxTime"), 1, 3600, 1);
+	obs_properties_add_int(props, OPT_MAX_SIZE,
+			obs_module_text("ReplayBuffer.MaxSize"), 1, 8192, 1);
+	return props;
+}
+
+static void replay_buffer_get_stats(void *data,
+		struct obs_output_stats *stats)
+{
+	struct replay_buffer *rb = data;
+
+	pthread_mutex_lock(&rb->mutex);
+	stats->buffered_packets = (uint32_t)num_packets(rb);
+
+	if (rb->packets.size) {
+		int64_t end_seq = rb->first_seq + (int64_t)num_packets(rb);
+		struct encoder_packet *oldest = get_packet(rb, rb->first_seq);
+		struct encoder_packet *newest = get_packet(rb, end_seq - 1);
+
+		stats->buffered_duration =
+			(uint64_t)(newest->dts_usec - oldest->dts_usec);
+	}
+	pthread_mutex_unlock(&rb->mutex);
+}
+
+struct obs_output_info replay_buffer_info = {
+	.id             = "replay_buffer",
+	.flags          = OBS_OUTPUT_AV | OBS_OUTPUT_ENCODED,
+	.getname        = replay_buffer_getname,
+	.create         = replay_buffer_create,
+	.destroy        = replay_buffer_destroy,
+	.start          = replay_buffer_start,
+	.stop           = replay_buffer_stop,
+	.encoded_packet = replay_buffer_data,
+	.defaults       = replay_buffer_defaults,
+	.properties     = replay_buffer_properties,
+	.get_stats      = replay_buffer_get_stats
+};
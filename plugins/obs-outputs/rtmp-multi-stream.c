@@ -0,0 +1,1287 @@
+/******************************************************************************
+    Copyright (C) 2014 by Hugh Bailey <obs.jim@gmail.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+******************************************************************************/
+
+/*
+ * Multi-destination RTMP output
+ *
+ *   Sends one set of encoded packets to several RTMP servers.  Each
+ * destination is connected (and the RTMP handshake done) with a blocking
+ * connect thread, after which its socket is made non-blocking and handed to
+ * a single network thread.  The network thread fans the packets out to each
+ * destination's own queue, and writes them with epoll, so a slow destination
+ * only ever backs up (and drops frames from) its own queue.
+ */
+
+#include <obs-module.h>
+#include <obs-avc.h>
+#include <util/platform.h>
+#include <util/circlebuf.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/threading.h>
+#include <util/mpsc-queue.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "librtmp/rtmp.h"
+#include "librtmp/log.h"
+#include "flv-mux.h"
+
+#define do_log(level, format, ...) \
+	blog(level, "[rtmp multi stream: '%s'] " format, \
+			obs_output_getname(stream->output), ##__VA_ARGS__)
+
+#define warn(format, ...)  do_log(LOG_WARNING, format, ##__VA_ARGS__)
+#define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
+#define debug(format, ...) do_log(LOG_DEBUG,   format, ##__VA_ARGS__)
+
+/* the same channel RTMP_Write uses for stream data */
+#define RTMP_SOURCE_CHANNEL 0x04
+
+#define OPT_DESTINATIONS    "destinations"
+#define OPT_DROP_THRESHOLD  "drop_threshold_ms"
+#define OPT_RECONNECT_DELAY "reconnect_delay_sec"
+#define OPT_MAX_RETRIES     "max_retries"
+
+/* settings of each item of the destinations array */
+#define OPT_DEST_URL        "url"
+#define OPT_DEST_KEY        "key"
+#define OPT_DEST_USERNAME   "username"
+#define OPT_DEST_PASSWORD   "password"
+
+/* packets from the encoders are handed to the network thread through a
+ * lock-free queue, which the network thread drains in batches */
+#define PACKET_QUEUE_SIZE   4096
+#define PACKET_BATCH_SIZE   64
+
+/* packets are only turned in to RTMP chunks once less than this much data is
+ * waiting to be written to a destination's socket, so frame dropping still
+ * has the packets to work with */
+#define OUT_BUFFER_LOW      (64 * 1024)
+
+#define MAX_EVENTS          16
+#define LOOP_TIMEOUT_MS     100
+#define RECV_BUFFER_SIZE    4096
+
+/* how long stopping waits for the destinations to send what is buffered */
+#define STOP_DRAIN_TIMEOUT_NS 2000000000ULL
+
+enum dest_state {
+	DEST_IDLE,       /* waiting to (re)connect */
+	DEST_CONNECTING, /* connect thread running */
+	DEST_CONNECTED,  /* connected, waiting to be added to the network loop */
+	DEST_ACTIVE,     /* sending from the network loop */
+	DEST_FAILED      /* out of retries */
+};
+
+struct dest_stats {
+	uint64_t         total_bytes;
+	int              dropped_frames;
+	uint32_t         buffered_packets;
+	uint64_t         buffered_duration;
+	uint64_t         send_buffer_bytes;
+	int              reconnects;
+	bool             connected;
+};
+
+struct rtmp_multi_stream;
+
+struct rtmp_destination {
+	struct rtmp_multi_stream *stream;
+
+	struct dstr      path, key;
+	struct dstr      username, password;
+
+	volatile long    state;
+	bool             thread_active;
+	pthread_t        connect_thread;
+	int              connect_error;
+	int              retries;
+	uint64_t         reconnect_time_ns;
+
+	RTMP             rtmp;
+	int              fd;
+	bool             want_write;
+	bool             closing;
+
+	/* everything below is only used by the network thread */
+	struct circlebuf packets;
+	struct circlebuf out;
+	int64_t          last_dts_usec;
+	bool             wait_keyframe;
+	bool             drop_disposable;
+
+	uint64_t         total_bytes;
+	int              dropped_frames;
+	int              reconnects;
+
+	/* copy of the statistics for other threads, uses the stats mutex */
+	struct dest_stats stats;
+};
+
+struct rtmp_multi_stream {
+	obs_output_t     output;
+
+	struct mpsc_queue queue;
+	volatile long    queue_drops;
+	bool             wait_keyframe;  /* only used by the callback */
+
+	DARRAY(struct rtmp_destination*) dests;
+	pthread_mutex_t  stats_mutex;
+
+	int              epoll_fd;
+	int              wake_fd;
+
+	bool             active;
+	bool             capturing;  /* only used by the network thread */
+	pthread_t        net_thread;
+	os_event_t       stop_event;
+
+	int64_t          drop_threshold_usec;
+	uint64_t         reconnect_delay_ns;
+	int              max_retries;
+};
+
+static const char *rtmp_multi_stream_getname(void)
+{
+	return obs_module_text("RTMPMultiStream");
+}
+
+static void log_rtmp(int level, const char *format, va_list args)
+{
+	if (level > RTMP_LOGWARNING)
+		return;
+
+	blogva(LOG_INFO, format, args);
+}
+
+static inline void wake_network_thread(struct rtmp_multi_stream *stream)
+{
+	eventfd_write(stream->wake_fd, 1);
+}
+
+static inline bool stopping(struct rtmp_multi_stream *stream)
+{
+	return os_event_try(stream->stop_event) != EAGAIN;
+}
+
+/* ------------------------------------------------------------------------- */
+/* destinations                                                              */
+
+static void free_dest_packets(struct rtmp_destination *dest)
+{
+	while (dest->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&dest->packets, &packet, sizeof(packet));
+		obs_encoder_packet_release(&packet);
+	}
+
+	circlebuf_free(&dest->out);
+}
+
+static void destroy_destination(struct rtmp_destination *dest)
+{
+	free_dest_packets(dest);
+	circlebuf_free(&dest->packets);
+	dstr_free(&dest->path);
+	dstr_free(&dest->key);
+	dstr_free(&dest->username);
+	dstr_free(&dest->password);
+	bfree(dest);
+}
+
+static void free_destinations(struct rtmp_multi_stream *stream)
+{
+	pthread_mutex_lock(&stream->stats_mutex);
+
+	for (size_t i = 0; i < stream->dests.num; i++)
+		destroy_destination(stream->dests.array[i]);
+	da_free(stream->dests);
+
+	pthread_mutex_unlock(&stream->stats_mutex);
+}
+
+static bool load_destinations(struct rtmp_multi_stream *stream,
+		obs_data_t settings)
+{
+	obs_data_array_t array = obs_data_getarray(settings, OPT_DESTINATIONS);
+	size_t           count = obs_data_array_count(array);
+
+	free_destinations(stream);
+
+	pthread_mutex_lock(&stream->stats_mutex);
+
+	for (size_t i = 0; i < count; i++) {
+		obs_data_t              item = obs_data_array_item(array, i);
+		const char              *url = obs_data_getstring(item,
+				OPT_DEST_URL);
+		const char              *key = obs_data_getstring(item,
+				OPT_DEST_KEY);
+		struct rtmp_destination *dest;
+
+		if (!url || !*url || !key || !*key) {
+			warn("Destination %d has no URL or stream key, "
+			     "skipping", (int)i);
+			obs_data_release(item);
+			continue;
+		}
+
+		dest = bzalloc(sizeof(struct rtmp_destination));
+		dest->stream = stream;
+		dest->fd     = -1;
+		dstr_copy(&dest->path,     url);
+		dstr_copy(&dest->key,      key);
+		dstr_copy(&dest->username,
+				obs_data_getstring(item, OPT_DEST_USERNAME));
+		dstr_copy(&dest->password,
+				obs_data_getstring(item, OPT_DEST_PASSWORD));
+		RTMP_Init(&dest->rtmp);
+
+		da_push_back(stream->dests, &dest);
+		obs_data_release(item);
+	}
+
+	pthread_mutex_unlock(&stream->stats_mutex);
+
+	obs_data_array_release(array);
+	return stream->dests.num != 0;
+}
+
+static inline int64_t buffered_duration_usec(struct rtmp_destination *dest)
+{
+	struct encoder_packet first;
+
+	if (!dest->packets.size)
+		return 0;
+
+	circlebuf_peek_front(&dest->packets, &first, sizeof(first));
+	return dest->last_dts_usec - first.dts_usec;
+}
+
+static inline size_t num_buffered_packets(struct rtmp_destination *dest)
+{
+	return dest->packets.size / sizeof(struct encoder_packet);
+}
+
+static void update_dest_stats(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+	struct dest_stats        *stats  = &dest->stats;
+
+	pthread_mutex_lock(&stream->stats_mutex);
+	stats->total_bytes       = dest->total_bytes;
+	stats->dropped_frames    = dest->dropped_frames;
+	stats->buffered_packets  = (uint32_t)num_buffered_packets(dest);
+	stats->buffered_duration = (uint64_t)buffered_duration_usec(dest);
+	stats->send_buffer_bytes = dest->out.size;
+	stats->reconnects        = dest->reconnects;
+	stats->connected         =
+		os_atomic_load_long(&dest->state) == DEST_ACTIVE;
+	pthread_mutex_unlock(&stream->stats_mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+/* sending                                                                   */
+
+/* once a destination is handed to the network thread, librtmp writes in to
+ * the destination's send buffer instead of to the socket.  while closing,
+ * whatever librtmp sends (unpublish, delete stream) is written directly, but
+ * without waiting for the socket. */
+static int buffer_rtmp_data(RTMPSockBuf *sb, const char *data, int size,
+		void *param)
+{
+	struct rtmp_destination *dest = param;
+
+	if (dest->closing)
+		send(sb->sb_socket, data, size, MSG_NOSIGNAL);
+	else
+		circlebuf_push_back(&dest->out, data, size);
+
+	return size;
+}
+
+/* packets are turned in to RTMP messages straight from the packet data, only
+ * the few bytes of FLV codec header are written separately */
+static int send_packet(struct rtmp_destination *dest,
+		struct encoder_packet *packet, bool is_header)
+{
+	uint8_t    header[FLV_BODY_HEADER_MAX];
+	RTMPIOVec  body[2];
+	RTMPPacket rtmp_packet = {0};
+	size_t     header_size;
+	int        ret = 0;
+
+	if (!packet->data || !packet->size)
+		goto cleanup;
+
+	header_size = flv_body_header(packet, header, is_header);
+
+	body[0].iov_base = (const char*)header;
+	body[0].iov_len  = (int)header_size;
+	body[1].iov_base = (const char*)packet->data;
+	body[1].iov_len  = (int)packet->size;
+
+	rtmp_packet.m_nChannel    = RTMP_SOURCE_CHANNEL;
+	rtmp_packet.m_nInfoField2 = dest->rtmp.m_stream_id;
+	rtmp_packet.m_nTimeStamp  = get_ms_time(packet, packet->dts);
+	rtmp_packet.m_nBodySize   = (uint32_t)(header_size + packet->size);
+	rtmp_packet.m_packetType  = (packet->type == OBS_ENCODER_VIDEO) ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+	rtmp_packet.m_headerType  = rtmp_packet.m_nTimeStamp ?
+		RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
+
+	if (!RTMP_SendPacketV(&dest->rtmp, &rtmp_packet, body, 2))
+		ret = -1;
+
+cleanup:
+	obs_encoder_packet_release(packet);
+	return ret;
+}
+
+/* writes as much of the send buffer as the socket takes.  returns -1 on
+ * error, 0 if the socket is full, or 1 once the buffer is empty */
+static int write_buffered_data(struct rtmp_destination *dest)
+{
+	struct circlebuf *out = &dest->out;
+
+	while (out->size) {
+		size_t  size = out->capacity - out->start_pos;
+		ssize_t ret;
+
+		if (size > out->size)
+			size = out->size;
+
+		ret = send(dest->fd, (uint8_t*)out->data + out->start_pos,
+				size, MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ?
+				0 : -1;
+		}
+
+		circlebuf_pop_front(out, NULL, (size_t)ret);
+		dest->total_bytes += (uint64_t)ret;
+	}
+
+	return 1;
+}
+
+static bool set_want_write(struct rtmp_destination *dest, bool want_write)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+	struct epoll_event       event   = {0};
+
+	if (dest->want_write == want_write)
+		return true;
+
+	event.events   = EPOLLIN | (want_write ? EPOLLOUT : 0);
+	event.data.ptr = dest;
+
+	if (epoll_ctl(stream->epoll_fd, EPOLL_CTL_MOD, dest->fd, &event) != 0)
+		return false;
+
+	dest->want_write = want_write;
+	return true;
+}
+
+static bool send_data(struct rtmp_destination *dest)
+{
+	int ret;
+
+	for (;;) {
+		while (dest->out.size < OUT_BUFFER_LOW && dest->packets.size) {
+			struct encoder_packet packet;
+			circlebuf_pop_front(&dest->packets, &packet,
+					sizeof(packet));
+
+			if (send_packet(dest, &packet, false) < 0)
+				return false;
+		}
+
+		if (!dest->out.size)
+			break;
+
+		ret = write_buffered_data(dest);
+		if (ret < 0)
+			return false;
+		if (ret == 0)
+			break;
+	}
+
+	return set_want_write(dest, dest->out.size != 0);
+}
+
+/* the server's replies are not needed once publishing, they are only read so
+ * that the connection doesn't back up */
+static bool receive_data(struct rtmp_destination *dest)
+{
+	char buf[RECV_BUFFER_SIZE];
+
+	for (;;) {
+		ssize_t ret = recv(dest->fd, buf, sizeof(buf), 0);
+
+		if (ret > 0)
+			continue;
+		if (ret == 0)
+			return false;
+		if (errno == EINTR)
+			continue;
+
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* frame dropping                                                            */
+
+/* frames that can be dropped without having to wait for a keyframe */
+static inline bool is_disposable(struct encoder_packet *packet)
+{
+	return packet->drop_priority < OBS_NAL_PRIORITY_HIGH;
+}
+
+/* drops all buffered video of a destination.  the destination then waits for
+ * the next keyframe, audio is left alone. */
+static void drop_video(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream  = dest->stream;
+	struct circlebuf         new_buf  = {0};
+	int                      prev_dropped = dest->dropped_frames;
+
+	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
+
+	while (dest->packets.size) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&dest->packets, &packet, sizeof(packet));
+
+		if (packet.type == OBS_ENCODER_VIDEO) {
+			dest->dropped_frames++;
+			obs_encoder_packet_release(&packet);
+		} else {
+			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+		}
+	}
+
+	circlebuf_free(&dest->packets);
+	dest->packets       = new_buf;
+	dest->wait_keyframe = true;
+
+	debug("Dropped %d frames for %s", dest->dropped_frames - prev_dropped,
+			dest->path.array);
+}
+
+/* disposable frames are dropped once more than three quarters of the drop
+ * threshold is buffered, and everything buffered is dropped once the drop
+ * threshold is passed */
+static void check_to_drop_frames(struct rtmp_destination *dest)
+{
+	int64_t threshold = dest->stream->drop_threshold_usec;
+	int64_t buffered  = buffered_duration_usec(dest);
+
+	if (buffered > threshold) {
+		drop_video(dest);
+		buffered = buffered_duration_usec(dest);
+	}
+
+	if (dest->drop_disposable)
+		dest->drop_disposable = buffered > threshold * 3 / 8;
+	else
+		dest->drop_disposable = buffered > threshold * 3 / 4;
+}
+
+static void add_dest_packet(struct rtmp_destination *dest,
+		struct encoder_packet *packet)
+{
+	struct encoder_packet new_packet;
+
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		check_to_drop_frames(dest);
+
+		if (dest->wait_keyframe && !packet->keyframe) {
+			dest->dropped_frames++;
+			return;
+		}
+		if (dest->drop_disposable && is_disposable(packet)) {
+			dest->dropped_frames++;
+			return;
+		}
+
+		dest->wait_keyframe = false;
+	}
+
+	obs_encoder_packet_ref(&new_packet, packet);
+	circlebuf_push_back(&dest->packets, &new_packet, sizeof(new_packet));
+	dest->last_dts_usec = packet->dts_usec;
+}
+
+/* hands everything the encoders have queued to every active destination */
+static void receive_queued_packets(struct rtmp_multi_stream *stream)
+{
+	struct encoder_packet packets[PACKET_BATCH_SIZE];
+	size_t                num;
+
+	do {
+		num = mpsc_queue_pop_batch(&stream->queue, packets,
+				PACKET_BATCH_SIZE);
+
+		for (size_t i = 0; i < num; i++) {
+			for (size_t j = 0; j < stream->dests.num; j++) {
+				struct rtmp_destination *dest =
+					stream->dests.array[j];
+
+				if (os_atomic_load_long(&dest->state) ==
+						DEST_ACTIVE)
+					add_dest_packet(dest, packets+i);
+			}
+
+			obs_encoder_packet_release(packets+i);
+		}
+	} while (num == PACKET_BATCH_SIZE);
+}
+
+/* ------------------------------------------------------------------------- */
+/* connecting                                                                */
+
+static inline void set_rtmp_str(AVal *val, const char *str)
+{
+	bool valid  = (str && *str);
+	val->av_val = valid ? (char*)str       : NULL;
+	val->av_len = valid ? (int)strlen(str) : 0;
+}
+
+static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
+{
+	bool valid  = !dstr_isempty(str);
+	val->av_val = valid ? str->array    : NULL;
+	val->av_len = valid ? (int)str->len : 0;
+}
+
+static void send_meta_data(struct rtmp_destination *dest)
+{
+	uint8_t *meta_data;
+	size_t  meta_data_size;
+
+	flv_meta_data(dest->stream->output, &meta_data, &meta_data_size,
+			false);
+	RTMP_Write(&dest->rtmp, (char*)meta_data, (int)meta_data_size);
+	bfree(meta_data);
+}
+
+static void send_audio_header(struct rtmp_destination *dest)
+{
+	obs_output_t  context  = dest->stream->output;
+	obs_encoder_t aencoder = obs_output_get_audio_encoder(context);
+	uint8_t       *header;
+
+	struct encoder_packet packet   = {
+		.type         = OBS_ENCODER_AUDIO,
+		.timebase_den = 1
+	};
+
+	obs_encoder_get_extra_data(aencoder, &header, &packet.size);
+	packet.data = bmemdup(header, packet.size);
+	send_packet(dest, &packet, true);
+}
+
+static void send_video_header(struct rtmp_destination *dest)
+{
+	obs_output_t  context  = dest->stream->output;
+	obs_encoder_t vencoder = obs_output_get_video_encoder(context);
+	uint8_t       *header;
+	size_t        size;
+
+	struct encoder_packet packet   = {
+		.type         = OBS_ENCODER_VIDEO,
+		.timebase_den = 1,
+		.keyframe     = true
+	};
+
+	obs_encoder_get_extra_data(vencoder, &header, &size);
+	packet.size = obs_parse_avc_header(&packet.data, header, size);
+	send_packet(dest, &packet, true);
+}
+
+static int try_connect(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+	RTMP                     *rtmp   = &dest->rtmp;
+	int                      flags;
+
+	info("Connecting to RTMP URL %s...", dest->path.array);
+
+	if (!RTMP_SetupURL2(rtmp, dest->path.array, dest->key.array))
+		return OBS_OUTPUT_BAD_PATH;
+
+	/* the data is written to the socket directly by the network thread,
+	 * which can't be done for tunneled or encrypted connections */
+	if (rtmp->Link.protocol & (RTMP_FEATURE_HTTP | RTMP_FEATURE_ENC |
+	                           RTMP_FEATURE_SSL)) {
+		warn("%s: Only plain RTMP is supported", dest->path.array);
+		return OBS_OUTPUT_BAD_PATH;
+	}
+
+	RTMP_EnableWrite(rtmp);
+
+	set_rtmp_dstr(&rtmp->Link.pubUser,   &dest->username);
+	set_rtmp_dstr(&rtmp->Link.pubPasswd, &dest->password);
+	rtmp->Link.swfUrl = rtmp->Link.tcUrl;
+	set_rtmp_str(&rtmp->Link.flashVer, "FMLE/3.0 (compatible; FMSc/1.0)");
+
+	rtmp->m_outChunkSize       = 4096;
+	rtmp->m_bSendChunkSizeInfo = true;
+	rtmp->m_bUseNagle          = true;
+
+	if (!RTMP_Connect(rtmp, NULL))
+		return OBS_OUTPUT_CONNECT_FAILED;
+	if (!RTMP_ConnectStream(rtmp, 0))
+		return OBS_OUTPUT_INVALID_STREAM;
+
+	/* the headers are still sent with the blocking socket */
+	send_meta_data(dest);
+	send_audio_header(dest);
+	send_video_header(dest);
+
+	if (!RTMP_IsConnected(rtmp))
+		return OBS_OUTPUT_DISCONNECTED;
+
+	dest->fd = rtmp->m_sb.sb_socket;
+	flags = fcntl(dest->fd, F_GETFL, 0);
+	if (flags == -1 || fcntl(dest->fd, F_SETFL, flags | O_NONBLOCK) != 0) {
+		warn("%s: Failed to make the socket non-blocking",
+				dest->path.array);
+		RTMP_Close(rtmp);
+		return OBS_OUTPUT_ERROR;
+	}
+
+	rtmp->m_bCustomSend     = true;
+	rtmp->m_customSendFunc  = buffer_rtmp_data;
+	rtmp->m_customSendParam = dest;
+
+	info("Connection to %s successful", dest->path.array);
+	return OBS_OUTPUT_SUCCESS;
+}
+
+static void *connect_thread(void *data)
+{
+	struct rtmp_destination *dest = data;
+	int ret = try_connect(dest);
+
+	dest->connect_error = ret;
+	os_atomic_set_long(&dest->state, (ret == OBS_OUTPUT_SUCCESS) ?
+			DEST_CONNECTED : DEST_IDLE);
+	wake_network_thread(dest->stream);
+	return NULL;
+}
+
+static void start_connect(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+
+	os_atomic_set_long(&dest->state, DEST_CONNECTING);
+
+	if (pthread_create(&dest->connect_thread, NULL, connect_thread,
+				dest) != 0) {
+		warn("Failed to create connect thread for %s",
+				dest->path.array);
+		dest->connect_error = OBS_OUTPUT_ERROR;
+		os_atomic_set_long(&dest->state, DEST_FAILED);
+		return;
+	}
+
+	dest->thread_active = true;
+}
+
+static void close_destination(struct rtmp_destination *dest)
+{
+	dest->closing = true;
+	RTMP_Close(&dest->rtmp);
+	dest->closing    = false;
+
+	/* the next connection attempt writes to the socket again */
+	dest->rtmp.m_bCustomSend = false;
+	dest->fd         = -1;
+	dest->want_write = false;
+
+	free_dest_packets(dest);
+}
+
+static void activate_destination(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+	struct epoll_event       event   = {0};
+
+	event.events   = EPOLLIN;
+	event.data.ptr = dest;
+
+	if (epoll_ctl(stream->epoll_fd, EPOLL_CTL_ADD, dest->fd, &event) != 0) {
+		warn("Failed to add %s to the network loop", dest->path.array);
+		close_destination(dest);
+		os_atomic_set_long(&dest->state, DEST_IDLE);
+		dest->reconnect_time_ns = os_gettime_ns() +
+			stream->reconnect_delay_ns;
+		return;
+	}
+
+	dest->retries         = 0;
+	dest->wait_keyframe   = true;
+	dest->drop_disposable = false;
+	os_atomic_set_long(&dest->state, DEST_ACTIVE);
+
+	/* packets only start coming in once the first destination is up,
+	 * destinations that connect later ask for a keyframe to start on */
+	if (!stream->capturing) {
+		stream->capturing = obs_output_begin_data_capture(
+				stream->output, 0);
+	} else {
+		obs_encoder_request_keyframe(
+				obs_output_get_video_encoder(stream->output));
+	}
+}
+
+static void disconnect_destination(struct rtmp_destination *dest)
+{
+	struct rtmp_multi_stream *stream = dest->stream;
+
+	info("Disconnected from %s", dest->path.array);
+
+	epoll_ctl(stream->epoll_fd, EPOLL_CTL_DEL, dest->fd, NULL);
+	close_destination(dest);
+
+	dest->reconnects++;
+	dest->reconnect_time_ns = os_gettime_ns() + stream->reconnect_delay_ns;
+	os_atomic_set_long(&dest->state, DEST_IDLE);
+}
+
+/* picks up finished connect threads and starts new connection attempts */
+static void update_connections(struct rtmp_multi_stream *stream, uint64_t now)
+{
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest  = stream->dests.array[i];
+		long                    state =
+			os_atomic_load_long(&dest->state);
+
+		if (state == DEST_CONNECTING || state == DEST_FAILED)
+			continue;
+
+		if (dest->thread_active) {
+			pthread_join(dest->connect_thread, NULL);
+			dest->thread_active = false;
+
+			if (state == DEST_CONNECTED) {
+				if (stopping(stream)) {
+					close_destination(dest);
+					os_atomic_set_long(&dest->state,
+							DEST_IDLE);
+				} else {
+					activate_destination(dest);
+				}
+				continue;
+			}
+
+			if (dest->connect_error == OBS_OUTPUT_BAD_PATH ||
+			    ++dest->retries > stream->max_retries) {
+				warn("Connection to %s failed: %d, giving up",
+						dest->path.array,
+						dest->connect_error);
+				os_atomic_set_long(&dest->state, DEST_FAILED);
+				continue;
+			}
+
+			info("Connection to %s failed: %d, retrying",
+					dest->path.array, dest->connect_error);
+			dest->reconnect_time_ns = now +
+				stream->reconnect_delay_ns;
+		}
+
+		if (state == DEST_IDLE && !stopping(stream) &&
+		    now >= dest->reconnect_time_ns)
+			start_connect(dest);
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+/* network thread                                                            */
+
+static void handle_events(struct rtmp_multi_stream *stream,
+		struct epoll_event *events, int num)
+{
+	for (int i = 0; i < num; i++) {
+		struct rtmp_destination *dest = events[i].data.ptr;
+		eventfd_t               val;
+
+		if (!dest) {
+			eventfd_read(stream->wake_fd, &val);
+			continue;
+		}
+
+		if (os_atomic_load_long(&dest->state) != DEST_ACTIVE)
+			continue;
+
+		if ((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+		    ((events[i].events & EPOLLIN) && !receive_data(dest)))
+			disconnect_destination(dest);
+	}
+}
+
+static bool destinations_drained(struct rtmp_multi_stream *stream)
+{
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest = stream->dests.array[i];
+
+		if (os_atomic_load_long(&dest->state) == DEST_ACTIVE &&
+		    (dest->packets.size || dest->out.size))
+			return false;
+	}
+
+	return true;
+}
+
+static bool destinations_failed(struct rtmp_multi_stream *stream)
+{
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest = stream->dests.array[i];
+
+		if (os_atomic_load_long(&dest->state) != DEST_FAILED)
+			return false;
+	}
+
+	return true;
+}
+
+static void close_destinations(struct rtmp_multi_stream *stream)
+{
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct rtmp_destination *dest = stream->dests.array[i];
+		long                    state;
+
+		if (dest->thread_active) {
+			pthread_join(dest->connect_thread, NULL);
+			dest->thread_active = false;
+		}
+
+		state = os_atomic_load_long(&dest->state);
+		if (state == DEST_ACTIVE)
+			epoll_ctl(stream->epoll_fd, EPOLL_CTL_DEL, dest->fd,
+					NULL);
+		if (state == DEST_ACTIVE || state == DEST_CONNECTED)
+			close_destination(dest);
+
+		os_atomic_set_long(&dest->state, DEST_IDLE);
+		update_dest_stats(dest);
+	}
+}
+
+static void free_packets(struct rtmp_multi_stream *stream)
+{
+	struct encoder_packet packet;
+
+	while (mpsc_queue_pop(&stream->queue, &packet))
+		obs_encoder_packet_release(&packet);
+}
+
+/* data capture is only ever started and ended on the network thread */
+static inline void end_capture(struct rtmp_multi_stream *stream)
+{
+	if (stream->capturing) {
+		obs_output_end_data_capture(stream->output);
+		stream->capturing = false;
+	}
+}
+
+static void *network_thread(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	struct epoll_event       events[MAX_EVENTS];
+	uint64_t                 stop_time = 0;
+	int                      stop_code = OBS_OUTPUT_SUCCESS;
+
+	for (;;) {
+		uint64_t now;
+		int      num;
+
+		num = epoll_wait(stream->epoll_fd, events, MAX_EVENTS,
+				LOOP_TIMEOUT_MS);
+		if (num < 0 && errno != EINTR) {
+			warn("epoll_wait failed: %d", errno);
+			stop_code = OBS_OUTPUT_ERROR;
+			break;
+		}
+
+		now = os_gettime_ns();
+
+		handle_events(stream, events, num);
+		receive_queued_packets(stream);
+		update_connections(stream, now);
+
+		for (size_t i = 0; i < stream->dests.num; i++) {
+			struct rtmp_destination *dest = stream->dests.array[i];
+
+			if (os_atomic_load_long(&dest->state) == DEST_ACTIVE &&
+			    !send_data(dest))
+				disconnect_destination(dest);
+
+			update_dest_stats(dest);
+		}
+
+		if (stopping(stream)) {
+			/* whatever is queued by now is still sent */
+			if (!stop_time) {
+				stop_time = now + STOP_DRAIN_TIMEOUT_NS;
+				end_capture(stream);
+			}
+			if (destinations_drained(stream) || now >= stop_time)
+				break;
+
+		} else if (destinations_failed(stream)) {
+			stop_code = stream->capturing ?
+				OBS_OUTPUT_DISCONNECTED :
+				stream->dests.array[0]->connect_error;
+			break;
+		}
+	}
+
+	if (stopping(stream))
+		end_capture(stream);
+
+	close_destinations(stream);
+	free_packets(stream);
+
+	if (stop_code != OBS_OUTPUT_SUCCESS)
+		info("All destinations failed");
+	else
+		info("User stopped the stream");
+
+	if (!stopping(stream)) {
+		/* obs_output_signal_stop ends data capture */
+		pthread_detach(stream->net_thread);
+		stream->active    = false;
+		stream->capturing = false;
+		obs_output_signal_stop(stream->output, stop_code);
+	} else {
+		stream->active = false;
+	}
+
+	return NULL;
+}
+
+/* ------------------------------------------------------------------------- */
+/* output callbacks                                                          */
+
+static void rtmp_multi_stream_stop(void *data);
+
+static void rtmp_multi_stream_destroy(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	if (stream->active)
+		rtmp_multi_stream_stop(data);
+
+	if (stream) {
+		free_packets(stream);
+		free_destinations(stream);
+
+		if (stream->epoll_fd != -1)
+			close(stream->epoll_fd);
+		if (stream->wake_fd != -1)
+			close(stream->wake_fd);
+
+		os_event_destroy(stream->stop_event);
+		pthread_mutex_destroy(&stream->stats_mutex);
+		mpsc_queue_free(&stream->queue);
+		bfree(stream);
+	}
+}
+
+static void get_destination_count_proc(void *data, calldata_t params)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	pthread_mutex_lock(&stream->stats_mutex);
+	calldata_setint(params, "count", (long long)stream->dests.num);
+	pthread_mutex_unlock(&stream->stats_mutex);
+}
+
+static void get_destination_stats_proc(void *data, calldata_t params)
+{
+	struct rtmp_multi_stream *stream = data;
+	struct rtmp_destination  *dest;
+	long long                idx = 0;
+
+	calldata_getint(params, "index", &idx);
+
+	pthread_mutex_lock(&stream->stats_mutex);
+
+	if (idx >= 0 && (size_t)idx < stream->dests.num) {
+		dest = stream->dests.array[idx];
+
+		calldata_setstring(params, "url", dest->path.array);
+		calldata_setbool(params, "connected", dest->stats.connected);
+		calldata_setint(params, "total_bytes",
+				(long long)dest->stats.total_bytes);
+		calldata_setint(params, "dropped_frames",
+				dest->stats.dropped_frames);
+		calldata_setint(params, "buffered_packets",
+				dest->stats.buffered_packets);
+		calldata_setint(params, "buffered_duration",
+				(long long)dest->stats.buffered_duration);
+		calldata_setint(params, "send_buffer_bytes",
+				(long long)dest->stats.send_buffer_bytes);
+		calldata_setint(params, "reconnects", dest->stats.reconnects);
+	}
+
+	pthread_mutex_unlock(&stream->stats_mutex);
+}
+
+static const char *get_destination_count_decl =
+	"void get_destination_count(out int count)";
+
+static const char *get_destination_stats_decl =
+	"void get_destination_stats(in int index, out string url, "
+		"out bool connected, out int total_bytes, "
+		"out int dropped_frames, out int buffered_packets, "
+		"out int buffered_duration, out int send_buffer_bytes, "
+		"out int reconnects)";
+
+static void *rtmp_multi_stream_create(obs_data_t settings, obs_output_t output)
+{
+	struct rtmp_multi_stream *stream =
+		bzalloc(sizeof(struct rtmp_multi_stream));
+	proc_handler_t           handler = obs_output_prochandler(output);
+	struct epoll_event       event   = {0};
+
+	stream->output   = output;
+	stream->epoll_fd = -1;
+	stream->wake_fd  = -1;
+	pthread_mutex_init_value(&stream->stats_mutex);
+
+	RTMP_LogSetCallback(log_rtmp);
+	RTMP_LogSetLevel(RTMP_LOGWARNING);
+
+	if (pthread_mutex_init(&stream->stats_mutex, NULL) != 0)
+		goto fail;
+	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
+		goto fail;
+	if (!mpsc_queue_init(&stream->queue, sizeof(struct encoder_packet),
+				PACKET_QUEUE_SIZE))
+		goto fail;
+
+	stream->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (stream->epoll_fd == -1)
+		goto fail;
+
+	stream->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (stream->wake_fd == -1)
+		goto fail;
+
+	/* the wake event is the only one without a destination */
+	event.events   = EPOLLIN;
+	event.data.ptr = NULL;
+	if (epoll_ctl(stream->epoll_fd, EPOLL_CTL_ADD, stream->wake_fd,
+				&event) != 0)
+		goto fail;
+
+	proc_handler_add(handler, get_destination_count_decl,
+			get_destination_count_proc, stream);
+	proc_handler_add(handler, get_destination_stats_decl,
+			get_destination_stats_proc, stream);
+
+	UNUSED_PARAMETER(settings);
+	return stream;
+
+fail:
+	rtmp_multi_stream_destroy(stream);
+	return NULL;
+}
+
+static void rtmp_multi_stream_stop(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	os_event_signal(stream->stop_event);
+
+	/* the network thread ends data capture itself */
+	if (stream->active) {
+		wake_network_thread(stream);
+		pthread_join(stream->net_thread, NULL);
+	}
+
+	os_event_reset(stream->stop_event);
+}
+
+static bool rtmp_multi_stream_start(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	obs_data_t settings;
+	bool       success;
+
+	if (!obs_output_can_begin_data_capture(stream->output, 0))
+		return false;
+	if (!obs_output_initialize_encoders(stream->output, 0))
+		return false;
+
+	settings = obs_output_get_settings(stream->output);
+	success  = load_destinations(stream, settings);
+	stream->drop_threshold_usec =
+		(int64_t)obs_data_getint(settings, OPT_DROP_THRESHOLD) * 1000;
+	stream->reconnect_delay_ns =
+		(uint64_t)obs_data_getint(settings, OPT_RECONNECT_DELAY) *
+		1000000000ULL;
+	stream->max_retries =
+		(int)obs_data_getint(settings, OPT_MAX_RETRIES);
+	obs_data_release(settings);
+
+	if (!success) {
+		warn("No destinations to stream to");
+		return false;
+	}
+
+	stream->queue_drops   = 0;
+	stream->wait_keyframe = false;
+	stream->capturing     = false;
+	free_packets(stream);
+
+	if (pthread_create(&stream->net_thread, NULL, network_thread,
+				stream) != 0) {
+		warn("Failed to create network thread");
+		return false;
+	}
+
+	stream->active = true;
+	return true;
+}
+
+static void rtmp_multi_stream_data(void *data, struct encoder_packet *packet)
+{
+	struct rtmp_multi_stream *stream = data;
+	struct encoder_packet    new_packet;
+
+	/* video was dropped on a full queue, so everything up to the next
+	 * keyframe would reference a missing frame for every destination */
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (stream->wait_keyframe && !packet->keyframe) {
+			os_atomic_inc_long(&stream->queue_drops);
+			return;
+		}
+
+		stream->wait_keyframe = false;
+	}
+
+	obs_encoder_packet_ref(&new_packet, packet);
+
+	if (mpsc_queue_push(&stream->queue, &new_packet)) {
+		wake_network_thread(stream);
+	} else {
+		if (packet->type == OBS_ENCODER_VIDEO) {
+			os_atomic_inc_long(&stream->queue_drops);
+			stream->wait_keyframe = true;
+		}
+		obs_encoder_packet_release(&new_packet);
+	}
+}
+
+static void rtmp_multi_stream_defaults(obs_data_t defaults)
+{
+	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
+	obs_data_set_default_int(defaults, OPT_RECONNECT_DELAY, 10);
+	obs_data_set_default_int(defaults, OPT_MAX_RETRIES, 20);
+}
+
+static obs_properties_t rtmp_multi_stream_properties(void)
+{
+	obs_properties_t props = obs_properties_create();
+
+	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
+			obs_module_text("RTMPStream.DropThreshold"),
+			200, 10000, 100);
+	obs_properties_add_int(props, OPT_RECONNECT_DELAY,
+			obs_module_text("RTMPMultiStream.ReconnectDelay"),
+			1, 60, 1);
+	obs_properties_add_int(props, OPT_MAX_RETRIES,
+			obs_module_text("RTMPMultiStream.MaxRetries"),
+			0, 10000, 1);
+	return props;
+}
+
+static uint64_t rtmp_multi_stream_total_bytes_sent(void *data)
+{
+	struct rtmp_multi_stream *stream = data;
+	uint64_t                 total   = 0;
+
+	pthread_mutex_lock(&stream->stats_mutex);
+	for (size_t i = 0; i < stream->dests.num; i++)
+		total += stream->dests.array[i]->stats.total_bytes;
+	pthread_mutex_unlock(&stream->stats_mutex);
+
+	return total;
+}
+
+static int rtmp_multi_stream_dropped_frames(void *data)
+{
+	struct rtmp_multi_stream *stream  = data;
+	int                      dropped = (int)stream->queue_drops;
+
+	pthread_mutex_lock(&stream->stats_mutex);
+	for (size_t i = 0; i < stream->dests.num; i++)
+		dropped += stream->dests.array[i]->stats.dropped_frames;
+	pthread_mutex_unlock(&stream->stats_mutex);
+
+	return dropped;
+}
+
+/* the output as a whole is as backed up as its slowest destination */
+static void rtmp_multi_stream_get_stats(void *data,
+		struct obs_output_stats *stats)
+{
+	struct rtmp_multi_stream *stream = data;
+
+	pthread_mutex_lock(&stream->stats_mutex);
+
+	for (size_t i = 0; i < stream->dests.num; i++) {
+		struct dest_stats *ds = &stream->dests.array[i]->stats;
+
+		stats->buffered_packets += ds->buffered_packets;
+		stats->send_queue_bytes += ds->send_buffer_bytes;
+		if (ds->buffered_duration > stats->buffered_duration)
+			stats->buffered_duration = ds->buffered_duration;
+	}
+
+	stats->congested = (int64_t)stats->buffered_duration >
+		stream->drop_threshold_usec / 4;
+
+	pthread_mutex_unlock(&stream->stats_mutex);
+}
+
+struct obs_output_info rtmp_multi_output_info = {
+	.id             = "rtmp_multi_output",
+	.flags          = OBS_OUTPUT_AV |
+	                  OBS_OUTPUT_ENCODED,
+	.getname        = rtmp_multi_stream_getname,
+	.create         = rtmp_multi_stream_create,
+	.destroy        = rtmp_multi_stream_destroy,
+	.start          = rtmp_multi_stream_start,
+	.stop           = rtmp_multi_stream_stop,
+	.encoded_packet = rtmp_multi_stream_data,
+	.defaults       = rtmp_multi_stream_defaults,
+	.properties     = rtmp_multi_stream_properties,
+	.total_bytes    = rtmp_multi_stream_total_bytes_sent,
+	.dropped_frames = rtmp_multi_stream_dropped_frames,
+	.get_stats      = rtmp_multi_stream_get_stats
+};
@@ -21,11 +21,18 @@
 #include <util/circlebuf.h>
 #include <util/dstr.h>
 #include <util/threading.h>
+#include <util/mpsc-queue.h>
 #include <inttypes.h>
 #include "librtmp/rtmp.h"
 #include "librtmp/log.h"
 #include "flv-mux.h"
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <netinet/tcp.h>
+#include <linux/sockios.h>
+#endif
+
 #define do_log(level, format, ...) \
 	blog(level, "[rtmp stream: '%s'] " format, \
 			obs_output_getname(stream->output), ##__VA_ARGS__)
@@ -34,16 +41,67 @@
 #define info(format, ...)  do_log(LOG_INFO,    format, ##__VA_ARGS__)
 #define debug(format, ...) do_log(LOG_DEBUG,   format, ##__VA_ARGS__)
 
-#define OPT_DROP_THRESHOLD "drop_threshold_ms"
+/* the same channel RTMP_Write uses for stream data */
+#define RTMP_SOURCE_CHANNEL 0x04
+
+#define OPT_DROP_THRESHOLD  "drop_threshold_ms"
+#define OPT_DYNAMIC_BITRATE "dynamic_bitrate"
+
+/* dynamic bitrate: lower the bitrate when more than half of the drop
+ * threshold is buffered, raise it back up once less than an eighth of the
+ * drop threshold has stayed buffered for a while */
+#define BITRATE_LOWER_PERCENT       75
+#define BITRATE_RAISE_PERCENT       110
+#define BITRATE_MIN_PERCENT         25
+#define BITRATE_LOWER_INTERVAL_USEC 1000000LL
+#define BITRATE_RAISE_INTERVAL_USEC 5000000LL
+
+/* frame dropping is graded by how far the buffer is over the drop
+ * threshold.  each level is left again once the buffer has drained to half
+ * of that level's threshold */
+enum drop_level {
+	DROP_NONE,
+	DROP_DISPOSABLE,  /* drop frames that no other frame references */
+	DROP_TO_KEYFRAME, /* drop frames after the last buffered keyframe */
+	DROP_GOPS         /* drop all buffered video */
+};
+
+static const int drop_level_percent[] = {0, 75, 100, 150};
+
+#define NUM_DROP_PRIORITIES (OBS_NAL_PRIORITY_HIGHEST + 1)
+
+/* congestion telemetry is sampled every 250ms, and throughput is measured
+ * over the last 5 seconds of samples */
+#define TELEMETRY_INTERVAL_NS 250000000ULL
+#define TELEMETRY_SAMPLES     20
+
+struct send_sample {
+	uint64_t         time_ns;
+	uint64_t         bytes;
+};
+
+/* packets from the encoders are handed to the send thread through a
+ * lock-free queue, which the send thread drains in batches */
+#define PACKET_QUEUE_SIZE 4096
+#define PACKET_BATCH_SIZE 64
 
 //#define TEST_FRAMEDROPS
 
 struct rtmp_stream {
 	obs_output_t     output;
 
-	pthread_mutex_t  packets_mutex;
+	struct mpsc_queue queue;
+	volatile long    queue_drops;
+	volatile long    send_pending;
+
+	/* only used by the encoder callback */
+	bool             wait_keyframe;
+
+	/* only used by the send thread once the stream is active */
 	struct circlebuf packets;
 
+	pthread_mutex_t  stats_mutex;
+
 	bool             connecting;
 	pthread_t        connect_thread;
 
@@ -60,12 +118,31 @@ struct rtmp_stream {
 	int64_t          drop_threshold_usec;
 	int64_t          min_drop_dts_usec;
 	int              min_priority;
+	enum drop_level  drop_level;
+	int              priority_drops[NUM_DROP_PRIORITIES];
+	uint64_t         priority_drop_bytes[NUM_DROP_PRIORITIES];
+
+	/* dynamic bitrate variables */
+	bool             dynamic_bitrate;
+	uint32_t         base_bitrate;
+	uint32_t         cur_bitrate;
+	int64_t          last_lower_dts_usec;
+	int64_t          low_buffer_dts_usec;
 
 	int64_t          last_dts_usec;
 
 	uint64_t         total_bytes_sent;
 	int              dropped_frames;
 
+	/* congestion telemetry */
+	struct send_sample samples[TELEMETRY_SAMPLES];
+	size_t           sample_idx;
+	size_t           num_samples;
+	uint64_t         last_sample_ns;
+	uint64_t         send_time_total;
+	uint64_t         sends;
+	struct obs_output_stats telemetry;
+
 	RTMP             rtmp;
 };
 
@@ -84,10 +161,14 @@ static void log_rtmp(int level, const char *format, va_list args)
 
 static inline void free_packets(struct rtmp_stream *stream)
 {
+	struct encoder_packet packet;
+
+	while (mpsc_queue_pop(&stream->queue, &packet))
+		obs_encoder_packet_release(&packet);
+
 	while (stream->packets.size) {
-		struct encoder_packet packet;
 		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
-		obs_free_encoder_packet(&packet);
+		obs_encoder_packet_release(&packet);
 	}
 }
 
@@ -108,8 +189,9 @@ static void rtmp_stream_destroy(void *data)
 		dstr_free(&stream->password);
 		os_event_destroy(stream->stop_event);
 		os_sem_destroy(stream->send_sem);
-		pthread_mutex_destroy(&stream->packets_mutex);
+		pthread_mutex_destroy(&stream->stats_mutex);
 		circlebuf_free(&stream->packets);
+		mpsc_queue_free(&stream->queue);
 		bfree(stream);
 	}
 }
@@ -118,16 +200,19 @@ static void *rtmp_stream_create(obs_data_t settings, obs_output_t output)
 {
 	struct rtmp_stream *stream = bzalloc(sizeof(struct rtmp_stream));
 	stream->output = output;
-	pthread_mutex_init_value(&stream->packets_mutex);
+	pthread_mutex_init_value(&stream->stats_mutex);
 
 	RTMP_Init(&stream->rtmp);
 	RTMP_LogSetCallback(log_rtmp);
 	RTMP_LogSetLevel(RTMP_LOGWARNING);
 
-	if (pthread_mutex_init(&stream->packets_mutex, NULL) != 0)
+	if (pthread_mutex_init(&stream->stats_mutex, NULL) != 0)
 		goto fail;
 	if (os_event_init(&stream->stop_event, OS_EVENT_TYPE_MANUAL) != 0)
 		goto fail;
+	if (!mpsc_queue_init(&stream->queue, sizeof(struct encoder_packet),
+				PACKET_QUEUE_SIZE))
+		goto fail;
 
 	UNUSED_PARAMETER(settings);
 	return stream;
@@ -154,6 +239,29 @@ static void rtmp_stream_stop(void *data)
 		RTMP_Close(&stream->rtmp);
 	}
 
+	if (stream->dropped_frames)
+		info("Dropped frames by priority: "
+		     "disposable %d (%"PRIu64" bytes), "
+		     "low %d (%"PRIu64" bytes), "
+		     "high %d (%"PRIu64" bytes), "
+		     "highest %d (%"PRIu64" bytes)",
+		     stream->priority_drops[OBS_NAL_PRIORITY_DISPOSABLE],
+		     stream->priority_drop_bytes[OBS_NAL_PRIORITY_DISPOSABLE],
+		     stream->priority_drops[OBS_NAL_PRIORITY_LOW],
+		     stream->priority_drop_bytes[OBS_NAL_PRIORITY_LOW],
+		     stream->priority_drops[OBS_NAL_PRIORITY_HIGH],
+		     stream->priority_drop_bytes[OBS_NAL_PRIORITY_HIGH],
+		     stream->priority_drops[OBS_NAL_PRIORITY_HIGHEST],
+		     stream->priority_drop_bytes[OBS_NAL_PRIORITY_HIGHEST]);
+
+	/* the encoder may be shared, so put its bitrate back */
+	if (stream->dynamic_bitrate && stream->cur_bitrate &&
+	    stream->cur_bitrate != stream->base_bitrate) {
+		obs_output_set_target_bitrate(stream->output,
+				stream->base_bitrate);
+		stream->cur_bitrate = stream->base_bitrate;
+	}
+
 	os_event_reset(stream->stop_event);
 }
 
@@ -171,39 +279,66 @@ static inline void set_rtmp_dstr(AVal *val, struct dstr *str)
 	val->av_len = valid ? (int)str->len : 0;
 }
 
+static void receive_queued_packets(struct rtmp_stream *stream);
+
 static inline bool get_next_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
-	bool new_packet = false;
+	receive_queued_packets(stream);
 
-	pthread_mutex_lock(&stream->packets_mutex);
-	if (stream->packets.size) {
-		circlebuf_pop_front(&stream->packets, packet,
-				sizeof(struct encoder_packet));
-		new_packet = true;
-	}
-	pthread_mutex_unlock(&stream->packets_mutex);
+	if (!stream->packets.size)
+		return false;
 
-	return new_packet;
+	circlebuf_pop_front(&stream->packets, packet,
+			sizeof(struct encoder_packet));
+	return true;
 }
 
+static void update_telemetry(struct rtmp_stream *stream, uint64_t send_time);
+
+/* packets are sent as RTMP messages straight from the packet data, only the
+ * few bytes of FLV codec header are written separately */
 static int send_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet, bool is_header)
 {
-	uint8_t *data;
-	size_t  size;
-	int     ret = 0;
+	uint8_t    header[FLV_BODY_HEADER_MAX];
+	RTMPIOVec  body[2];
+	RTMPPacket rtmp_packet = {0};
+	size_t     header_size;
+	uint64_t   send_start;
+	int        ret = 0;
+
+	if (!packet->data || !packet->size)
+		goto cleanup;
+
+	header_size = flv_body_header(packet, header, is_header);
+
+	body[0].iov_base = (const char*)header;
+	body[0].iov_len  = (int)header_size;
+	body[1].iov_base = (const char*)packet->data;
+	body[1].iov_len  = (int)packet->size;
+
+	rtmp_packet.m_nChannel    = RTMP_SOURCE_CHANNEL;
+	rtmp_packet.m_nInfoField2 = stream->rtmp.m_stream_id;
+	rtmp_packet.m_nTimeStamp  = get_ms_time(packet, packet->dts);
+	rtmp_packet.m_nBodySize   = (uint32_t)(header_size + packet->size);
+	rtmp_packet.m_packetType  = (packet->type == OBS_ENCODER_VIDEO) ?
+		RTMP_PACKET_TYPE_VIDEO : RTMP_PACKET_TYPE_AUDIO;
+	rtmp_packet.m_headerType  = rtmp_packet.m_nTimeStamp ?
+		RTMP_PACKET_SIZE_MEDIUM : RTMP_PACKET_SIZE_LARGE;
 
-	flv_packet_mux(packet, &data, &size, is_header);
 #ifdef TEST_FRAMEDROPS
 	os_sleep_ms(rand() % 40);
 #endif
-	ret = RTMP_Write(&stream->rtmp, (char*)data, (int)size);
-	bfree(data);
+	send_start = os_gettime_ns();
+	if (!RTMP_SendPacketV(&stream->rtmp, &rtmp_packet, body, 2))
+		ret = -1;
 
-	obs_free_encoder_packet(packet);
+	stream->total_bytes_sent += rtmp_packet.m_nBodySize;
+	update_telemetry(stream, os_gettime_ns() - send_start);
 
-	stream->total_bytes_sent += size;
+cleanup:
+	obs_encoder_packet_release(packet);
 	return ret;
 }
 
@@ -223,14 +358,14 @@ static void *send_thread(void *data)
 	struct rtmp_stream *stream = data;
 	bool disconnected = false;
 
+	/* everything queued is sent on each wakeup, and the semaphore is only
+	 * posted again for packets queued after the flag is cleared */
 	while (os_sem_wait(stream->send_sem) == 0) {
-		struct encoder_packet packet;
+		os_atomic_compare_swap_long(&stream->send_pending, 1, 0);
 
 		if (os_event_try(stream->stop_event) != EAGAIN)
 			break;
-		if (!get_next_packet(stream, &packet))
-			continue;
-		if (send_packet(stream, &packet, false) < 0) {
+		if (!send_remaining_packets(stream)) {
 			disconnected = true;
 			break;
 		}
@@ -308,6 +443,7 @@ static void send_headers(struct rtmp_stream *stream)
 
 static inline bool reset_semaphore(struct rtmp_stream *stream)
 {
+	stream->send_pending = 0;
 	os_sem_destroy(stream->send_sem);
 	return os_sem_init(&stream->send_sem, 0) == 0;
 }
@@ -343,6 +479,9 @@ static int init_send(struct rtmp_stream *stream)
 
 	reset_semaphore(stream);
 
+	/* packets can still be queued after a disconnect */
+	free_packets(stream);
+
 	ret = pthread_create(&stream->send_thread, NULL, send_thread, stream);
 	if (ret != 0) {
 		RTMP_Close(&stream->rtmp);
@@ -425,8 +564,22 @@ static bool rtmp_stream_start(void *data)
 	if (!obs_output_initialize_encoders(stream->output, 0))
 		return false;
 
-	stream->total_bytes_sent = 0;
-	stream->dropped_frames   = 0;
+	stream->total_bytes_sent  = 0;
+	stream->dropped_frames    = 0;
+	stream->queue_drops       = 0;
+	stream->wait_keyframe     = false;
+	stream->sample_idx        = 0;
+	stream->num_samples       = 0;
+	stream->last_sample_ns    = 0;
+	stream->send_time_total   = 0;
+	stream->sends             = 0;
+	memset(&stream->telemetry, 0, sizeof(stream->telemetry));
+	stream->min_priority      = 0;
+	stream->min_drop_dts_usec = 0;
+	stream->drop_level        = DROP_NONE;
+	memset(stream->priority_drops, 0, sizeof(stream->priority_drops));
+	memset(stream->priority_drop_bytes, 0,
+			sizeof(stream->priority_drop_bytes));
 
 	settings = obs_output_get_settings(stream->output);
 	dstr_copy(&stream->path,     obs_service_get_url(service));
@@ -435,8 +588,16 @@ static bool rtmp_stream_start(void *data)
 	dstr_copy(&stream->password, obs_service_get_password(service));
 	stream->drop_threshold_usec =
 		(int64_t)obs_data_getint(settings, OPT_DROP_THRESHOLD) * 1000;
+	stream->dynamic_bitrate =
+		obs_data_getbool(settings, OPT_DYNAMIC_BITRATE);
 	obs_data_release(settings);
 
+	stream->base_bitrate = obs_encoder_get_bitrate(
+			obs_output_get_video_encoder(stream->output));
+	stream->cur_bitrate         = stream->base_bitrate;
+	stream->last_lower_dts_usec = 0;
+	stream->low_buffer_dts_usec = 0;
+
 	return pthread_create(&stream->connect_thread, NULL, connect_thread,
 			stream) == 0;
 }
@@ -455,78 +616,342 @@ static inline size_t num_buffered_packets(struct rtmp_stream *stream)
 	return stream->packets.size / sizeof(struct encoder_packet);
 }
 
-static void drop_frames(struct rtmp_stream *stream)
+static inline int64_t buffered_duration_usec(struct rtmp_stream *stream)
+{
+	struct encoder_packet first;
+
+	if (!stream->packets.size)
+		return 0;
+
+	circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+	return stream->last_dts_usec - first.dts_usec;
+}
+
+/* bytes written to the socket that the kernel has not sent (or had
+ * acknowledged) yet */
+static uint64_t get_send_queue_bytes(struct rtmp_stream *stream)
+{
+#if defined(__linux__) && defined(SIOCOUTQ)
+	int queued = 0;
+	if (ioctl(stream->rtmp.m_sb.sb_socket, SIOCOUTQ, &queued) == 0 &&
+	    queued > 0)
+		return (uint64_t)queued;
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	return 0;
+}
+
+/* gets the round trip time, and the rate the TCP congestion window
+ * currently allows (in kbps) */
+static uint32_t get_tcp_rate(struct rtmp_stream *stream, uint64_t *rtt)
+{
+#if defined(__linux__) && defined(TCP_INFO)
+	struct tcp_info tcpi;
+	socklen_t       size = sizeof(tcpi);
+
+	if (getsockopt(stream->rtmp.m_sb.sb_socket, IPPROTO_TCP, TCP_INFO,
+				&tcpi, &size) == 0 && tcpi.tcpi_rtt) {
+		*rtt = tcpi.tcpi_rtt;
+		return (uint32_t)((uint64_t)tcpi.tcpi_snd_cwnd *
+				tcpi.tcpi_snd_mss * 8000 / tcpi.tcpi_rtt);
+	}
+#else
+	UNUSED_PARAMETER(stream);
+#endif
+	*rtt = 0;
+	return 0;
+}
+
+/* combines the throughput and TCP state in to a bandwidth estimate.  while
+ * data is backing up, the link is saturated and the throughput is what the
+ * link can carry.  otherwise the throughput only shows what the encoders
+ * produce, and the congestion window gives an upper bound of what could
+ * be sent. */
+static inline uint32_t estimate_bandwidth(struct obs_output_stats *stats,
+		uint32_t tcp_rate)
+{
+	if (stats->congested || !tcp_rate)
+		return stats->throughput;
+
+	return (tcp_rate > stats->throughput) ? tcp_rate : stats->throughput;
+}
+
+static void update_telemetry(struct rtmp_stream *stream, uint64_t send_time)
+{
+	struct obs_output_stats *stats = &stream->telemetry;
+	struct send_sample      *sample;
+	struct send_sample      *oldest;
+	uint64_t                now = os_gettime_ns();
+	uint64_t                send_queue = 0;
+	uint64_t                rtt = 0;
+	uint32_t                tcp_rate = 0;
+	bool                    take_sample;
+
+	take_sample = (now - stream->last_sample_ns >= TELEMETRY_INTERVAL_NS);
+	if (take_sample) {
+		send_queue = get_send_queue_bytes(stream);
+		tcp_rate   = get_tcp_rate(stream, &rtt);
+	}
+
+	pthread_mutex_lock(&stream->stats_mutex);
+
+	stream->send_time_total += send_time;
+	stream->sends++;
+	stats->avg_send_time = stream->send_time_total / stream->sends;
+	if (send_time > stats->max_send_time)
+		stats->max_send_time = send_time;
+
+	if (!take_sample)
+		goto unlock;
+
+	stream->last_sample_ns = now;
+
+	/* only count data that has actually left the socket */
+	sample          = &stream->samples[stream->sample_idx];
+	sample->time_ns = now;
+	sample->bytes   = (stream->total_bytes_sent > send_queue) ?
+		stream->total_bytes_sent - send_queue : 0;
+
+	stream->sample_idx = (stream->sample_idx + 1) % TELEMETRY_SAMPLES;
+	if (stream->num_samples < TELEMETRY_SAMPLES)
+		stream->num_samples++;
+
+	oldest = (stream->num_samples < TELEMETRY_SAMPLES) ?
+		&stream->samples[0] : &stream->samples[stream->sample_idx];
+
+	if (now > oldest->time_ns && sample->bytes >= oldest->bytes)
+		stats->throughput = (uint32_t)((sample->bytes - oldest->bytes) *
+				8000000 / (now - oldest->time_ns));
+
+	stats->buffered_packets  = (uint32_t)num_buffered_packets(stream);
+	stats->buffered_duration = (uint64_t)buffered_duration_usec(stream);
+	stats->send_queue_bytes  = send_queue;
+	stats->rtt               = rtt;
+	stats->congested         = (int64_t)stats->buffered_duration >
+		stream->drop_threshold_usec / 4;
+	stats->bandwidth_estimate = estimate_bandwidth(stats, tcp_rate);
+
+unlock:
+	pthread_mutex_unlock(&stream->stats_mutex);
+}
+
+static inline int64_t drop_level_threshold(struct rtmp_stream *stream,
+		enum drop_level level)
+{
+	return stream->drop_threshold_usec * drop_level_percent[level] / 100;
+}
+
+/* frames that can be dropped without having to wait for a keyframe */
+static inline bool is_disposable(struct encoder_packet *packet)
+{
+	return packet->drop_priority < OBS_NAL_PRIORITY_HIGH;
+}
+
+static void count_dropped_packet(struct rtmp_stream *stream,
+		struct encoder_packet *packet)
+{
+	int priority = packet->priority;
+
+	if (priority < 0)
+		priority = 0;
+	else if (priority >= NUM_DROP_PRIORITIES)
+		priority = NUM_DROP_PRIORITIES - 1;
+
+	if (stream->min_priority < packet->drop_priority)
+		stream->min_priority = packet->drop_priority;
+
+	stream->priority_drops[priority]++;
+	stream->priority_drop_bytes[priority] += packet->size;
+	stream->dropped_frames++;
+}
+
+/* returns the index of the last buffered video keyframe, or -1 if none is
+ * buffered */
+static long find_last_keyframe(struct rtmp_stream *stream)
+{
+	struct circlebuf new_buf  = {0};
+	long             keyframe = -1;
+
+	circlebuf_reserve(&new_buf, stream->packets.size);
+
+	for (long i = 0; stream->packets.size; i++) {
+		struct encoder_packet packet;
+		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
+
+		if (packet.type == OBS_ENCODER_VIDEO && packet.keyframe)
+			keyframe = i;
+
+		circlebuf_push_back(&new_buf, &packet, sizeof(packet));
+	}
+
+	circlebuf_free(&stream->packets);
+	stream->packets = new_buf;
+	return keyframe;
+}
+
+static inline bool should_drop(enum drop_level level,
+		struct encoder_packet *packet, long idx, long keyframe)
+{
+	if (packet->type != OBS_ENCODER_VIDEO)
+		return false;
+
+	switch (level) {
+	case DROP_NONE:        return false;
+	case DROP_DISPOSABLE:  return is_disposable(packet);
+	case DROP_TO_KEYFRAME: return idx > keyframe;
+	case DROP_GOPS:        return true;
+	}
+
+	return false;
+}
+
+static void drop_frames(struct rtmp_stream *stream, enum drop_level level)
 {
 	struct circlebuf new_buf            = {0};
-	int              drop_priority      = 0;
-	uint64_t         last_drop_dts_usec = 0;
-	int              num_frames_dropped = 0;
+	int64_t          last_drop_dts_usec = 0;
+	int              prev_dropped       = stream->dropped_frames;
+	long             keyframe           = -1;
 
 	debug("Previous packet count: %d", (int)num_buffered_packets(stream));
 
+	if (level == DROP_TO_KEYFRAME)
+		keyframe = find_last_keyframe(stream);
+
 	circlebuf_reserve(&new_buf, sizeof(struct encoder_packet) * 8);
 
-	while (stream->packets.size) {
+	for (long i = 0; stream->packets.size; i++) {
 		struct encoder_packet packet;
 		circlebuf_pop_front(&stream->packets, &packet, sizeof(packet));
 
 		last_drop_dts_usec = packet.dts_usec;
 
-		if (packet.type == OBS_ENCODER_AUDIO) {
-			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
-
+		if (should_drop(level, &packet, i, keyframe)) {
+			count_dropped_packet(stream, &packet);
+			obs_encoder_packet_release(&packet);
 		} else {
-			if (drop_priority < packet.drop_priority)
-				drop_priority = packet.drop_priority;
-
-			num_frames_dropped++;
-			obs_free_encoder_packet(&packet);
+			circlebuf_push_back(&new_buf, &packet, sizeof(packet));
 		}
 	}
 
 	circlebuf_free(&stream->packets);
 	stream->packets           = new_buf;
-	stream->min_priority      = drop_priority;
 	stream->min_drop_dts_usec = last_drop_dts_usec;
 
-	stream->dropped_frames += num_frames_dropped;
-	debug("New packet count: %d", (int)num_buffered_packets(stream));
+	debug("Dropped %d frames at drop level %d, new packet count: %d",
+			stream->dropped_frames - prev_dropped, (int)level,
+			(int)num_buffered_packets(stream));
 }
 
 static void check_to_drop_frames(struct rtmp_stream *stream)
 {
 	struct encoder_packet first;
-	int64_t buffer_duration_usec;
+	int64_t               buffered = buffered_duration_usec(stream);
+	enum drop_level       level    = stream->drop_level;
+	enum drop_level       target   = DROP_NONE;
+
+	while (level > DROP_NONE &&
+	       buffered < drop_level_threshold(stream, level) / 2)
+		level--;
+
+	while (target < DROP_GOPS &&
+	       buffered > drop_level_threshold(stream, target + 1))
+		target++;
+
+	if (target > DROP_NONE && target >= level &&
+	    num_buffered_packets(stream) >= 5) {
+		circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+
+		/* do not drop frames if frames were just dropped within this
+		 * time */
+		if (first.dts_usec >= stream->min_drop_dts_usec) {
+			debug("dropping %" PRId64 " worth of frames", buffered);
+			drop_frames(stream, target);
+			level = target;
+		}
+	}
 
-	if (num_buffered_packets(stream) < 5)
+	if (level != stream->drop_level) {
+		debug("Drop level changed from %d to %d",
+				(int)stream->drop_level, (int)level);
+		stream->drop_level = level;
+	}
+}
+
+static void set_bitrate(struct rtmp_stream *stream, uint32_t bitrate)
+{
+	if (bitrate == stream->cur_bitrate)
 		return;
 
-	circlebuf_peek_front(&stream->packets, &first, sizeof(first));
+	info("Changing bitrate from %"PRIu32" to %"PRIu32" kbps",
+			stream->cur_bitrate, bitrate);
 
-	/* do not drop frames if frames were just dropped within this time */
-	if (first.dts_usec < stream->min_drop_dts_usec)
-		return;
+	stream->cur_bitrate = bitrate;
+	obs_output_set_target_bitrate(stream->output, bitrate);
+}
+
+/* adapts the encoder bitrate to the send buffer, so that frames only need
+ * to be dropped when lowering the bitrate isn't enough */
+static void adjust_bitrate(struct rtmp_stream *stream, int64_t dts_usec)
+{
+	int64_t  buffered = buffered_duration_usec(stream);
+	uint32_t bitrate;
+
+	if (buffered > stream->drop_threshold_usec / 2) {
+		uint32_t min_bitrate;
+
+		stream->low_buffer_dts_usec = 0;
+
+		if (stream->last_lower_dts_usec && dts_usec <
+		    stream->last_lower_dts_usec + BITRATE_LOWER_INTERVAL_USEC)
+			return;
+
+		min_bitrate = stream->base_bitrate * BITRATE_MIN_PERCENT / 100;
+		bitrate = stream->cur_bitrate * BITRATE_LOWER_PERCENT / 100;
+		if (bitrate < min_bitrate)
+			bitrate = min_bitrate;
 
-	/* if the amount of time stored in the buffered packets waiting to be
-	 * sent is higher than threshold, drop frames */
-	buffer_duration_usec = stream->last_dts_usec - first.dts_usec;
+		stream->last_lower_dts_usec = dts_usec;
+		set_bitrate(stream, bitrate);
 
-	if (buffer_duration_usec > stream->drop_threshold_usec) {
-		drop_frames(stream);
-		debug("dropping %" PRId64 " worth of frames",
-				buffer_duration_usec);
+	} else if (buffered < stream->drop_threshold_usec / 8) {
+		if (stream->cur_bitrate >= stream->base_bitrate)
+			return;
+
+		if (!stream->low_buffer_dts_usec) {
+			stream->low_buffer_dts_usec = dts_usec;
+			return;
+		}
+
+		if (dts_usec <
+		    stream->low_buffer_dts_usec + BITRATE_RAISE_INTERVAL_USEC)
+			return;
+
+		bitrate = stream->cur_bitrate * BITRATE_RAISE_PERCENT / 100;
+		if (bitrate > stream->base_bitrate)
+			bitrate = stream->base_bitrate;
+
+		stream->low_buffer_dts_usec = dts_usec;
+		set_bitrate(stream, bitrate);
+
+	} else {
+		stream->low_buffer_dts_usec = 0;
 	}
 }
 
 static bool add_video_packet(struct rtmp_stream *stream,
 		struct encoder_packet *packet)
 {
+	if (stream->dynamic_bitrate && stream->base_bitrate)
+		adjust_bitrate(stream, packet->dts_usec);
+
 	check_to_drop_frames(stream);
 
 	/* if currently dropping frames, drop packets until it reaches the
 	 * desired priority */
-	if (packet->priority < stream->min_priority) {
-		stream->dropped_frames++;
+	if (packet->priority < stream->min_priority ||
+	    (stream->drop_level >= DROP_DISPOSABLE && is_disposable(packet))) {
+		count_dropped_packet(stream, packet);
 		return false;
 	} else {
 		stream->min_priority = 0;
@@ -535,34 +960,64 @@ static bool add_video_packet(struct rtmp_stream *stream,
 	return add_packet(stream, packet);
 }
 
+/* moves everything the encoders have queued in to the send buffer, the
+ * frame drop and bitrate logic runs here on the send thread */
+static void receive_queued_packets(struct rtmp_stream *stream)
+{
+	struct encoder_packet packets[PACKET_BATCH_SIZE];
+	size_t                num;
+
+	do {
+		num = mpsc_queue_pop_batch(&stream->queue, packets,
+				PACKET_BATCH_SIZE);
+
+		for (size_t i = 0; i < num; i++) {
+			struct encoder_packet *packet = packets+i;
+			bool added = (packet->type == OBS_ENCODER_VIDEO) ?
+				add_video_packet(stream, packet) :
+				add_packet(stream, packet);
+
+			if (!added)
+				obs_encoder_packet_release(packet);
+		}
+	} while (num == PACKET_BATCH_SIZE);
+}
+
 static void rtmp_stream_data(void *data, struct encoder_packet *packet)
 {
 	struct rtmp_stream    *stream = data;
 	struct encoder_packet new_packet;
-	bool                  added_packet;
-
-	if (packet->type == OBS_ENCODER_VIDEO)
-		obs_parse_avc_packet(&new_packet, packet);
-	else
-		obs_duplicate_encoder_packet(&new_packet, packet);
 
-	pthread_mutex_lock(&stream->packets_mutex);
+	/* once video was dropped on a full queue, everything up to the next
+	 * keyframe references a missing frame.  it's dropped here so that the
+	 * packets queued before the drop are still sent. */
+	if (packet->type == OBS_ENCODER_VIDEO) {
+		if (stream->wait_keyframe && !packet->keyframe) {
+			os_atomic_inc_long(&stream->queue_drops);
+			return;
+		}
 
-	added_packet = (packet->type == OBS_ENCODER_VIDEO) ?
-		add_video_packet(stream, &new_packet) :
-		add_packet(stream, &new_packet);
+		stream->wait_keyframe = false;
+	}
 
-	pthread_mutex_unlock(&stream->packets_mutex);
+	obs_encoder_packet_ref(&new_packet, packet);
 
-	if (added_packet)
-		os_sem_post(stream->send_sem);
-	else
-		obs_free_encoder_packet(&new_packet);
+	if (mpsc_queue_push(&stream->queue, &new_packet)) {
+		if (os_atomic_compare_swap_long(&stream->send_pending, 0, 1))
+			os_sem_post(stream->send_sem);
+	} else {
+		if (packet->type == OBS_ENCODER_VIDEO) {
+			os_atomic_inc_long(&stream->queue_drops);
+			stream->wait_keyframe = true;
+		}
+		obs_encoder_packet_release(&new_packet);
+	}
 }
 
 static void rtmp_stream_defaults(obs_data_t defaults)
 {
 	obs_data_set_default_int(defaults, OPT_DROP_THRESHOLD, 600);
+	obs_data_set_default_bool(defaults, OPT_DYNAMIC_BITRATE, false);
 }
 
 static obs_properties_t rtmp_stream_properties(void)
@@ -572,6 +1027,8 @@ static obs_properties_t rtmp_stream_properties(void)
 	obs_properties_add_int(props, OPT_DROP_THRESHOLD,
 			obs_module_text("RTMPStream.DropThreshold"),
 			200, 10000, 100);
+	obs_properties_add_bool(props, OPT_DYNAMIC_BITRATE,
+			obs_module_text("RTMPStream.DynamicBitrate"));
 	return props;
 }
 
@@ -584,7 +1041,16 @@ static uint64_t rtmp_stream_total_bytes_sent(void *data)
 static int rtmp_stream_dropped_frames(void *data)
 {
 	struct rtmp_stream *stream = data;
-	return stream->dropped_frames;
+	return stream->dropped_frames + (int)stream->queue_drops;
+}
+
+static void rtmp_stream_get_stats(void *data, struct obs_output_stats *stats)
+{
+	struct rtmp_stream *stream = data;
+
+	pthread_mutex_lock(&stream->stats_mutex);
+	*stats = stream->telemetry;
+	pthread_mutex_unlock(&stream->stats_mutex);
 }
 
 struct obs_output_info rtmp_output_info = {
@@ -601,5 +1067,6 @@ struct obs_output_info rtmp_output_info = {
 	.defaults       = rtmp_stream_defaults,
 	.properties     = rtmp_stream_properties,
 	.total_bytes    = rtmp_stream_total_bytes_sent,
-	.dropped_frames = rtmp_stream_dropped_frames
+	.dropped_frames = rtmp_stream_dropped_frames,
+	.get_stats      = rtmp_stream_get_stats
 };
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <util/dstr.h>
 #include <util/darray.h>
+#include <util/threading.h>
 #include <obs-module.h>
 
 #ifndef _STDINT_H_INCLUDED
@@ -42,8 +43,28 @@ struct obs_x264 {
 	x264_param_t    params;
 	x264_t          *context;
 
+	/* used by overload protection to step down to faster presets */
+	x264_param_t    base_params;
+	int             preset_idx;
+	int             speed_level;
+	char            *tune;
+
 	DARRAY(uint8_t) packet_data;
 
+	/* a reused context must keep seeing increasing timestamps, so pts of
+	 * later sessions are offset past the last pts of the previous one */
+	int64_t         pts_offset;
+	int64_t         next_pts;
+	bool            force_idr;
+
+	/* a context with delayed frames can't be flushed without ending its
+	 * stream, so a reset switches to a spare context, and the next spare
+	 * is opened in the background */
+	x264_t          *spare_context;
+	x264_param_t    spare_params;
+	pthread_t       spare_thread;
+	bool            spare_thread_active;
+
 	uint8_t         *extra_data;
 	uint8_t         *sei;
 
@@ -73,13 +94,53 @@ static void clear_data(struct obs_x264 *obsx264)
 	}
 }
 
+static void *spare_thread(void *data)
+{
+	struct obs_x264 *obsx264 = data;
+	obsx264->spare_context = x264_encoder_open(&obsx264->spare_params);
+	return NULL;
+}
+
+static void start_spare_thread(struct obs_x264 *obsx264)
+{
+	if (obsx264->spare_thread_active || obsx264->spare_context)
+		return;
+
+	obsx264->spare_params = obsx264->params;
+	obsx264->spare_thread_active = pthread_create(&obsx264->spare_thread,
+			NULL, spare_thread, obsx264) == 0;
+}
+
+static x264_t *take_spare_context(struct obs_x264 *obsx264)
+{
+	x264_t *context;
+
+	if (obsx264->spare_thread_active) {
+		pthread_join(obsx264->spare_thread, NULL);
+		obsx264->spare_thread_active = false;
+	}
+
+	context = obsx264->spare_context;
+	obsx264->spare_context = NULL;
+	return context;
+}
+
+static void free_spare_context(struct obs_x264 *obsx264)
+{
+	x264_t *context = take_spare_context(obsx264);
+	if (context)
+		x264_encoder_close(context);
+}
+
 static void obs_x264_destroy(void *data)
 {
 	struct obs_x264 *obsx264 = data;
 
 	if (obsx264) {
+		free_spare_context(obsx264);
 		clear_data(obsx264);
 		da_free(obsx264->packet_data);
+		bfree(obsx264->tune);
 		bfree(obsx264);
 	}
 }
@@ -214,9 +275,26 @@ static inline void apply_x264_profile(struct obs_x264 *obsx264,
 	}
 }
 
+static int get_preset_idx(const char *preset)
+{
+	if (!preset || !*preset)
+		preset = "medium";
+
+	for (int i = 0; x264_preset_names[i]; i++) {
+		if (astrcmpi(x264_preset_names[i], preset) == 0)
+			return i;
+	}
+
+	return 0;
+}
+
 static bool reset_x264_params(struct obs_x264 *obsx264,
 		const char *preset, const char *tune)
 {
+	bfree(obsx264->tune);
+	obsx264->tune       = (tune && *tune) ? bstrdup(tune) : NULL;
+	obsx264->preset_idx = get_preset_idx(preset);
+
 	return x264_param_default_preset(&obsx264->params, preset, tune) == 0;
 }
 
@@ -247,6 +325,13 @@ static void update_params(struct obs_x264 *obsx264, obs_data_t settings,
 		obsx264->params.i_keyint_max =
 			keyint_sec * voi->fps_num / voi->fps_den;
 
+	/* when a group places keyframes, keyframes only come from the group
+	 * so that they're on the same frames in every rendition */
+	if (obs_encoder_group_keyframes(obsx264->encoder)) {
+		obsx264->params.i_keyint_max         = X264_KEYINT_MAX_INFINITE;
+		obsx264->params.i_scenecut_threshold = 0;
+	}
+
 	obsx264->params.b_vfr_input          = false;
 	obsx264->params.rc.i_vbv_max_bitrate = bitrate;
 	obsx264->params.rc.i_vbv_buffer_size = buffer_size;
@@ -319,10 +404,17 @@ static bool update_settings(struct obs_x264 *obsx264, obs_data_t settings)
 
 		if (!obsx264->context)
 			apply_x264_profile(obsx264, profile);
+
+		/* overload protection steps down from these */
+		obsx264->base_params = obsx264->params;
 	}
 
 	obsx264->params.b_repeat_headers = false;
 
+	/* output length-prefixed NALs so libobs doesn't have to convert
+	 * packets from Annex-B to AVCC */
+	obsx264->params.b_annexb         = false;
+
 	strlist_free(paramlist);
 	bfree(preset);
 	bfree(profile);
@@ -331,13 +423,99 @@ static bool update_settings(struct obs_x264 *obsx264, obs_data_t settings)
 	return success;
 }
 
+/* the buffer size is scaled with the bitrate so that the buffer keeps the
+ * duration the settings gave it */
+static bool obs_x264_set_bitrate(void *data, uint32_t bitrate)
+{
+	struct obs_x264 *obsx264 = data;
+	const x264_param_t *base = &obsx264->base_params;
+	int ret;
+
+	obsx264->params.rc.i_bitrate         = (int)bitrate;
+	obsx264->params.rc.i_vbv_max_bitrate = (int)bitrate;
+
+	if (base->rc.i_bitrate > 0)
+		obsx264->params.rc.i_vbv_buffer_size = (int)(
+				(int64_t)base->rc.i_vbv_buffer_size *
+				bitrate / base->rc.i_bitrate);
+
+	ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
+	if (ret != 0)
+		warn("Failed to reconfigure bitrate: %d", ret);
+	return ret == 0;
+}
+
+static inline void set_analysis_params(x264_param_t *dst,
+		const x264_param_t *src)
+{
+	dst->analyse           = src->analyse;
+	dst->i_frame_reference = src->i_frame_reference;
+}
+
+static inline int speed_preset_idx(struct obs_x264 *obsx264, int level)
+{
+	int idx = obsx264->preset_idx - level;
+	return idx < 0 ? 0 : idx;
+}
+
+/* only the analysis settings and reference frame count of the faster preset
+ * are used, as those are what x264_encoder_reconfig can change */
+static bool apply_speed_level(struct obs_x264 *obsx264, int level)
+{
+	const char   *preset = x264_preset_names[speed_preset_idx(obsx264,
+			level)];
+	x264_param_t preset_params;
+
+	if (level == 0)
+		preset_params = obsx264->base_params;
+	else if (x264_param_default_preset(&preset_params, preset,
+				obsx264->tune) != 0)
+		return false;
+
+	set_analysis_params(&obsx264->params, &preset_params);
+	return true;
+}
+
+static bool obs_x264_set_speed_level(void *data, int level)
+{
+	struct obs_x264 *obsx264 = data;
+	int             ret;
+
+	if (!apply_speed_level(obsx264, level))
+		return false;
+
+	ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
+	if (ret != 0) {
+		warn("Failed to change speed level: %d", ret);
+		return false;
+	}
+
+	obsx264->speed_level = level;
+
+	info("Speed level %d, using preset '%s'", level,
+			x264_preset_names[speed_preset_idx(obsx264, level)]);
+	return true;
+}
+
 static bool obs_x264_update(void *data, obs_data_t settings)
 {
 	struct obs_x264 *obsx264 = data;
-	bool success = update_settings(obsx264, settings);
+	bool success;
 	int ret;
 
+	/* the spare context was opened with the old settings */
+	free_spare_context(obsx264);
+
+	/* the new settings are applied on top of the full speed analysis
+	 * settings, and the current speed level is then applied again */
+	set_analysis_params(&obsx264->params, &obsx264->base_params);
+
+	success = update_settings(obsx264, settings);
+
 	if (success) {
+		if (obsx264->speed_level)
+			apply_speed_level(obsx264, obsx264->speed_level);
+
 		ret = x264_encoder_reconfig(obsx264->context, &obsx264->params);
 		if (ret != 0)
 			warn("Failed to reconfigure: %d", ret);
@@ -347,6 +525,18 @@ static bool obs_x264_update(void *data, obs_data_t settings)
 	return false;
 }
 
+static const uint8_t annexb_start_code[4] = {0, 0, 0, 1};
+
+static void push_annexb_nal(struct darray *dst, const x264_nal_t *nal)
+{
+	if (nal->i_payload <= 4)
+		return;
+
+	darray_push_back_array(sizeof(uint8_t), dst, annexb_start_code, 4);
+	darray_push_back_array(sizeof(uint8_t), dst, nal->p_payload + 4,
+			nal->i_payload - 4);
+}
+
 static void load_headers(struct obs_x264 *obsx264)
 {
 	x264_nal_t      *nals;
@@ -359,14 +549,16 @@ static void load_headers(struct obs_x264 *obsx264)
 
 	x264_encoder_headers(obsx264->context, &nals, &nal_count);
 
+	/* NALs are length-prefixed (b_annexb is off), but extra data and SEI
+	 * data are expected in Annex-B form, so replace the length prefixes
+	 * with start codes */
 	for (int i = 0; i < nal_count; i++) {
 		x264_nal_t *nal = nals+i;
 
 		if (nal->i_type == NAL_SEI)
-			da_push_back_array(sei, nal->p_payload, nal->i_payload);
+			push_annexb_nal(&sei.da, nal);
 		else
-			da_push_back_array(header, nal->p_payload,
-					nal->i_payload);
+			push_annexb_nal(&header.da, nal);
 	}
 
 	obsx264->extra_data      = header.array;
@@ -375,6 +567,41 @@ static void load_headers(struct obs_x264 *obsx264)
 	obsx264->sei_size        = sei.num;
 }
 
+/* flushing with a NULL picture would end the stream for good, so a context
+ * that still has delayed frames (lookahead, b-frames) is replaced with a
+ * spare one opened from the same parameters */
+static bool obs_x264_reset(void *data)
+{
+	struct obs_x264 *obsx264 = data;
+
+	if (!obsx264->context)
+		return false;
+
+	if (x264_encoder_delayed_frames(obsx264->context) > 0) {
+		x264_t *context = take_spare_context(obsx264);
+
+		if (!context)
+			context = x264_encoder_open(&obsx264->params);
+		if (!context) {
+			warn("Failed to open a new context for reuse");
+			return false;
+		}
+
+		clear_data(obsx264);
+		obsx264->context    = context;
+		obsx264->pts_offset = 0;
+		obsx264->next_pts   = 0;
+		load_headers(obsx264);
+
+		start_spare_thread(obsx264);
+	} else {
+		obsx264->pts_offset = obsx264->next_pts;
+	}
+
+	obsx264->force_idr = true;
+	return true;
+}
+
 static void *obs_x264_create(obs_data_t settings, obs_encoder_t encoder)
 {
 	struct obs_x264 *obsx264 = bzalloc(sizeof(struct obs_x264));
@@ -392,7 +619,7 @@ static void *obs_x264_create(obs_data_t settings, obs_encoder_t encoder)
 	}
 
 	if (!obsx264->context) {
-		bfree(obsx264);
+		obs_x264_destroy(obsx264);
 		return NULL;
 	}
 
@@ -403,12 +630,18 @@ static void parse_packet(struct obs_x264 *obsx264,
 		struct encoder_packet *packet, x264_nal_t *nals,
 		int nal_count, x264_picture_t *pic_out)
 {
+	int priority = NAL_PRIORITY_DISPOSABLE;
+
 	if (!nal_count) return;
 
 	da_resize(obsx264->packet_data, 0);
 
 	for (int i = 0; i < nal_count; i++) {
 		x264_nal_t *nal = nals+i;
+
+		if (nal->i_type == NAL_SLICE || nal->i_type == NAL_SLICE_IDR)
+			priority = nal->i_ref_idc;
+
 		da_push_back_array(obsx264->packet_data, nal->p_payload,
 				nal->i_payload);
 	}
@@ -416,9 +649,12 @@ static void parse_packet(struct obs_x264 *obsx264,
 	packet->data          = obsx264->packet_data.array;
 	packet->size          = obsx264->packet_data.num;
 	packet->type          = OBS_ENCODER_VIDEO;
-	packet->pts           = pic_out->i_pts;
-	packet->dts           = pic_out->i_dts;
+	packet->pts           = pic_out->i_pts - obsx264->pts_offset;
+	packet->dts           = pic_out->i_dts - obsx264->pts_offset;
 	packet->keyframe      = pic_out->b_keyframe != 0;
+	packet->priority      = priority;
+	packet->drop_priority = (priority <= NAL_PRIORITY_LOW) ?
+		priority : NAL_PRIORITY_HIGHEST;
 }
 
 static inline void init_pic_data(struct obs_x264 *obsx264, x264_picture_t *pic,
@@ -426,7 +662,13 @@ static inline void init_pic_data(struct obs_x264 *obsx264, x264_picture_t *pic,
 {
 	x264_picture_init(pic);
 
-	pic->i_pts = frame->pts;
+	pic->i_pts = frame->pts + obsx264->pts_offset;
+	obsx264->next_pts = pic->i_pts + 1;
+
+	if (frame->keyframe || obsx264->force_idr)
+		pic->i_type = X264_TYPE_IDR;
+	obsx264->force_idr = false;
+
 	pic->img.i_csp = obsx264->params.i_csp;
 
 	if (obsx264->params.i_csp == X264_CSP_NV12)
@@ -511,17 +753,21 @@ static bool obs_x264_video_info(void *data, struct video_scale_info *info)
 }
 
 struct obs_encoder_info obs_x264_encoder = {
-	.id         = "obs_x264",
-	.type       = OBS_ENCODER_VIDEO,
-	.codec      = "h264",
-	.getname    = obs_x264_getname,
-	.create     = obs_x264_create,
-	.destroy    = obs_x264_destroy,
-	.encode     = obs_x264_encode,
-	.properties = obs_x264_props,
-	.defaults   = obs_x264_defaults,
-	.update     = obs_x264_update,
-	.extra_data = obs_x264_extra_data,
-	.sei_data   = obs_x264_sei,
-	.video_info = obs_x264_video_info
+	.id              = "obs_x264",
+	.type            = OBS_ENCODER_VIDEO,
+	.codec           = "h264",
+	.caps            = OBS_ENCODER_CAP_AVCC,
+	.getname         = obs_x264_getname,
+	.create          = obs_x264_create,
+	.destroy         = obs_x264_destroy,
+	.encode          = obs_x264_encode,
+	.properties      = obs_x264_props,
+	.defaults        = obs_x264_defaults,
+	.update          = obs_x264_update,
+	.extra_data      = obs_x264_extra_data,
+	.sei_data        = obs_x264_sei,
+	.video_info      = obs_x264_video_info,
+	.set_bitrate     = obs_x264_set_bitrate,
+	.set_speed_level = obs_x264_set_speed_level,
+	.reset           = obs_x264_reset
 };
@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include <obs-avc.h>
+
+/*
+ * Measures how fast obs_avc_find_startcode walks through Annex-B H.264
+ * files, one result per file.  Without any files, a buffer that looks like
+ * encoded video is used instead: random slice data with a start code every
+ * few kilobytes.
+ *
+ *   avc-bench [passes] [file.h264 ...]
+ */
+
+#define RANDOM_SIZE  (64 * 1024 * 1024)
+#define NAL_INTERVAL 4096
+
+static void fill_buffer(uint8_t *data, size_t size)
+{
+	for (size_t i = 0; i < size; i++) {
+		data[i] = (uint8_t)rand();
+
+		/* emulation prevention keeps {0, 0, 0-3} out of real slices */
+		if (i >= 2 && data[i - 2] == 0 && data[i - 1] == 0 &&
+		    data[i] <= 3)
+			data[i] = 3 + (uint8_t)(rand() % 253);
+	}
+
+	for (size_t i = 0; i + 4 <= size; i += NAL_INTERVAL) {
+		data[i]     = 0;
+		data[i + 1] = 0;
+		data[i + 2] = 0;
+		data[i + 3] = 1;
+	}
+}
+
+static size_t scan_buffer(const uint8_t *data, size_t size)
+{
+	const uint8_t *end = data + size;
+	const uint8_t *p   = obs_avc_find_startcode(data, end);
+	size_t        count = 0;
+
+	while (p < end) {
+		count++;
+		p = obs_avc_find_startcode(p + 4, end);
+	}
+
+	return count;
+}
+
+static uint8_t *load_file(const char *path, size_t *size)
+{
+	FILE    *file = fopen(path, "rb");
+	uint8_t *data = NULL;
+	long    len;
+
+	if (!file)
+		return NULL;
+
+	fseek(file, 0, SEEK_END);
+	len = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	if (len > 0) {
+		data = bmalloc((size_t)len);
+		if (fread(data, 1, (size_t)len, file) != (size_t)len) {
+			bfree(data);
+			data = NULL;
+		}
+	}
+
+	fclose(file);
+	*size = (size_t)len;
+	return data;
+}
+
+static void bench_buffer(const char *name, const uint8_t *data, size_t size,
+		int passes)
+{
+	size_t   count = 0;
+	uint64_t start_time, elapsed;
+
+	start_time = os_gettime_ns();
+	for (int i = 0; i < passes; i++)
+		count += scan_buffer(data, size);
+	elapsed = os_gettime_ns() - start_time;
+
+	printf("%s: %d passes over %.1f MB, %d start codes per pass: "
+	       "%.2f ms per pass, %.1f MB/s\n",
+	       name, passes, (double)size / (1024.0 * 1024.0),
+	       (int)(count / passes),
+	       (double)elapsed / 1000000.0 / passes,
+	       (double)size * passes / (1024.0 * 1024.0) /
+	       ((double)elapsed / 1000000000.0));
+}
+
+int main(int argc, char *argv[])
+{
+	int     passes = argc > 1 ? atoi(argv[1]) : 20;
+	uint8_t *data;
+	size_t  size;
+	int     ret = 0;
+
+	if (passes <= 0) {
+		printf("usage: avc-bench [passes] [file.h264 ...]\n");
+		return 1;
+	}
+
+	if (argc <= 2) {
+		data = bmalloc(RANDOM_SIZE);
+		fill_buffer(data, RANDOM_SIZE);
+		bench_buffer("random data", data, RANDOM_SIZE, passes);
+		bfree(data);
+		return 0;
+	}
+
+	for (int i = 2; i < argc; i++) {
+		data = load_file(argv[i], &size);
+		if (!data) {
+			printf("%s: could not be read\n", argv[i]);
+			ret = 1;
+			continue;
+		}
+
+		bench_buffer(argv[i], data, size, passes);
+		bfree(data);
+	}
+
+	return ret;
+}
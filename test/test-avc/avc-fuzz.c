@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <obs.h>
+#include <obs-avc.h>
+
+/*
+ * Compares obs_avc_find_startcode against a plain byte-by-byte search on
+ * random buffers, and runs obs_parse_avc_packet on the same data.
+ *
+ *   avc-fuzz [iterations] [seed]
+ */
+
+#define MAX_SIZE 256
+
+static const uint8_t *ref_find_startcode(const uint8_t *p, const uint8_t *end)
+{
+	const uint8_t *out = end;
+
+	for (const uint8_t *cur = p; end - cur > 3; cur++) {
+		if (cur[0] == 0 && cur[1] == 0 && cur[2] == 1) {
+			out = cur;
+			break;
+		}
+	}
+
+	if (p < out && out < end && !out[-1]) out--;
+	return out;
+}
+
+/* mostly zeros and ones so that start codes and near misses are common */
+static inline uint8_t random_byte(void)
+{
+	int r = rand() % 8;
+	return r < 4 ? 0 : (r < 6 ? 1 : (uint8_t)rand());
+}
+
+static bool check_buffer(const uint8_t *data, size_t size)
+{
+	const uint8_t *end = data + size;
+	const uint8_t *p   = data;
+
+	/* walk every start code the way the AVC parser does */
+	while (true) {
+		const uint8_t *out      = obs_avc_find_startcode(p, end);
+		const uint8_t *expected = ref_find_startcode(p, end);
+
+		if (out != expected) {
+			printf("mismatch: size %d, offset %d: got %d, "
+			       "expected %d\n", (int)size, (int)(p - data),
+			       (int)(out - data), (int)(expected - data));
+			return false;
+		}
+
+		if (out == end)
+			break;
+		p = out + 1;
+	}
+
+	return true;
+}
+
+static void parse_buffer(const uint8_t *data, size_t size)
+{
+	struct encoder_packet src = {0};
+	struct encoder_packet dst = {0};
+
+	src.type = OBS_ENCODER_VIDEO;
+	src.data = (uint8_t*)data;
+	src.size = size;
+
+	obs_parse_avc_packet(&dst, &src);
+	obs_free_encoder_packet(&dst);
+}
+
+int main(int argc, char *argv[])
+{
+	/* extra room so the data can start at any alignment */
+	static uint8_t buffer[MAX_SIZE + 16];
+	long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+	unsigned seed   = argc > 2 ? (unsigned)atol(argv[2]) : 1;
+
+	srand(seed);
+
+	for (long i = 0; i < iterations; i++) {
+		size_t  offset = (size_t)(rand() % 16);
+		size_t  size   = (size_t)(rand() % (MAX_SIZE + 1));
+		uint8_t *data  = buffer + offset;
+
+		for (size_t j = 0; j < size; j++)
+			data[j] = random_byte();
+
+		if (!check_buffer(data, size)) {
+			printf("failed on iteration %ld (seed %u)\n", i, seed);
+			return 1;
+		}
+
+		parse_buffer(data, size);
+	}
+
+	printf("%ld buffers ok\n", iterations);
+	return 0;
+}
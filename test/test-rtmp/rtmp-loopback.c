@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+/* the network code is tested directly, without the module around it */
+#include "rtmp-multi-stream.c"
+
+/*
+ * Streams to two no-op sinks on 127.0.0.1 through the multi-destination
+ * RTMP output.  One sink reads everything it is sent, the other never reads
+ * anything.  The stalled destination has to drop its own frames while the
+ * other one still receives every frame.
+ *
+ *   rtmp-loopback [frames]
+ */
+
+#define FRAME_SIZE     (16 * 1024)
+#define FRAME_RATE     30
+#define KEYINT         30
+#define FRAME_SLEEP_MS 5
+#define SOCKET_BUFFER  (16 * 1024)
+#define WAIT_TIMEOUT_S 5
+
+const char *obs_module_text(const char *val)
+{
+	return val;
+}
+
+struct sink {
+	int             listen_fd;
+	int             fd;
+	bool            reading;
+	pthread_t       thread;
+	volatile long   received;
+};
+
+static bool sink_listen(struct sink *sink, bool reading)
+{
+	struct sockaddr_in addr = {0};
+	int                size = SOCKET_BUFFER;
+
+	sink->fd        = -1;
+	sink->reading   = reading;
+	sink->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (sink->listen_fd == -1)
+		return false;
+
+	/* accepted sockets keep the receive buffer of the listening one */
+	if (!reading)
+		setsockopt(sink->listen_fd, SOL_SOCKET, SO_RCVBUF, &size,
+				sizeof(size));
+
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	return bind(sink->listen_fd, (struct sockaddr*)&addr,
+			sizeof(addr)) == 0 &&
+		listen(sink->listen_fd, 1) == 0;
+}
+
+static void *sink_thread(void *data)
+{
+	struct sink *sink = data;
+	char        buf[64 * 1024];
+	ssize_t     ret;
+
+	sink->fd = accept(sink->listen_fd, NULL, NULL);
+	if (sink->fd == -1 || !sink->reading)
+		return NULL;
+
+	while ((ret = recv(sink->fd, buf, sizeof(buf), 0)) > 0)
+		os_atomic_set_long(&sink->received,
+				sink->received + (long)ret);
+
+	return NULL;
+}
+
+static void sink_close(struct sink *sink)
+{
+	shutdown(sink->listen_fd, SHUT_RDWR);
+	if (sink->fd != -1)
+		shutdown(sink->fd, SHUT_RDWR);
+	pthread_join(sink->thread, NULL);
+
+	if (sink->fd != -1)
+		close(sink->fd);
+	close(sink->listen_fd);
+}
+
+/* connects a destination to a sink and hands it to the network thread the
+ * way update_connections does once the RTMP handshake is done */
+static struct rtmp_destination *add_destination(
+		struct rtmp_multi_stream *stream, struct sink *sink)
+{
+	struct rtmp_destination *dest = bzalloc(sizeof(*dest));
+	struct sockaddr_in      addr;
+	socklen_t               len  = sizeof(addr);
+	int                     size = SOCKET_BUFFER;
+
+	dest->stream = stream;
+	dest->fd     = -1;
+	dstr_copy(&dest->path, "rtmp://127.0.0.1/loopback");
+	RTMP_Init(&dest->rtmp);
+	da_push_back(stream->dests, &dest);
+
+	getsockname(sink->listen_fd, (struct sockaddr*)&addr, &len);
+
+	dest->fd = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(dest->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+	if (connect(dest->fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+		return NULL;
+
+	fcntl(dest->fd, F_SETFL, fcntl(dest->fd, F_GETFL, 0) | O_NONBLOCK);
+
+	dest->rtmp.m_sb.sb_socket    = dest->fd;
+	dest->rtmp.m_bCustomSend     = true;
+	dest->rtmp.m_customSendFunc  = buffer_rtmp_data;
+	dest->rtmp.m_customSendParam = dest;
+
+	activate_destination(dest);
+	return dest;
+}
+
+static void send_frame(struct rtmp_multi_stream *stream, uint8_t *data,
+		int64_t frame)
+{
+	struct encoder_packet packet = {0};
+
+	packet.type          = OBS_ENCODER_VIDEO;
+	packet.data          = data;
+	packet.size          = FRAME_SIZE;
+	packet.pts           = frame;
+	packet.dts           = frame;
+	packet.timebase_num  = 1;
+	packet.timebase_den  = FRAME_RATE;
+	packet.dts_usec      = frame * 1000000 / FRAME_RATE;
+	packet.keyframe      = (frame % KEYINT) == 0;
+	packet.priority      = packet.keyframe ?
+		OBS_NAL_PRIORITY_HIGHEST : OBS_NAL_PRIORITY_HIGH;
+	packet.drop_priority = packet.priority;
+
+	rtmp_multi_stream_data(stream, &packet);
+}
+
+int main(int argc, char *argv[])
+{
+	int64_t                  frames = argc > 1 ? atol(argv[1]) : 150;
+	struct rtmp_multi_stream *stream;
+	struct rtmp_destination  *fast, *stalled;
+	struct sink              fast_sink, stalled_sink;
+	uint8_t                  *data;
+	uint64_t                 timeout;
+	long                     expected;
+	int                      ret = 1;
+
+	if (frames <= 0) {
+		printf("usage: rtmp-loopback [frames]\n");
+		return 1;
+	}
+
+	if (!sink_listen(&fast_sink, true) ||
+	    !sink_listen(&stalled_sink, false)) {
+		printf("failed to listen on 127.0.0.1\n");
+		return 1;
+	}
+
+	pthread_create(&fast_sink.thread, NULL, sink_thread, &fast_sink);
+	pthread_create(&stalled_sink.thread, NULL, sink_thread,
+			&stalled_sink);
+
+	stream = rtmp_multi_stream_create(NULL, NULL);
+	stream->drop_threshold_usec = 1000000;
+	stream->reconnect_delay_ns  = 1000000000ULL;
+
+	fast    = add_destination(stream, &fast_sink);
+	stalled = add_destination(stream, &stalled_sink);
+	if (!fast || !stalled) {
+		printf("failed to connect to the sinks\n");
+		goto cleanup;
+	}
+
+	pthread_create(&stream->net_thread, NULL, network_thread, stream);
+	stream->active = true;
+
+	data = bzalloc(FRAME_SIZE);
+	for (int64_t i = 0; i < frames; i++) {
+		send_frame(stream, data, i);
+		os_sleep_ms(FRAME_SLEEP_MS);
+	}
+	bfree(data);
+
+	/* every frame carries at least its own data */
+	expected = (long)(frames * FRAME_SIZE);
+	timeout  = os_gettime_ns() + WAIT_TIMEOUT_S * 1000000000ULL;
+	while (os_atomic_load_long(&fast_sink.received) < expected &&
+	       os_gettime_ns() < timeout)
+		os_sleep_ms(10);
+
+	pthread_mutex_lock(&stream->stats_mutex);
+	printf("reading sink:  %ld bytes received, %d frames dropped\n",
+			os_atomic_load_long(&fast_sink.received),
+			fast->stats.dropped_frames);
+	printf("stalled sink:  %d frames dropped, %d packets buffered\n",
+			stalled->stats.dropped_frames,
+			(int)stalled->stats.buffered_packets);
+
+	if (fast->stats.dropped_frames != 0)
+		printf("the reading sink lost frames\n");
+	else if (os_atomic_load_long(&fast_sink.received) < expected)
+		printf("the reading sink was held up by the stalled one\n");
+	else if (stalled->stats.dropped_frames == 0)
+		printf("the stalled sink never dropped frames\n");
+	else
+		ret = 0;
+	pthread_mutex_unlock(&stream->stats_mutex);
+
+	rtmp_multi_stream_stop(stream);
+
+cleanup:
+	rtmp_multi_stream_destroy(stream);
+	sink_close(&fast_sink);
+	sink_close(&stalled_sink);
+
+	printf("%s\n", ret == 0 ? "ok" : "failed");
+	return ret;
+}